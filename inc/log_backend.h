@@ -0,0 +1,225 @@
+#ifndef CBOR_LOG_BACKEND_H
+#define CBOR_LOG_BACKEND_H
+
+#include "reclog.h"
+#include "rec_sink.h"
+#include "ring_buffer.h"
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace RECLOG
+{
+    struct RecordHead
+    {
+        uint32_t size; // header included, never equals REC_RING_WRAP
+        uint8_t type;
+        uint8_t flags;
+        // leading payload bytes that differ between repeats of one record, time and thread.
+        uint16_t stamp;
+        uint32_t site;
+        DiskFileCluster *dest;
+    };
+
+    // payload of records too large for the ring, owned by the record.
+    struct RecordBlock
+    {
+        unsigned char *data;
+        size_t len;
+    };
+
+    // payload of records with blobs: this, count RecordParts, then the inline bytes.
+    struct RecordGather
+    {
+        uint32_t count;
+        uint32_t len;
+    };
+
+    // a blob going in at offset of the inline bytes, owner is a reference of its own.
+    struct RecordPart
+    {
+        size_t offset;
+        const void *data;
+        size_t len;
+        std::shared_ptr<const void> *owner;
+    };
+
+    enum RecordFlag : uint8_t
+    {
+        REC_FLAG_BLOCK = 1,
+        REC_FLAG_DEFERRED = 2,
+        // same site and text as the one before it means a repeat.
+        REC_FLAG_COLLAPSE = 4,
+        REC_FLAG_GATHER = 8
+    };
+
+    // the sinks records for one destination fan out to, its own screen or file sink first.
+    struct Route
+    {
+        DiskFileCluster *dest;
+        LogSink *primary;
+        std::vector<std::shared_ptr<LogSink>> sinks;
+        // just the primary, the writer batches such records as if there was no route.
+        bool Plain() const
+        {
+            return sinks.size() == 1 && sinks[0].get() == primary;
+        }
+    };
+    using RouteTable = std::vector<Route>;
+
+    size_t WriteRecord(CodeType type, DiskFileCluster *dest, const void *src, size_t len);
+    // a CBOR record in diagnostic notation on one line, false if it does not decode.
+    bool RenderCbor(const void *src, size_t len, std::string &out);
+    void DeliverRecord(CodeType type, DiskFileCluster *dest, const void *src, size_t len, uint8_t flags);
+
+    // producers copy finished records into their own ring, a single writer
+    // running on RECONFIG::g_expool drains all rings into the files.
+    class LogBackend
+    {
+    public:
+        static LogBackend &Instance();
+
+        void Start(FunctionPool &pool);
+        void Stop();
+        void Flush();
+        // durable asks for a sync of every file written so far, false once timeout_ms passed.
+        bool Flush(bool durable, int timeout_ms);
+        void Submit(CodeType type, DiskFileCluster *dest, const void *src, size_t len, uint8_t flags = 0,
+                    uint32_t site = REC_NO_SITE, uint16_t stamp = 0);
+        // the blobs are written in place of a copy, each owner is kept until then.
+        void Submit(CodeType type, DiskFileCluster *dest, const void *src, size_t len, const std::vector<BlobRef> &blobs,
+                    uint32_t site = REC_NO_SITE);
+        // copy on write, the writer picks a new table up before its next pass.
+        void AddSink(DiskFileCluster *dest, std::shared_ptr<LogSink> sink);
+        void RemoveSink(DiskFileCluster *dest, const std::shared_ptr<LogSink> &sink);
+        std::vector<std::shared_ptr<LogSink>> Sinks(DiskFileCluster *dest);
+        // screen records lost to the overload policy, clusters count their own.
+        size_t ScreenDropped() const
+        {
+            return m_screen_dropped.load(std::memory_order_relaxed);
+        }
+
+    private:
+        struct ThreadQueue
+        {
+            explicit ThreadQueue(size_t capacity) : ring(capacity), busy(false), orphaned(false), seed(0x9E3779B9u) {}
+            RingBuffer ring;
+            std::atomic_bool busy;
+            std::atomic_bool orphaned;
+            // producer only, picks the records SAMPLE keeps.
+            uint32_t seed;
+        };
+
+        // last collapsible record written to one destination and how often it came again since.
+        struct Repeat
+        {
+            DiskFileCluster *dest = nullptr;
+            // false after anything else went to dest.
+            bool armed = false;
+            uint32_t site = 0;
+            std::string text;
+            size_t count = 0;
+        };
+
+        // where a drop counter was when its marker was last written.
+        struct DropReport
+        {
+            size_t screen = 0;
+            size_t cbor = 0;
+            size_t log = 0;
+            size_t raw = 0;
+        };
+
+        // consecutive records for one file, written with a single WriteBatch.
+        struct Batch
+        {
+            DiskFileCluster *dest = nullptr;
+            IoSpan spans[REC_MAX_IOV];
+            size_t count = 0;
+            size_t bytes = 0;
+            std::vector<unsigned char *> blocks;
+            std::vector<std::shared_ptr<const void> *> owners;
+        };
+
+        std::atomic_bool m_running{false};
+        bool m_alive{false};
+        std::mutex m_lock;
+        std::condition_variable m_wakeup;
+        std::condition_variable m_finish;
+        uint64_t m_flush_req{0};
+        uint64_t m_flush_done{0};
+        uint64_t m_sync_req{0};
+        uint64_t m_sync_done{0};
+
+        std::mutex m_qlock;
+        std::vector<std::unique_ptr<ThreadQueue>> m_queues;
+        std::atomic_size_t m_qversion{0};
+        // only touched by the writer.
+        std::vector<ThreadQueue *> m_snapshot;
+        std::vector<DiskFileCluster *> m_dirty;
+        std::vector<DiskFileCluster *> m_unsynced;
+        size_t m_version{0};
+        Batch m_batch;
+        // group commit policy and progress, writer only.
+        long long m_sync_ms{0};
+        size_t m_sync_bytes{0};
+        size_t m_unsynced_bytes{0};
+        long long m_last_sync{0};
+        // screen overload policy and the dropped-record markers.
+        OverloadPolicy m_screen_policy;
+        std::atomic_size_t m_screen_dropped{0};
+        DropReport m_reported;
+        long long m_last_report{0};
+        bool m_collapse{false};
+        // when ticks were last mapped to the wall clock.
+        long long m_last_calibrate{0};
+        // period of the stats record, 0 writes none.
+        long long m_stats_ms{0};
+        long long m_last_stats{0};
+        std::vector<Repeat> m_repeats;
+
+        std::mutex m_rlock;
+        std::shared_ptr<const RouteTable> m_routes{std::make_shared<RouteTable>()};
+        std::atomic_size_t m_rversion{0};
+        // only touched by the writer.
+        std::shared_ptr<const RouteTable> m_route_snapshot{m_routes};
+        size_t m_route_version{0};
+        bool m_sinks_dirty{false};
+        bool m_sinks_unsynced{false};
+
+        ThreadQueue *LocalQueue();
+        // false when the record has to be dispatched by the caller.
+        bool Enqueue(CodeType type, DiskFileCluster *dest, const void *src, size_t len, uint8_t flags, uint32_t site,
+                     uint16_t stamp, const std::vector<BlobRef> *blobs);
+        void Push(ThreadQueue &q, CodeType type, DiskFileCluster *dest, const void *src, size_t len, uint8_t flags,
+                  uint32_t site, uint16_t stamp, const std::vector<BlobRef> *blobs);
+        unsigned char *MakeRoom(ThreadQueue &q, const OverloadPolicy &policy, size_t size);
+        bool DropOldest(ThreadQueue &q);
+        void CountDropped(DiskFileCluster *dest, size_t n);
+        void ReportDropped();
+        void ReportStats();
+        bool Collapse(ThreadQueue &q, const RecordHead &head, const unsigned char *payload);
+        void ReportRepeat(Repeat &rep);
+        void ReportRepeats();
+        void Run();
+        size_t DrainAll();
+        size_t Drain(ThreadQueue &q);
+        void Consume(const RecordHead &head, const unsigned char *payload, const Route *route);
+        void Discard(const RecordHead &head, const unsigned char *payload);
+        static size_t SpansOf(const RecordHead &head, const unsigned char *payload);
+        void BatchGather(const unsigned char *payload);
+        void Dispatch(CodeType type, DiskFileCluster *dest, const void *src, size_t len, uint8_t flags, uint32_t site);
+        void Fanout(const Route &route, CodeType type, const void *src, size_t len, uint8_t flags, uint32_t site);
+        Route &EditRoute(RouteTable &table, DiskFileCluster *dest);
+        void RefreshRoutes();
+        void WriteBatch();
+        void MarkDirty(DiskFileCluster *dest, size_t bytes);
+        void FlushFiles();
+        void SyncFiles();
+        bool SyncDue() const;
+        void Refresh();
+    };
+}
+
+#endif
@@ -0,0 +1,228 @@
+#ifndef CBOR_REC_BUFFER_H
+#define CBOR_REC_BUFFER_H
+
+#include "encoder.h"
+#include "rec_format.h"
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+namespace RECLOG
+{
+    // buffers kept per thread and how large one may grow before it is dropped instead of kept.
+    constexpr size_t REC_POOL_DEPTH = 8;
+    constexpr size_t REC_POOL_KEEP_BYTES = 1 << 16;
+    constexpr size_t REC_POOL_RESERVE = 4096;
+
+    // std::ostream writing straight into a std::string that keeps its capacity.
+    class TextBuffer : private std::streambuf
+    {
+    public:
+        TextBuffer() : os(this)
+        {
+            str.reserve(REC_POOL_RESERVE);
+        }
+
+        std::string str;
+        std::ostream os;
+
+        // straight into str while the stream is in its fresh state, through the stream otherwise.
+        // floats come out as their shortest round-trip text then, unlike the stream's 6 digits.
+        template <typename T>
+        void Put(const T &v)
+        {
+            if (!(PlainFormat(os) && AppendPlain(str, v)))
+            {
+                os << v;
+            }
+        }
+
+        void Reset()
+        {
+            static const std::ostream fresh(nullptr);
+            str.clear();
+            os.clear();
+            os.copyfmt(fresh);
+        }
+
+        size_t Capacity() const
+        {
+            return str.capacity();
+        }
+
+    private:
+        int_type overflow(int_type ch) override
+        {
+            if (!traits_type::eq_int_type(ch, traits_type::eof()))
+            {
+                str.push_back(traits_type::to_char_type(ch));
+            }
+            return traits_type::not_eof(ch);
+        }
+
+        std::streamsize xsputn(const char *s, std::streamsize n) override
+        {
+            str.append(s, static_cast<size_t>(n));
+            return n;
+        }
+    };
+
+    // cbor output that stays allocated between records.
+    class CborBuffer
+    {
+    public:
+        CborBuffer() : buf(REC_POOL_RESERVE) {}
+
+        cborio::ustring buf;
+
+        void Reset()
+        {
+            buf.clear();
+        }
+
+        size_t Capacity() const
+        {
+            return buf.capacity();
+        }
+    };
+
+    // raw bytes of Codec_RAW and the arguments of deferred Codec_STR.
+    class ByteBuffer
+    {
+    public:
+        ByteBuffer()
+        {
+            str.reserve(REC_POOL_RESERVE);
+        }
+
+        std::string str;
+
+        void Reset()
+        {
+            str.clear();
+        }
+
+        size_t Capacity() const
+        {
+            return str.capacity();
+        }
+    };
+
+    // per thread free list, codecs borrow on construction and give back on destruction.
+    template <typename T>
+    class BufferPool
+    {
+    public:
+        static T *Acquire()
+        {
+            if (state() == POOL_GONE)
+            {
+                return new T();
+            }
+            auto &pool = Local();
+            if (pool.m_free.empty())
+            {
+                return new T();
+            }
+            auto buf = pool.m_free.back();
+            pool.m_free.pop_back();
+            return buf;
+        }
+
+        static void Release(T *buf)
+        {
+            if (buf == nullptr)
+            {
+                return;
+            }
+            // released after the pool of this thread went away, or grown too large to keep.
+            if (state() == POOL_GONE || buf->Capacity() > REC_POOL_KEEP_BYTES ||
+                Local().m_free.size() >= REC_POOL_DEPTH)
+            {
+                delete buf;
+                return;
+            }
+            buf->Reset();
+            Local().m_free.push_back(buf);
+        }
+
+    private:
+        enum PoolState
+        {
+            POOL_NONE,
+            POOL_LIVE,
+            POOL_GONE
+        };
+
+        std::vector<T *> m_free;
+
+        BufferPool()
+        {
+            m_free.reserve(REC_POOL_DEPTH);
+            state() = POOL_LIVE;
+        }
+
+        ~BufferPool()
+        {
+            state() = POOL_GONE;
+            for (auto buf : m_free)
+            {
+                delete buf;
+            }
+        }
+
+        static PoolState &state()
+        {
+            // trivially destructible, still readable while thread locals go away.
+            static thread_local PoolState flag = POOL_NONE;
+            return flag;
+        }
+
+        static BufferPool &Local()
+        {
+            static thread_local BufferPool pool;
+            return pool;
+        }
+    };
+
+    template <typename T>
+    class PooledBuffer
+    {
+    public:
+        PooledBuffer() : m_buf(BufferPool<T>::Acquire()) {}
+        explicit PooledBuffer(bool acquire) : m_buf(acquire ? BufferPool<T>::Acquire() : nullptr) {}
+        ~PooledBuffer()
+        {
+            BufferPool<T>::Release(m_buf);
+        }
+
+        PooledBuffer(PooledBuffer &&other) : m_buf(other.m_buf)
+        {
+            other.m_buf = nullptr;
+        }
+        PooledBuffer(const PooledBuffer &) = delete;
+        PooledBuffer &operator=(const PooledBuffer &) = delete;
+
+        T &operator*() const
+        {
+            return *m_buf;
+        }
+
+        T *operator->() const
+        {
+            return m_buf;
+        }
+
+        // nullptr once moved from.
+        T *get() const
+        {
+            return m_buf;
+        }
+
+    private:
+        T *m_buf;
+    };
+}
+
+#endif
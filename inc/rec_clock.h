@@ -0,0 +1,68 @@
+#ifndef CBOR_REC_CLOCK_H
+#define CBOR_REC_CLOCK_H
+
+#include <chrono>
+#include <cstdint>
+
+#if !defined(RECLOG_NO_TSC) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define RECLOG_USE_TSC 1
+#elif !defined(RECLOG_NO_TSC) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define RECLOG_USE_TSC 1
+#endif
+
+namespace RECLOG
+{
+    // maps raw ticks to wall time, wall_ns = wall + (ticks - base) * ns_per_tick.
+    struct ClockCalibration
+    {
+        uint64_t base;
+        long long wall;
+        double ns_per_tick;
+    };
+
+    // the hot path only reads ticks, the TSC where there is one and steady_clock otherwise.
+    // the writer recalibrates once a second so the mapping follows the wall clock, never backwards.
+    class Clock
+    {
+    public:
+        static uint64_t Ticks()
+        {
+#ifdef RECLOG_USE_TSC
+            return __rdtsc();
+#else
+            return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                             std::chrono::steady_clock::now().time_since_epoch())
+                                             .count());
+#endif
+        }
+
+        static long long ToNanos(uint64_t ticks, const ClockCalibration &cal)
+        {
+            auto delta = static_cast<double>(static_cast<int64_t>(ticks - cal.base));
+            return cal.wall + static_cast<long long>(delta * cal.ns_per_tick);
+        }
+
+        static long long ToNanos(uint64_t ticks)
+        {
+            return ToNanos(ticks, Current());
+        }
+
+        // nanoseconds since epoch.
+        static long long Now()
+        {
+            return ToNanos(Ticks());
+        }
+
+        static ClockCalibration Current();
+        // one read without retrying or calibrating, async-signal-safe. false while there is no
+        // calibration yet or Calibrate is rewriting it.
+        static bool TryCurrent(ClockCalibration &cal);
+        // bumped by every Calibrate, files note the mapping again when it changed.
+        static uint32_t Generation();
+        static void Calibrate();
+    };
+}
+
+#endif
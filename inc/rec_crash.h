@@ -0,0 +1,42 @@
+#ifndef CBOR_REC_CRASH_H
+#define CBOR_REC_CRASH_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace RECLOG
+{
+    struct LogSite;
+
+    // records kept per thread, each thread writes only its own slots.
+    constexpr size_t REC_CRASH_SLOTS = 64;
+    // threads with a ring at the same time, later ones keep none until a ring is given back.
+    constexpr size_t REC_CRASH_THREADS = 64;
+    // longer records keep their head.
+    constexpr size_t REC_CRASH_BYTES = 240;
+
+    // crash file, one item per line, crashsym symbolizes and renders it:
+    //     REC crash <signal name> <signal number> pid <pid> start <start time in ms>
+    //     clock <base ticks> <wall ns> <ns per tick as hex bits>, or clock uncalibrated
+    //     frame <return address>
+    //     map <line of /proc/self/maps>
+    //     text <record>, '\n' and '\\' escaped
+    //     args <file> <line> <verbosity> <deferred record in hex>
+    class CrashRing
+    {
+    public:
+        // copies a STR record into the calling thread's ring. CBO and RAW records are binary and
+        // not kept. the ring is allocated on the thread's first record, after that it never blocks
+        // or allocates. a thread that exits gives it back, records included, for the next thread.
+        static void Note(const LogSite *site, bool deferred, const void *src, size_t len);
+        // preopened so the handler never opens files, Close removes it again on a clean exit.
+        static bool Open(const char *path);
+        static void Close();
+        // async-signal-safe, write(2) on the preopened file only.
+        static void Dump(int signal_number, const char *signal_name, void *const *callstack, int frames);
+        // the text and args lines of the slots still intact, oldest first across all threads.
+        static void DumpRecords(int fd);
+    };
+}
+
+#endif
@@ -0,0 +1,283 @@
+#ifndef CBOR_REC_DEFERRED_H
+#define CBOR_REC_DEFERRED_H
+
+#include "rec_clock.h"
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <ios>
+#include <sstream>
+#include <string>
+#include <type_traits>
+
+namespace RECLOG
+{
+    class DiskFileCluster;
+    enum class CodeType;
+
+    // what records without a site carry in place of its id.
+    constexpr uint32_t REC_NO_SITE = 0xFFFFFFFFu;
+    // room for the file:line column of the preamble.
+    constexpr size_t REC_SITE_WHERE = 48;
+
+    // one per RECLOG/RECFILE expansion whatever the codec, registered on first use and
+    // alive as long as the program. records refer to it by id.
+    struct LogSite
+    {
+        LogSite(const char *file, unsigned line, int verbosity, CodeType codec);
+        const char *file;
+        // file without its directories.
+        const char *name;
+        unsigned line;
+        int verbosity;
+        CodeType codec;
+        uint32_t id;
+        // preamble column, formatted once.
+        char where[REC_SITE_WHERE];
+    };
+
+    class SiteRegistry
+    {
+    public:
+        static uint32_t Add(const LogSite *site);
+        static uint32_t Size();
+        static const LogSite *At(uint32_t id);
+    };
+
+    // layout of binary .log files:
+    // "RECBIN02" then frames of [u8 kind][u32 length][payload], little endian.
+    constexpr char REC_BIN_MAGIC[] = "RECBIN02";
+    constexpr size_t REC_BIN_MAGIC_LEN = 8;
+    // site id, raw clock ticks and thread index lead every record.
+    constexpr size_t REC_DEFERRED_PREFIX = 16;
+
+    enum FrameKind : uint8_t
+    {
+        FRAME_START = 1,
+        FRAME_SITE = 2,
+        FRAME_RECORD = 3,
+        // [u64 base ticks][i64 wall ns][f64 ns per tick], maps the ticks of the records after it.
+        FRAME_CLOCK = 4,
+        // [u32 thread index][name], records of the thread show the name from here on.
+        FRAME_THREAD = 5
+    };
+
+    enum ArgTag : uint8_t
+    {
+        ARG_CHAR = 1,
+        ARG_BOOL,
+        ARG_INT,
+        ARG_UINT,
+        ARG_FLOAT,
+        ARG_DOUBLE,
+        ARG_STRING,
+        ARG_POINTER,
+        ARG_MANIP,
+        ARG_FORMAT
+    };
+
+    // which parts of the stream state an ARG_FORMAT carries, flags are stored as the toggled bits.
+    enum FormatField : uint8_t
+    {
+        FORMAT_FLAGS = 1,
+        FORMAT_PRECISION = 2,
+        FORMAT_WIDTH = 4,
+        FORMAT_FILL = 8
+    };
+
+    using Manipulator = std::ios_base &(*)(std::ios_base &);
+
+    inline void store_le(unsigned char *dst, uint64_t v, size_t n)
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            dst[i] = static_cast<unsigned char>(v >> (8 * i));
+        }
+    }
+
+    inline uint64_t load_le(const unsigned char *src, size_t n)
+    {
+        uint64_t v = 0;
+        for (size_t i = 0; i < n; ++i)
+        {
+            v |= static_cast<uint64_t>(src[i]) << (8 * i);
+        }
+        return v;
+    }
+
+    int FindManipulator(Manipulator f);
+
+    // captures Codec_STR arguments as tagged bytes, formatting is left to RenderArgs.
+    class ArgWriter
+    {
+    public:
+        explicit ArgWriter(std::string &buf) : m_buf(buf) {}
+
+        void put(bool v)
+        {
+            m_buf.push_back(static_cast<char>(ARG_BOOL));
+            m_buf.push_back(v ? 1 : 0);
+        }
+
+        void put(char v)
+        {
+            m_buf.push_back(static_cast<char>(ARG_CHAR));
+            m_buf.push_back(v);
+        }
+
+        void put(signed char v)
+        {
+            put(static_cast<char>(v));
+        }
+
+        void put(unsigned char v)
+        {
+            put(static_cast<char>(v));
+        }
+
+        template <typename T,
+                  typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type * = nullptr>
+        void put(T v)
+        {
+            m_buf.push_back(static_cast<char>(ARG_INT));
+            auto u = static_cast<uint64_t>(static_cast<int64_t>(v));
+            // zigzag, small magnitudes of either sign stay short.
+            put_varint((u << 1) ^ (static_cast<int64_t>(v) < 0 ? ~static_cast<uint64_t>(0) : 0));
+        }
+
+        template <typename T,
+                  typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value>::type * = nullptr>
+        void put(T v)
+        {
+            m_buf.push_back(static_cast<char>(ARG_UINT));
+            put_varint(static_cast<uint64_t>(v));
+        }
+
+        void put(float v)
+        {
+            m_buf.push_back(static_cast<char>(ARG_FLOAT));
+            put_raw(&v, sizeof(v));
+        }
+
+        template <typename T,
+                  typename std::enable_if<std::is_same<T, double>::value || std::is_same<T, long double>::value>::type * = nullptr>
+        void put(T v)
+        {
+            double d = static_cast<double>(v);
+            m_buf.push_back(static_cast<char>(ARG_DOUBLE));
+            put_raw(&d, sizeof(d));
+        }
+
+        void put(const char *v)
+        {
+            put_string(v, strlen(v));
+        }
+
+        void put(char *v)
+        {
+            put_string(v, strlen(v));
+        }
+
+        void put(const std::string &v)
+        {
+            put_string(v.data(), v.size());
+        }
+
+        void put(const void *v)
+        {
+            m_buf.push_back(static_cast<char>(ARG_POINTER));
+            put_varint(static_cast<uint64_t>(reinterpret_cast<uintptr_t>(v)));
+        }
+
+        void put(Manipulator f)
+        {
+            auto idx = FindManipulator(f);
+            if (idx >= 0)
+            {
+                m_buf.push_back(static_cast<char>(ARG_MANIP));
+                m_buf.push_back(static_cast<char>(idx));
+            }
+        }
+
+        // anything else that streams, formatted right away.
+        template <typename T,
+                  typename std::enable_if<!std::is_arithmetic<T>::value &&
+                                          !std::is_pointer<T>::value &&
+                                          !std::is_array<T>::value &&
+                                          !std::is_same<T, std::string>::value>::type * = nullptr>
+        void put(const T &v)
+        {
+            std::ostringstream ss;
+            ss << v;
+            auto str = ss.str();
+            if (!str.empty())
+            {
+                put_string(str.data(), str.size());
+            }
+            // std::setw, std::setprecision and friends only change the state,
+            // keep what they changed relative to a fresh stream.
+            std::ostringstream fresh;
+            auto flags = static_cast<uint64_t>(ss.flags() ^ fresh.flags());
+            char changed = (flags != 0 ? FORMAT_FLAGS : 0) |
+                           (ss.precision() != fresh.precision() ? FORMAT_PRECISION : 0) |
+                           (ss.width() != fresh.width() ? FORMAT_WIDTH : 0) |
+                           (ss.fill() != fresh.fill() ? FORMAT_FILL : 0);
+            if (changed != 0)
+            {
+                m_buf.push_back(static_cast<char>(ARG_FORMAT));
+                m_buf.push_back(changed);
+                put_varint(flags);
+                put_varint(static_cast<uint64_t>(ss.precision()));
+                put_varint(static_cast<uint64_t>(ss.width()));
+                m_buf.push_back(ss.fill());
+            }
+        }
+
+        template <typename T,
+                  typename std::enable_if<std::is_pointer<T>::value &&
+                                          !std::is_same<typename std::decay<T>::type, char *>::value &&
+                                          !std::is_same<typename std::decay<T>::type, const char *>::value>::type * = nullptr>
+        void put(const T &v)
+        {
+            put(static_cast<const void *>(v));
+        }
+
+    private:
+        std::string &m_buf;
+
+        void put_varint(uint64_t v)
+        {
+            while (v >= 0x80)
+            {
+                m_buf.push_back(static_cast<char>(v | 0x80));
+                v >>= 7;
+            }
+            m_buf.push_back(static_cast<char>(v));
+        }
+
+        void put_raw(const void *v, size_t len)
+        {
+            m_buf.append(static_cast<const char *>(v), len);
+        }
+
+        void put_string(const char *v, size_t len)
+        {
+            m_buf.push_back(static_cast<char>(ARG_STRING));
+            put_varint(len);
+            m_buf.append(v, len);
+        }
+    };
+
+    // streams captured arguments the way Codec_STR would have, false on malformed input.
+    bool RenderArgs(const unsigned char *data, size_t len, std::ostream &os);
+
+    // text line of a deferred record, preamble included. an empty thread name shows the index.
+    bool RenderDeferred(const unsigned char *data, size_t len, long long start_time, const ClockCalibration &cal,
+                        const std::string &thread, const char *file, unsigned line, int verbosity, std::string &out);
+    // same with the sites, threads and clock of this process.
+    bool RenderDeferred(const unsigned char *data, size_t len, std::string &out);
+
+    void WriteDeferred(DiskFileCluster *dest, const void *src, size_t len);
+}
+
+#endif
@@ -0,0 +1,147 @@
+#ifndef CBOR_REC_FORMAT_H
+#define CBOR_REC_FORMAT_H
+
+#include <cstdint>
+#include <cstring>
+#include <ios>
+#include <string>
+#include <type_traits>
+
+namespace RECLOG
+{
+    // room every Format* call needs at buf.
+    constexpr size_t REC_NUMBER_CHARS = 32;
+
+    inline const char *digit_pairs()
+    {
+        static const char pairs[] = "0001020304050607080910111213141516171819202122232425262728293031323334353637383940414243444546474849"
+                                    "5051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+        return pairs;
+    }
+
+    // to_chars for integers, two digits per step from the back. returns the chars written.
+    inline size_t FormatUInt(char *buf, uint64_t v)
+    {
+        char tmp[20];
+        auto pos = sizeof(tmp);
+        while (v >= 100)
+        {
+            pos -= 2;
+            memcpy(tmp + pos, digit_pairs() + 2 * (v % 100), 2);
+            v /= 100;
+        }
+        if (v >= 10)
+        {
+            pos -= 2;
+            memcpy(tmp + pos, digit_pairs() + 2 * v, 2);
+        }
+        else
+        {
+            tmp[--pos] = static_cast<char>('0' + v);
+        }
+        memcpy(buf, tmp + pos, sizeof(tmp) - pos);
+        return sizeof(tmp) - pos;
+    }
+
+    inline size_t FormatInt(char *buf, int64_t v)
+    {
+        if (v >= 0)
+        {
+            return FormatUInt(buf, static_cast<uint64_t>(v));
+        }
+        *buf = '-';
+        return 1 + FormatUInt(buf + 1, 0 - static_cast<uint64_t>(v));
+    }
+
+    // shortest text that reads back as the same value (Grisu2), fixed notation for
+    // decimal exponents -5 to 16 and 1.5e+20 style outside, like %g without a precision.
+    size_t FormatDouble(char *buf, double v);
+    size_t FormatFloat(char *buf, float v);
+
+    // the state of a fresh stream, the only one the fast paths take over. an explicit
+    // setprecision(6) looks the same, floats still get the round-trip text then.
+    inline bool PlainFormat(const std::ios_base &os)
+    {
+        return os.flags() == (std::ios_base::dec | std::ios_base::skipws) && os.width() == 0 && os.precision() == 6;
+    }
+
+    // integers that stream as numbers, the character types and bool do not.
+    template <typename T>
+    struct IsPlainInt
+        : std::integral_constant<bool, std::is_integral<T>::value && !std::is_same<T, bool>::value &&
+                                           !std::is_same<T, wchar_t>::value && !std::is_same<T, char16_t>::value &&
+                                           !std::is_same<T, char32_t>::value && (sizeof(T) > 1)>
+    {
+    };
+
+    template <typename T, typename std::enable_if<IsPlainInt<T>::value && std::is_signed<T>::value>::type * = nullptr>
+    size_t FormatNumber(char *buf, T v)
+    {
+        return FormatInt(buf, static_cast<int64_t>(v));
+    }
+
+    template <typename T, typename std::enable_if<IsPlainInt<T>::value && std::is_unsigned<T>::value>::type * = nullptr>
+    size_t FormatNumber(char *buf, T v)
+    {
+        return FormatUInt(buf, static_cast<uint64_t>(v));
+    }
+
+    inline size_t FormatNumber(char *buf, double v)
+    {
+        return FormatDouble(buf, v);
+    }
+
+    inline size_t FormatNumber(char *buf, float v)
+    {
+        return FormatFloat(buf, v);
+    }
+
+    // v as text, appended. false leaves v to the stream. integers read as a fresh stream prints them,
+    // floats deliberately do not: the shortest text that reads back to v, not 6 significant digits.
+    template <typename T, typename std::enable_if<IsPlainInt<T>::value || std::is_same<T, double>::value ||
+                                                  std::is_same<T, float>::value>::type * = nullptr>
+    bool AppendPlain(std::string &str, T v)
+    {
+        char buf[REC_NUMBER_CHARS];
+        str.append(buf, FormatNumber(buf, v));
+        return true;
+    }
+
+    inline bool AppendPlain(std::string &str, bool v)
+    {
+        str.push_back(v ? '1' : '0');
+        return true;
+    }
+
+    inline bool AppendPlain(std::string &str, char v)
+    {
+        str.push_back(v);
+        return true;
+    }
+
+    inline bool AppendPlain(std::string &str, const char *v)
+    {
+        str.append(v);
+        return true;
+    }
+
+    inline bool AppendPlain(std::string &str, const std::string &v)
+    {
+        str.append(v);
+        return true;
+    }
+
+    template <typename T, typename std::enable_if<!IsPlainInt<T>::value && !std::is_floating_point<T>::value &&
+                                                  !std::is_convertible<const T &, const char *>::value>::type * = nullptr>
+    bool AppendPlain(std::string &, const T &)
+    {
+        return false;
+    }
+
+    inline bool AppendPlain(std::string &, long double)
+    {
+        return false;
+    }
+}
+
+#endif
@@ -0,0 +1,182 @@
+#ifndef CBOR_REC_SCHEMA_H
+#define CBOR_REC_SCHEMA_H
+
+#include "encoder.h"
+#include "simple_reflect.h"
+#include <cstdint>
+#include <string>
+
+namespace RECLOG
+{
+    class DiskFileCluster;
+    class FileHandle;
+
+    // schema mode of .cbor files (RECOPTION::cbor_schema):
+    // every file starts with one definition per reflected struct,
+    //     tag(REC_SCHEMA_DEF_TAG) [id, struct name, [field name, field type, ...]]
+    // and a struct in a record is only its values,
+    //     tag(REC_SCHEMA_TAG) [id, value, ...]
+    // nested structs are encoded the same way and defined before the struct holding them.
+    // named threads are noted ahead of their records too,
+    //     tag(REC_THREAD_TAG) [thread index, name]
+    // every .cbor file, schema mode or not, notes the clock calibration whenever it changed,
+    //     tag(REC_CLOCK_TAG) [base ticks, wall ns, ns per tick]
+    // and records are stamped with raw ticks, converted by readers with the calibration last seen,
+    //     tag(REC_TICKS_TAG) ticks
+    constexpr unsigned int REC_SCHEMA_DEF_TAG = 40100;
+    constexpr unsigned int REC_SCHEMA_TAG = 40101;
+    constexpr unsigned int REC_THREAD_TAG = 40102;
+    constexpr unsigned int REC_CLOCK_TAG = 40103;
+    constexpr unsigned int REC_TICKS_TAG = 40104;
+
+    class SchemaRegistry
+    {
+    public:
+        // body is the encoded struct name and field list, the id comes with the header.
+        static uint32_t Add(const unsigned char *body, size_t len);
+        static uint32_t Size();
+        // encoded definition of id, header included.
+        static std::string At(uint32_t id);
+    };
+
+    // calibration, definitions and thread names the current file of dest misses, written ahead of the next records.
+    size_t WriteSchemas(DiskFileCluster *dest, FileHandle &handle);
+
+    template <typename T>
+    uint32_t SchemaId();
+
+    template <typename T, typename = void>
+    struct SchemaType
+    {
+        static const char *name()
+        {
+            return "text";
+        }
+    };
+
+    template <>
+    struct SchemaType<bool>
+    {
+        static const char *name()
+        {
+            return "bool";
+        }
+    };
+
+    template <typename T>
+    struct SchemaType<T, typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value>::type>
+    {
+        static const char *name()
+        {
+            return std::is_signed<T>::value ? "int" : "uint";
+        }
+    };
+
+    template <typename T>
+    struct SchemaType<T, typename std::enable_if<std::is_floating_point<T>::value>::type>
+    {
+        static const char *name()
+        {
+            return sizeof(T) == sizeof(float) ? "float" : "double";
+        }
+    };
+
+    template <typename T>
+    struct SchemaType<T, typename std::enable_if<cborio::ISTRing<T>::value || cborio::is_charptr<T>::value>::type>
+    {
+        static const char *name()
+        {
+            return "string";
+        }
+    };
+
+    template <typename T>
+    struct SchemaType<T, typename std::enable_if<cborio::ISTList<T>::value>::type>
+    {
+        static const char *name()
+        {
+            return "array";
+        }
+    };
+
+    template <typename T>
+    struct SchemaType<T, typename std::enable_if<cborio::ISTLmap<T>::value>::type>
+    {
+        static const char *name()
+        {
+            return "map";
+        }
+    };
+
+    template <typename T>
+    struct SchemaType<T, typename std::enable_if<refl::IsReflected<T>::value>::type>
+    {
+        static const char *name()
+        {
+            // defined ahead of the struct naming it.
+            SchemaId<T>();
+            return T::_field_name_;
+        }
+    };
+
+    template <typename T, size_t... Is>
+    void SchemaFields(cborio::encoder &cbs, index_sequence<Is...>)
+    {
+        (void)std::initializer_list<int>{
+            (cbs << T::template FIELD<T, Is>::name()
+                 << SchemaType<typename std::decay<decltype(std::declval<typename T::template FIELD<T, Is> &>().value())>::type>::name(),
+             0)...};
+    }
+
+    template <typename T>
+    uint32_t SchemaId()
+    {
+        static const uint32_t id = []()
+        {
+            cborio::ustring body(256);
+            cborio::encoder cbs(body);
+            // a copy, the constexpr member has no definition before C++17.
+            const char *name = T::_field_name_;
+            cbs << name;
+            cbs.write_array_head(T::_field_count_ * 2);
+            SchemaFields<T>(cbs, make_index_sequence<T::_field_count_>{});
+            return SchemaRegistry::Add(body.data(), body.size());
+        }();
+        return id;
+    }
+
+    template <typename T,
+              typename std::enable_if<refl::IsReflected<typename std::decay<T>::type>::value>::type * = nullptr>
+    void SchemaEncode(cborio::encoder &cbs, const T &obj);
+
+    template <typename T,
+              typename std::enable_if<!refl::IsReflected<typename std::decay<T>::type>::value>::type * = nullptr>
+    void SchemaEncode(cborio::encoder &cbs, const T &obj)
+    {
+        cbs << obj;
+    }
+
+    struct fLambdaSchema
+    {
+        cborio::encoder &cbs;
+
+        template <typename Name, typename Valu>
+        void operator()(Name &&, Valu &&value)
+        {
+            SchemaEncode(cbs, value);
+        }
+    };
+
+    template <typename T,
+              typename std::enable_if<refl::IsReflected<typename std::decay<T>::type>::value>::type *>
+    void SchemaEncode(cborio::encoder &cbs, const T &obj)
+    {
+        using TP = typename std::decay<T>::type;
+        cbs.write_tag(REC_SCHEMA_TAG);
+        cbs.write_array_head(TP::_field_count_ + 1);
+        cbs << SchemaId<TP>();
+        refl::forEach(obj, fLambdaSchema{cbs});
+    }
+}
+
+#endif
@@ -0,0 +1,145 @@
+#ifndef CBOR_REC_SHM_H
+#define CBOR_REC_SHM_H
+
+#include "reclog.h"
+#include <deque>
+#include <thread>
+#include <vector>
+
+namespace RECLOG
+{
+    // one ring per producer, REC_SHM_DIR "rec.<channel>.<pid>.<n>", linux only.
+    // entries are [u32 size][u8 type][3 pad][i64 wall ns][payload], 8 byte aligned,
+    // the size is stored last and a set REC_SHM_PAD bit skips to the start of the ring.
+    constexpr char REC_SHM_DIR[] = "/dev/shm/";
+    constexpr size_t REC_SHM_SIZE = 1 << 22;
+    constexpr uint32_t REC_SHM_PAD = 0x80000000u;
+    // records younger than this wait for slower producers before they are merged.
+    constexpr long long REC_SHM_HOLD_MS = 20;
+
+    struct ShmRingHead;
+
+    // the producing side, any number of threads put records without a lock or a syscall.
+    class ShmProducer
+    {
+    public:
+        ShmProducer(const std::string &channel, size_t capacity = REC_SHM_SIZE);
+        ~ShmProducer();
+        ShmProducer(const ShmProducer &) = delete;
+        ShmProducer &operator=(const ShmProducer &) = delete;
+
+        bool Valid() const
+        {
+            return m_head != nullptr;
+        }
+        // false when the collector fell a whole ring behind or the record takes more than half of it,
+        // the ring counts it as dropped.
+        bool Put(CodeType type, const void *src, size_t len);
+        size_t Dropped() const;
+
+    private:
+        ShmRingHead *m_head;
+        unsigned char *m_data;
+        size_t m_mapsize;
+        std::string m_path;
+    };
+
+    // what a cluster writes to while RECOPTION::shm_channel is set, one entry per record.
+    // records the ring has no room for count as dropped by owner.
+    class FileShm : public FileBase
+    {
+    public:
+        FileShm(std::shared_ptr<ShmProducer> producer, CodeType type, DiskFileCluster *owner)
+            : m_producer(std::move(producer)), m_type(type), m_owner(owner) {}
+
+        size_t WriteBatch(const IoSpan *spans, size_t count) override
+        {
+            size_t bytes = 0;
+            for (size_t i = 0; i < count; ++i)
+            {
+                bytes += WriteData(spans[i].data, sizeof(char), spans[i].len);
+            }
+            return bytes;
+        }
+
+        size_t WriteData(const void *src, size_t ele, size_t len) override
+        {
+            if (m_producer->Put(m_type, src, ele * len))
+            {
+                return ele * len;
+            }
+            m_owner->IncreaseDropped(1);
+            return 0;
+        }
+
+        size_t WriteData(const std::string &str) override
+        {
+            return WriteData(str.data(), sizeof(char), str.size());
+        }
+
+        size_t WriteData(const cborio::ustring &ustr) override
+        {
+            return WriteData(ustr.data(), sizeof(unsigned char), ustr.size());
+        }
+
+    private:
+        std::shared_ptr<ShmProducer> m_producer;
+        CodeType m_type;
+        DiskFileCluster *m_owner;
+    };
+
+    // the single disk writer of a host, merges the rings of a channel by time into one set of files.
+    class ShmCollector
+    {
+    public:
+        ShmCollector(const std::string &channel, const std::string &rootname, const RECOPTION &option);
+        ~ShmCollector();
+        ShmCollector(const ShmCollector &) = delete;
+        ShmCollector &operator=(const ShmCollector &) = delete;
+
+        // one pass over every ring, final also writes records still held back. returns records written.
+        size_t Poll(bool final = false);
+        // library mode, polls on a thread of its own until Stop.
+        void Start();
+        // writes whatever is left and closes the files.
+        void Stop();
+        // producers whose rings are currently mapped.
+        size_t Rings() const
+        {
+            return m_rings.size();
+        }
+
+    private:
+        struct Pending
+        {
+            long long wall;
+            CodeType type;
+            std::string data;
+        };
+
+        struct Ring
+        {
+            std::string path;
+            ShmRingHead *head;
+            unsigned char *data;
+            size_t mapsize;
+            std::deque<Pending> pending;
+        };
+
+        std::string m_channel;
+        std::string m_rootname;
+        std::unique_ptr<DiskFileCluster> m_clusters[3];
+        std::vector<std::unique_ptr<Ring>> m_rings;
+        long long m_last_scan;
+        std::atomic_bool m_running;
+        std::thread m_thread;
+
+        void Scan();
+        void Read(Ring &ring);
+        bool Finished(const Ring &ring) const;
+        void Unmap(Ring &ring);
+        DiskFileCluster *Cluster(CodeType type);
+    };
+}
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef CBOR_REC_SINK_H
+#define CBOR_REC_SINK_H
+
+#include "reclog.h"
+#include <deque>
+#include <string>
+#include <vector>
+
+namespace RECLOG
+{
+    class ShmProducer;
+
+    // one more place the records of a route go to, see RECONFIG::AddSink.
+    // the writer calls a sink with the bytes the statement encoded, never from two threads at once.
+    class LogSink
+    {
+    public:
+        explicit LogSink(int level = RECLOG_MAX_VERBOSITY) : m_level(level) {}
+        virtual ~LogSink() = default;
+        LogSink(const LogSink &) = delete;
+        LogSink &operator=(const LogSink &) = delete;
+
+        // records more verbose than level pass this sink by, records without a site count as INFO.
+        void SetLevel(int level)
+        {
+            m_level.store(level, std::memory_order_relaxed);
+        }
+        int Level() const
+        {
+            return m_level.load(std::memory_order_relaxed);
+        }
+        bool Accepts(int verbosity) const
+        {
+            return verbosity <= Level();
+        }
+
+        virtual void Write(CodeType type, const void *data, size_t len) = 0;
+        // a deferred record as it is, false asks for its rendered text through Write instead.
+        virtual bool WriteDeferred(const void *, size_t)
+        {
+            return false;
+        }
+        virtual void Flush() {}
+        virtual void Sync()
+        {
+            Flush();
+        }
+
+    private:
+        std::atomic_int m_level;
+    };
+
+    // the screen, what RECLOG writes to.
+    class ScreenSink : public LogSink
+    {
+    public:
+        using LogSink::LogSink;
+        void Write(CodeType type, const void *data, size_t len) override;
+        bool WriteDeferred(const void *data, size_t len) override;
+        void Flush() override;
+    };
+
+    // the rotated files of a cluster, e.g. RECONFIG::g_flist_log.
+    class ClusterSink : public LogSink
+    {
+    public:
+        explicit ClusterSink(DiskFileCluster *cluster, int level = RECLOG_MAX_VERBOSITY)
+            : LogSink(level), m_cluster(cluster) {}
+        void Write(CodeType type, const void *data, size_t len) override;
+        bool WriteDeferred(const void *data, size_t len) override;
+        void Flush() override;
+        void Sync() override;
+
+    private:
+        DiskFileCluster *m_cluster;
+    };
+
+    // a shared memory ring, records reach a collector in another process.
+    class ShmSink : public LogSink
+    {
+    public:
+        explicit ShmSink(std::shared_ptr<ShmProducer> producer, int level = RECLOG_MAX_VERBOSITY)
+            : LogSink(level), m_producer(std::move(producer)) {}
+        void Write(CodeType type, const void *data, size_t len) override;
+
+    private:
+        std::shared_ptr<ShmProducer> m_producer;
+    };
+
+    // keeps the last capacity records in memory, for tests and for a post-mortem look.
+    class MemorySink : public LogSink
+    {
+    public:
+        explicit MemorySink(size_t capacity = 1024, int level = RECLOG_MAX_VERBOSITY)
+            : LogSink(level), m_capacity(capacity) {}
+        void Write(CodeType type, const void *data, size_t len) override;
+        std::vector<std::string> Records() const;
+        void Clear();
+
+    private:
+        size_t m_capacity;
+        mutable std::mutex m_lock;
+        std::deque<std::string> m_records;
+    };
+}
+
+#endif
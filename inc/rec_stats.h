@@ -0,0 +1,224 @@
+#ifndef CBOR_REC_STATS_H
+#define CBOR_REC_STATS_H
+
+#include "rec_clock.h"
+#include "rec_thread.h"
+#include "ring_buffer.h"
+#include "thread_pool.h"
+#include <atomic>
+#include <cstdint>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace RECLOG
+{
+    // counters and histograms are split this many ways, a thread adds to index % shards.
+    constexpr size_t REC_STAT_SHARDS = 16;
+    // 8 buckets per power of two, a value is known to within 12.5%.
+    constexpr unsigned REC_HIST_SUB_BITS = 3;
+    // ticks of 2^40 and more, minutes at any tick rate, share the last bucket.
+    constexpr unsigned REC_HIST_MAX_BITS = 40;
+    constexpr size_t REC_HIST_BUCKETS = (REC_HIST_MAX_BITS - REC_HIST_SUB_BITS + 1) << REC_HIST_SUB_BITS;
+
+    enum class StatId
+    {
+        // handed to the logger, queued or written on the spot.
+        RECORDS,
+        BYTES,
+        // reached a file, schemas and file headers included.
+        WRITTEN,
+        ROTATIONS,
+        COMPRESSIONS,
+        SYNCS,
+        COUNT
+    };
+
+    enum class LatencyId
+    {
+        // a record into its thread's ring.
+        ENQUEUE,
+        // one batch or record to a file.
+        WRITE,
+        SYNC,
+        // DiskFileCluster::Rotate, the switch to the next file.
+        ROTATE,
+        // one retired file compressed on RECONFIG::g_copool.
+        COMPRESS,
+        COUNT
+    };
+
+    inline size_t StatShard()
+    {
+        return ThisThread().index % REC_STAT_SHARDS;
+    }
+
+    // relaxed adds to the calling thread's shard, a read sums them. static storage only,
+    // it counts on being zeroed before any constructor runs.
+    class StatCounter
+    {
+    public:
+        void Add(uint64_t n)
+        {
+            m_shards[StatShard()].value.fetch_add(n, std::memory_order_relaxed);
+        }
+
+        uint64_t Load() const
+        {
+            uint64_t sum = 0;
+            for (auto &shard : m_shards)
+            {
+                sum += shard.value.load(std::memory_order_relaxed);
+            }
+            return sum;
+        }
+
+    private:
+        struct alignas(REC_CACHELINE_SIZE) Shard
+        {
+            std::atomic<uint64_t> value;
+        };
+        Shard m_shards[REC_STAT_SHARDS];
+    };
+
+    // what a histogram held when it was read, in nanoseconds.
+    struct LatencyStats
+    {
+        uint64_t count = 0;
+        double mean = 0;
+        double p50 = 0;
+        double p90 = 0;
+        double p99 = 0;
+        double p999 = 0;
+        double max = 0;
+    };
+
+    // log linear buckets of raw ticks, converted once a snapshot is taken. static storage only.
+    class LatencyHistogram
+    {
+    public:
+        void Record(uint64_t ticks)
+        {
+            auto &shard = m_shards[StatShard()];
+            shard.buckets[Bucket(ticks)].fetch_add(1, std::memory_order_relaxed);
+            shard.sum.fetch_add(ticks, std::memory_order_relaxed);
+            auto max = shard.max.load(std::memory_order_relaxed);
+            while (ticks > max && !shard.max.compare_exchange_weak(max, ticks, std::memory_order_relaxed))
+            {
+            }
+        }
+
+        // the time since start, a Clock::Ticks() taken before the work.
+        void Since(uint64_t start)
+        {
+            auto now = Clock::Ticks();
+            Record(now > start ? now - start : 0);
+        }
+
+        LatencyStats Snapshot(double ns_per_tick) const;
+
+        static size_t Bucket(uint64_t ticks)
+        {
+            if (ticks < (1u << REC_HIST_SUB_BITS))
+            {
+                return static_cast<size_t>(ticks);
+            }
+            auto top = HighBit(ticks);
+            if (top >= REC_HIST_MAX_BITS)
+            {
+                return REC_HIST_BUCKETS - 1;
+            }
+            auto sub = (ticks >> (top - REC_HIST_SUB_BITS)) & ((1u << REC_HIST_SUB_BITS) - 1);
+            return static_cast<size_t>(((top - REC_HIST_SUB_BITS + 1) << REC_HIST_SUB_BITS) + sub);
+        }
+
+        // the largest value that lands in bucket.
+        static uint64_t Upper(size_t bucket)
+        {
+            auto row = bucket >> REC_HIST_SUB_BITS;
+            auto sub = bucket & ((1u << REC_HIST_SUB_BITS) - 1);
+            if (row == 0)
+            {
+                return sub;
+            }
+            auto shift = row - 1;
+            return (((1ull << REC_HIST_SUB_BITS) + sub + 1) << shift) - 1;
+        }
+
+    private:
+        struct alignas(REC_CACHELINE_SIZE) Shard
+        {
+            std::atomic<uint64_t> buckets[REC_HIST_BUCKETS];
+            std::atomic<uint64_t> sum;
+            std::atomic<uint64_t> max;
+        };
+        Shard m_shards[REC_STAT_SHARDS];
+
+        static unsigned HighBit(uint64_t v)
+        {
+#if defined(_MSC_VER) && defined(_M_X64)
+            unsigned long pos;
+            _BitScanReverse64(&pos, v);
+            return static_cast<unsigned>(pos);
+#elif defined(__GNUC__)
+            return 63u - static_cast<unsigned>(__builtin_clzll(v));
+#else
+            unsigned pos = 0;
+            while (v >>= 1)
+            {
+                ++pos;
+            }
+            return pos;
+#endif
+        }
+    };
+
+    // see RECONFIG::Stats, totals since the process started.
+    struct RecStats
+    {
+        uint64_t records = 0;
+        uint64_t bytes = 0;
+        uint64_t written = 0;
+        uint64_t rotations = 0;
+        uint64_t compressions = 0;
+        uint64_t syncs = 0;
+        size_t dropped = 0;
+        // bytes waiting in the rings when the writer last looked, and the most it ever saw.
+        size_t queued = 0;
+        size_t queued_peak = 0;
+        LatencyStats enqueue;
+        LatencyStats write;
+        LatencyStats sync;
+        LatencyStats rotate;
+        LatencyStats compress;
+        PoolStats writer_pool;
+        PoolStats file_pool;
+    };
+
+    // process wide and never reset, every hook is a relaxed add or two.
+    class StatRegistry
+    {
+    public:
+        static void Count(StatId id, uint64_t n = 1)
+        {
+            Counters()[static_cast<size_t>(id)].Add(n);
+        }
+
+        static void Latency(LatencyId id, uint64_t start)
+        {
+            Histograms()[static_cast<size_t>(id)].Since(start);
+        }
+
+        // writer only.
+        static void Queued(size_t bytes);
+        // the logger's part of RecStats, the pools and drop counts are left to the caller.
+        static RecStats Snapshot();
+
+    private:
+        static StatCounter *Counters();
+        static LatencyHistogram *Histograms();
+    };
+}
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef CBOR_REC_THREAD_H
+#define CBOR_REC_THREAD_H
+
+#include <cstdint>
+#include <string>
+
+namespace RECLOG
+{
+    struct CrashLane;
+
+    // room for the thread column of the preamble.
+    constexpr size_t REC_THREAD_TEXT = 16;
+
+    // made on the first record of a thread, records read it instead of hashing the thread id.
+    struct ThreadContext
+    {
+        // dense, the first thread to log is 1.
+        uint32_t index;
+        // the thread column, the index in hex until the thread is named.
+        char text[REC_THREAD_TEXT];
+        // the crash ring of the thread, see CrashRing::Note. claimed once, nullptr if there was none.
+        mutable CrashLane *crash;
+        mutable bool crash_claimed;
+    };
+
+    const ThreadContext &ThisThread();
+
+    // every name given so far, in order, a thread named twice shows up twice.
+    class ThreadRegistry
+    {
+    public:
+        struct Entry
+        {
+            uint32_t index;
+            std::string name;
+        };
+
+        static void SetName(const char *name);
+        static uint32_t Size();
+        static Entry At(uint32_t n);
+        // latest name of index, empty if it never got one.
+        static std::string Name(uint32_t index);
+    };
+}
+
+#endif
@@ -4,15 +4,50 @@
 #include "simple_reflect.h"
 #include "encoder.h"
 #include "thread_pool.h"
+#include "rec_deferred.h"
+#include "rec_buffer.h"
+#include "rec_schema.h"
+#include "rec_stats.h"
+#include "rec_thread.h"
 #include <atomic>
+#include <chrono>
 #include <memory>
-#include <queue>
-
-#define RECVLOG_A(fulltype) RECLOG::make_RecLog<fulltype>(__FILE__, __LINE__)
+#include <mutex>
+#include <vector>
+
+#define REC_SITE(verbosity, codec)                                                   \
+    ([]() -> const RECLOG::LogSite * {                                               \
+        static const RECLOG::LogSite rec_site(__FILE__, __LINE__, verbosity, codec); \
+        return &rec_site; }())
+#define RECVLOG_A(fulltype) RECLOG::make_RecLog<fulltype>(REC_SITE(0, RECLOG::CodecOf<fulltype>::value))
 #define RECLOG(type) RECVLOG_A(RECLOG::Codec_##type)
-#define RECVLOG_B(fulltype) RECLOG::make_RecFile<fulltype>(__FILE__, __LINE__)
+#define RECVLOG_B(fulltype) RECLOG::make_RecFile<fulltype>(REC_SITE(0, RECLOG::CodecOf<fulltype>::value))
 #define RECFILE(type) RECVLOG_B(RECLOG::Codec_##type)
 
+// statements more verbose than this are compiled out, e.g. -DRECLOG_MAX_VERBOSITY=0 keeps INFO and above.
+#ifndef RECLOG_MAX_VERBOSITY
+#define RECLOG_MAX_VERBOSITY 9
+#endif
+// the statement runs only when cond holds, otherwise nothing after it is evaluated.
+#define RECVLOG_IF(maker, fulltype, cond, verbosity) \
+    !(cond) ? (void)0 : RECLOG::RecVoidify() & maker<fulltype>(REC_SITE(verbosity, RECLOG::CodecOf<fulltype>::value))
+// RECLOG_LVL(STR, DEBUG) << ...; arguments are only evaluated when the level is enabled.
+#define RECVLOG_LVL(maker, fulltype, level) \
+    RECVLOG_IF(maker, fulltype, RECLOG::LevelEnabled(RECLOG::REC_LEVEL_##level), RECLOG::REC_LEVEL_##level)
+#define RECLOG_LVL(type, level) RECVLOG_LVL(RECLOG::make_RecLog, RECLOG::Codec_##type, level)
+#define RECFILE_LVL(type, level) RECVLOG_LVL(RECLOG::make_RecFile, RECLOG::Codec_##type, level)
+// per statement rate limits: every n-th call, at most n calls a second, the first n calls.
+#define REC_LIMIT()                                                   \
+    ([]() -> RECLOG::SiteLimit & {                                    \
+        static RECLOG::SiteLimit rec_limit;                           \
+        return rec_limit; }())
+#define RECLOG_EVERY_N(type, n) RECVLOG_IF(RECLOG::make_RecLog, RECLOG::Codec_##type, REC_LIMIT().EveryN(n), 0)
+#define RECLOG_PER_SEC(type, n) RECVLOG_IF(RECLOG::make_RecLog, RECLOG::Codec_##type, REC_LIMIT().PerSecond(n), 0)
+#define RECLOG_FIRST_N(type, n) RECVLOG_IF(RECLOG::make_RecLog, RECLOG::Codec_##type, REC_LIMIT().FirstN(n), 0)
+#define RECFILE_EVERY_N(type, n) RECVLOG_IF(RECLOG::make_RecFile, RECLOG::Codec_##type, REC_LIMIT().EveryN(n), 0)
+#define RECFILE_PER_SEC(type, n) RECVLOG_IF(RECLOG::make_RecFile, RECLOG::Codec_##type, REC_LIMIT().PerSecond(n), 0)
+#define RECFILE_FIRST_N(type, n) RECVLOG_IF(RECLOG::make_RecFile, RECLOG::Codec_##type, REC_LIMIT().FirstN(n), 0)
+
 namespace RECLOG
 {
     enum class CodeType
@@ -22,12 +57,47 @@ namespace RECLOG
         LOG
     };
 
+    // verbosity of a statement, larger is chattier. RECLOG and RECFILE log at INFO.
+    enum RECLEVEL : int
+    {
+        REC_LEVEL_FATAL = -3,
+        REC_LEVEL_ERROR = -2,
+        REC_LEVEL_WARNING = -1,
+        REC_LEVEL_INFO = 0,
+        REC_LEVEL_DEBUG = 1,
+        REC_LEVEL_TRACE = 2
+    };
+
+    // records the writer hands over in one call.
+    constexpr size_t REC_MAX_IOV = 256;
+
+    struct IoSpan
+    {
+        const void *data;
+        size_t len;
+    };
+
     class FileBase
     {
     public:
         FileBase(){};
         virtual ~FileBase(){};
         virtual void Mark(bool){};
+        virtual void Flush(){};
+        // down to the disk, not just the kernel.
+        virtual void Sync()
+        {
+            Flush();
+        };
+        virtual size_t WriteBatch(const IoSpan *spans, size_t count)
+        {
+            size_t bytes = 0;
+            for (size_t i = 0; i < count; ++i)
+            {
+                bytes += WriteData(spans[i].data, sizeof(char), spans[i].len);
+            }
+            return bytes;
+        };
         virtual size_t WriteData(const std::string &)
         {
             return 0;
@@ -46,43 +116,260 @@ namespace RECLOG
 
     using FilePtr = std::shared_ptr<FileBase>;
 
+    // what a file already carries ahead of its records, added by the first records that need it.
+    struct FileHeader
+    {
+        std::mutex lock;
+        // deferred files, magic and start frame, the calibration and the sites noted so far.
+        bool started{false};
+        uint32_t clock{0};
+        uint32_t sites{0};
+        // cbor files in schema mode, the definitions noted so far.
+        uint32_t schemas{0};
+        // thread names, either kind.
+        uint32_t threads{0};
+
+        void Reset()
+        {
+            started = false;
+            clock = 0;
+            sites = 0;
+            schemas = 0;
+            threads = 0;
+        }
+    };
+
+    // one published file of a cluster, writers pin it for the duration of a write.
+    struct FileSlot
+    {
+        FilePtr file;
+        FileHeader header;
+        std::atomic<uint32_t> writers{0};
+        size_t gen{0};
+        // final size, known once retired.
+        size_t bytes{0};
+        // false once retired with writes no sync covered yet, guarded by the rotate lock.
+        bool synced{true};
+    };
+
+    class FileHandle
+    {
+    public:
+        explicit FileHandle(FileSlot *slot) : m_slot(slot) {}
+        ~FileHandle()
+        {
+            if (m_slot != nullptr)
+            {
+                m_slot->writers.fetch_sub(1, std::memory_order_release);
+            }
+        }
+
+        FileHandle(FileHandle &&other) : m_slot(other.m_slot)
+        {
+            other.m_slot = nullptr;
+        }
+        FileHandle(const FileHandle &) = delete;
+        FileHandle &operator=(const FileHandle &) = delete;
+
+        FileBase *operator->() const
+        {
+            return m_slot->file ? m_slot->file.get() : &closed;
+        }
+
+        FileBase &operator*() const
+        {
+            return *operator->();
+        }
+
+        // bumped every time a new file is published.
+        size_t Generation() const
+        {
+            return m_slot->gen;
+        }
+
+        // lock it while checking and writing headers, producers may write directly besides the writer.
+        FileHeader &Header() const
+        {
+            return m_slot->header;
+        }
+
+    private:
+        FileSlot *m_slot;
+        // stands in once the cluster was closed at exit.
+        static FileBase closed;
+    };
+
+    constexpr size_t REC_MAX_FILESIZE = 500000;
+    constexpr size_t REC_MAX_FILENUM = 12;
+
+    // what a producer does when its ring has no room left.
+    enum class RECOVERLOAD
+    {
+        BLOCK,
+        DROP_NEWEST,
+        // only records the writer has not taken yet can make room. while it holds older ones,
+        // a batch waiting on a slow disk included, the new record is dropped instead.
+        DROP_OLDEST,
+        SAMPLE
+    };
+
+    struct OverloadPolicy
+    {
+        RECOVERLOAD mode = RECOVERLOAD::BLOCK;
+        // BLOCK gives up and drops after it, 0 waits for as long as it takes.
+        unsigned int timeout_ms = 0;
+        // SAMPLE keeps one in sample_rate records while the ring is more than half full.
+        unsigned int sample_rate = 10;
+    };
+
+    struct RECOPTION
+    {
+        bool compressed = false;
+        // Codec_STR keeps the raw arguments, text is rendered by the writer or rec2txt.
+        bool deferred = false;
+        // a new file starts once any enabled limit is reached, 0 disables a limit.
+        size_t max_filesize = REC_MAX_FILESIZE;
+        unsigned int rotate_seconds = 0;
+        // files kept on disk, current one included.
+        size_t max_filenum = REC_MAX_FILENUM;
+        // oldest files are removed while all kept files together exceed it.
+        size_t disk_budget = 0;
+        // reserve max_filesize bytes for the next file while it waits to be used.
+        bool preallocate = true;
+        // write disk files through a shared mapping instead of stdio, linux only.
+        bool mapped = false;
+        // group commit, written data is synced once either amount has passed. 0 for both never syncs.
+        unsigned int fsync_ms = 0;
+        size_t fsync_bytes = 0;
+        // applied to the screen and every cluster, DiskFileCluster::SetOverload changes one.
+        OverloadPolicy overload;
+        // runtime threshold of the leveled macros, RECONFIG::SetVerbosity changes it later.
+        int verbosity = RECLOG_MAX_VERBOSITY;
+        // identical STR records in a row are written once, followed by "previous record repeated N times".
+        bool collapse = true;
+        // reflected structs in .cbor files as values under a schema id, see rec_schema.h.
+        bool cbor_schema = false;
+        // the last STR records stay in memory for the crash file, see rec_crash.h.
+        bool crash_ring = true;
+        // records go to the rings a ShmCollector of this channel drains instead of own files, linux only.
+        // rotation is up to the collector, deferred and cbor_schema are ignored while set.
+        std::string shm_channel;
+        // CBOR records on the screen are decoded to text instead of shown as hex.
+        bool screen_cbor = false;
+        // RECONFIG::g_expool runs the writer, g_copool opens and closes files and compresses
+        // them in its low lane. unnamed pools are called rec_writer and rec_files.
+        PoolOptions writer_pool;
+        PoolOptions file_pool;
+        // the writer logs RECONFIG::Stats this often, 0 never does.
+        unsigned int stats_ms = 0;
+    };
+
+    struct PreparedFile;
+
     class DiskFileCluster
     {
     public:
-        DiskFileCluster(const char *rootname, CodeType ftype)
-            : m_ftype(ftype), m_filesize(0), m_rootname(rootname) {}
-        FilePtr &GetCurFileFp();
+        DiskFileCluster(const char *rootname, CodeType ftype);
+        // never blocks on rotation, the file stays open until the handle is gone.
+        FileHandle GetCurFileFp();
+        CodeType Type() const
+        {
+            return m_ftype;
+        }
+        size_t FileNo() const
+        {
+            return m_gen.load(std::memory_order_acquire);
+        }
         void SetRootName(const char *rtname)
         {
             m_rootname = rtname;
         }
-        void AtExit()
+        // rotation limits, set before the first file is opened.
+        void SetPolicy(const RECOPTION &option);
+        // every record goes to file instead, there is no rotation. set before the first record.
+        void SetTransport(FilePtr file)
         {
-            while (!m_filelist.empty())
-            {
-                m_filelist.front()->Mark(false);
-                m_filelist.pop();
-            }
+            m_transport = std::move(file);
+            m_maxsize = 0;
+            m_period = 0;
+        }
+        bool Transported() const
+        {
+            return m_transport != nullptr;
+        }
+        // set before logging starts.
+        void SetOverload(const OverloadPolicy &policy)
+        {
+            m_overload = policy;
         }
+        const OverloadPolicy &Overload() const
+        {
+            return m_overload;
+        }
+        void IncreaseDropped(size_t n)
+        {
+            m_dropped.fetch_add(n, std::memory_order_relaxed);
+        }
+        // records lost to the overload policy so far.
+        size_t Dropped() const
+        {
+            return m_dropped.load(std::memory_order_relaxed);
+        }
+        void AtExit();
         void IncraeseBytes(size_t t)
         {
             m_filesize += t;
         }
+        void Flush()
+        {
+            if (FileNo() != 0)
+            {
+                GetCurFileFp()->Flush();
+            }
+        }
+        // the current file and every retired one still kept that missed a sync.
+        void Sync();
 
     private:
         CodeType m_ftype;
-        std::queue<FilePtr> m_filelist;
         std::string m_rootname;
+        std::string m_lastname;
         std::atomic_size_t m_filesize;
+        std::atomic_size_t m_dropped;
+        OverloadPolicy m_overload;
+        std::atomic<long long> m_opened;
         std::once_flag m_fg;
+        size_t m_maxsize;
+        size_t m_maxnum;
+        long long m_period;
+        size_t m_budget;
+        bool m_prealloc;
+        bool m_mapped;
+        bool m_durable;
+        FilePtr m_transport;
+        // the current file and the retired ones still kept on disk, indexed by generation.
+        std::unique_ptr<FileSlot[]> m_slots;
+        std::atomic_size_t m_gen;
+        size_t m_oldest;
+        std::mutex m_rotate;
+        // the next file, opened ahead of time on RECONFIG::g_copool.
+        std::shared_ptr<PreparedFile> m_prepared;
 
         std::string GetCurFileName();
+        std::string GetExtension() const;
+        void Rotate(size_t retired_bytes);
+        void Retire(FileSlot &slot);
+        void SyncRetired(FileSlot &slot);
+        void Prepare();
     };
 
+    class LogSink;
+
     class RECONFIG
     {
     public:
         static bool g_compress;
+        static RECOPTION g_option;
         static long long start_time;
         static FunctionPool g_copool;
         static FunctionPool g_expool;
@@ -91,32 +378,162 @@ namespace RECLOG
         static DiskFileCluster g_flist_cbor;
         static FilePtr &GetCurLogFp();
         static void InitREC(const char *filename = "", bool compressed = false);
+        static void InitREC(const char *filename, const RECOPTION &option);
+        // blocks until every record logged before the call reached its file.
+        static void Flush();
+        // same, but until it reached the disk. false if that took longer than timeout_ms.
+        static bool Flush(int timeout_ms);
+        // records lost to the overload policy, screen and files together.
+        static size_t Dropped();
+        // counters and latencies of the logger and its pools since the process started.
+        static RecStats Stats();
+        static void SetVerbosity(int verbosity)
+        {
+            g_verbosity.store(verbosity, std::memory_order_relaxed);
+        }
+        static int GetVerbosity()
+        {
+            return g_verbosity.load(std::memory_order_relaxed);
+        }
+        // shown in place of the thread index by the calling thread's records, e.g. "ctrl" or "io".
+        static void SetThreadName(const char *name)
+        {
+            ThreadRegistry::SetName(name);
+        }
         static void ExitREC();
+        // records logged to route also reach sink. the routes are nullptr for RECLOG, the screen,
+        // and &g_flist_log, &g_flist_cbor or &g_flist_raw for RECFILE.
+        static void AddSink(DiskFileCluster *route, std::shared_ptr<LogSink> sink);
+        static void RemoveSink(DiskFileCluster *route, const std::shared_ptr<LogSink> &sink);
+        // the sinks of route, the screen or file sink it always had first. its level filters that one.
+        static std::vector<std::shared_ptr<LogSink>> Sinks(DiskFileCluster *route);
+
+        // read on every leveled statement, relaxed is enough for a filter.
+        static std::atomic_int g_verbosity;
 
     private:
         static FilePtr screenfile;
     };
 
+    // folds to false for levels compiled out, otherwise a single relaxed load.
+    inline bool LevelEnabled(int level)
+    {
+        return level <= RECLOG_MAX_VERBOSITY && level <= RECONFIG::g_verbosity.load(std::memory_order_relaxed);
+    }
+
+    // state of one rate limited statement, shared by every thread running it.
+    class SiteLimit
+    {
+    public:
+        bool EveryN(uint64_t n)
+        {
+            return n < 2 || m_count.fetch_add(1, std::memory_order_relaxed) % n == 0;
+        }
+
+        bool FirstN(uint64_t n)
+        {
+            // stops counting once the quota is gone, so it never wraps.
+            return m_count.load(std::memory_order_relaxed) < n && m_count.fetch_add(1, std::memory_order_relaxed) < n;
+        }
+
+        bool PerSecond(uint64_t n)
+        {
+            auto now = std::chrono::steady_clock::now().time_since_epoch();
+            auto second = std::chrono::duration_cast<std::chrono::seconds>(now).count();
+            auto window = m_window.load(std::memory_order_relaxed);
+            if (window != second && m_window.compare_exchange_strong(window, second, std::memory_order_relaxed))
+            {
+                m_count.store(0, std::memory_order_relaxed);
+            }
+            return FirstN(n);
+        }
+
+    private:
+        std::atomic<uint64_t> m_count{0};
+        std::atomic<long long> m_window{0};
+    };
+
+    // lets the conditional macros discard the statement as one expression of type void.
+    struct RecVoidify
+    {
+        template <typename T>
+        void operator&(const T &) const {}
+    };
+
+    // blobs smaller than this are copied into the record, the owner costs more than the copy.
+    constexpr size_t REC_BLOB_MIN = 1 << 12;
+
+    // a large span logged by reference, e.g. a camera frame. owner keeps the bytes alive and
+    // unchanged until the writer wrote them, the logger never copies them.
+    struct RecBlob
+    {
+        const void *data;
+        size_t len;
+        std::shared_ptr<const void> owner;
+    };
+
+    template <typename T>
+    RecBlob Blob(const std::shared_ptr<T> &owner, const void *data, size_t len)
+    {
+        return RecBlob{data, len, owner};
+    }
+
+    // the vector moves into the record.
+    template <typename T>
+    RecBlob Blob(std::vector<T> &&vec)
+    {
+        auto owner = std::make_shared<std::vector<T>>(std::move(vec));
+        return RecBlob{owner->data(), owner->size() * sizeof(T), owner};
+    }
+
+    template <typename T>
+    RecBlob Blob(const std::shared_ptr<const std::vector<T>> &vec)
+    {
+        return RecBlob{vec->data(), vec->size() * sizeof(T), vec};
+    }
+
+    // where a blob goes between the bytes of a record.
+    struct BlobRef
+    {
+        size_t offset;
+        RecBlob blob;
+    };
+
     struct fLambdaFile;
     struct fLambdaLog;
 
     class Codec_RAW
     {
     private:
-        std::ostringstream m_ss;
-        FilePtr m_pFile;
-        bool m_counted;
+        PooledBuffer<ByteBuffer> m_buf;
+        DiskFileCluster *m_pCluster;
+        const LogSite *m_site;
+        std::vector<BlobRef> m_blobs;
 
     public:
-        Codec_RAW(FilePtr fp, bool counted) : m_pFile(fp), m_counted(counted) {}
+        explicit Codec_RAW(DiskFileCluster *cluster, const LogSite *site = nullptr) : m_pCluster(cluster), m_site(site) {}
         ~Codec_RAW();
 
         Codec_RAW(Codec_RAW &&other)
-            : m_ss(std::move(other.m_ss)), m_pFile(std::move(other.m_pFile)) {}
+            : m_buf(std::move(other.m_buf)), m_pCluster(other.m_pCluster), m_site(other.m_site),
+              m_blobs(std::move(other.m_blobs)) {}
+
+        Codec_RAW &operator<<(const RecBlob &blob)
+        {
+            if (blob.len < REC_BLOB_MIN)
+            {
+                m_buf->str.append(static_cast<const char *>(blob.data), blob.len);
+            }
+            else
+            {
+                m_blobs.push_back(BlobRef{m_buf->str.size(), blob});
+            }
+            return *this;
+        }
 
         Codec_RAW &operator<<(const char *v)
         {
-            m_ss.write(v, strlen(v));
+            m_buf->str.append(v, strlen(v));
             return *this;
         }
 
@@ -124,7 +541,7 @@ namespace RECLOG
                   typename std::enable_if<std::is_fundamental<T>::value, bool>::type = true>
         Codec_RAW &operator<<(const T &v)
         {
-            m_ss.write((char *)&v, sizeof(T));
+            m_buf->str.append((const char *)&v, sizeof(T));
             return *this;
         }
 
@@ -132,7 +549,7 @@ namespace RECLOG
                   typename std::enable_if<std::is_fundamental<typename T::value_type>::value, bool>::type = true>
         Codec_RAW &operator<<(const T &v)
         {
-            m_ss.write((char *)v.data(), v.size() * sizeof(typename T::value_type));
+            m_buf->str.append((const char *)v.data(), v.size() * sizeof(typename T::value_type));
             return *this;
         }
 
@@ -141,7 +558,7 @@ namespace RECLOG
         {
             char *data = (char *)&(*first);
             auto n = std::distance(first, last);
-            m_ss.write(data, n * sizeof(*first));
+            m_buf->str.append(data, n * sizeof(*first));
             return *this;
         }
 
@@ -149,7 +566,7 @@ namespace RECLOG
                   typename std::enable_if<std::is_fundamental<T>::value, bool>::type = true>
         Codec_RAW &write(const T *v, std::streamsize count)
         {
-            m_ss.write((char *)v, sizeof(T) * count);
+            m_buf->str.append((const char *)v, sizeof(T) * count);
             return *this;
         }
     };
@@ -157,15 +574,37 @@ namespace RECLOG
     class Codec_CBO
     {
     private:
-        cborio::cborstream cbs;
-        FilePtr m_pFile;
-        bool m_counted;
+        PooledBuffer<CborBuffer> m_buf;
+        cborio::encoder cbs;
+        DiskFileCluster *m_pCluster;
+        bool m_schema;
+        const LogSite *m_site;
+        std::vector<BlobRef> m_blobs;
 
     public:
-        Codec_CBO(FilePtr fp, bool counted)
-            : m_pFile(fp), m_counted(counted) {}
+        explicit Codec_CBO(DiskFileCluster *cluster, const LogSite *site = nullptr)
+            : cbs(m_buf->buf), m_pCluster(cluster), m_schema(RECONFIG::g_option.cbor_schema), m_site(site) {}
         ~Codec_CBO();
 
+        Codec_CBO(Codec_CBO &&other)
+            : m_buf(std::move(other.m_buf)), cbs(m_buf->buf), m_pCluster(other.m_pCluster), m_schema(other.m_schema),
+              m_site(other.m_site), m_blobs(std::move(other.m_blobs)) {}
+
+        // a byte string whose content is the blob.
+        Codec_CBO &operator<<(const RecBlob &blob)
+        {
+            cbs.write_bytes_head(blob.len);
+            if (blob.len < REC_BLOB_MIN)
+            {
+                m_buf->buf.put_bytes(static_cast<const unsigned char *>(blob.data), blob.len);
+            }
+            else
+            {
+                m_blobs.push_back(BlobRef{m_buf->buf.size(), blob});
+            }
+            return *this;
+        }
+
         template <typename T,
                   typename std::enable_if<refl::is_refl_info_st<typename std::decay<T>::type>::value>::type * = nullptr>
         Codec_CBO &operator<<(const T &t)
@@ -202,6 +641,15 @@ namespace RECLOG
                   typename std::enable_if<refl::IsReflected<typename std::decay<T>::type>::value>::type * = nullptr>
         void serializeObj(const T &obj, const char *fieldName = "")
         {
+            if (m_schema)
+            {
+                if (*fieldName)
+                {
+                    cbs << fieldName;
+                }
+                SchemaEncode(cbs, obj);
+                return;
+            }
             cbs << fieldName << '{';
             refl::forEach(obj, RECLOG::fLambdaFile(*this));
             cbs << '}';
@@ -211,22 +659,23 @@ namespace RECLOG
     class Codec_STR
     {
     private:
-        const char *_file;
-        unsigned int _line;
-        int m_verbosity;
-        bool m_counted;
+        const LogSite *m_site;
+        bool m_deferred;
+        // length of the preamble ahead of the text.
+        uint16_t m_stamp;
 
     private:
-        std::ostringstream m_ss;
-        FilePtr m_pFile;
+        PooledBuffer<TextBuffer> m_text;
+        PooledBuffer<ByteBuffer> m_args;
+        DiskFileCluster *m_pCluster;
 
     public:
-        Codec_STR(FilePtr fp, bool counted, int verbosity, const char *file, unsigned line)
-            : _file(file), _line(line), m_verbosity(verbosity), m_counted(counted), m_pFile(fp) {}
+        Codec_STR(DiskFileCluster *cluster, const LogSite *site);
         ~Codec_STR();
 
         Codec_STR(Codec_STR &&other)
-            : m_ss(std::move(other.m_ss)) {}
+            : m_site(other.m_site), m_deferred(other.m_deferred), m_stamp(other.m_stamp),
+              m_text(std::move(other.m_text)), m_args(std::move(other.m_args)), m_pCluster(other.m_pCluster) {}
 
         template <typename T,
                   typename std::enable_if<refl::is_refl_info_st<typename std::decay<T>::type>::value>::type * = nullptr>
@@ -247,33 +696,51 @@ namespace RECLOG
         // std::endl and other iomanip:s.
         Codec_STR &operator<<(std::ios_base &(*f)(std::ios_base &))
         {
-            f(m_ss);
+            if (m_deferred)
+            {
+                ArgWriter(m_args->str).put(f);
+            }
+            else
+            {
+                f(m_text->os);
+            }
             return *this;
         }
 
     private:
         friend struct fLambdaLog;
+        template <typename T>
+        void put(const T &obj)
+        {
+            if (m_deferred)
+            {
+                ArgWriter(m_args->str).put(obj);
+            }
+            else
+            {
+                m_text->Put(obj);
+            }
+        }
+
         template <typename T,
                   typename std::enable_if<!refl::IsReflected<typename std::decay<T>::type>::value>::type * = nullptr>
         void serializeObj(const T &obj, const char *fieldName = "")
         {
             if (*fieldName)
             {
-                m_ss << fieldName << obj;
-            }
-            else
-            {
-                m_ss << obj;
+                put(fieldName);
             }
+            put(obj);
         }
 
         template <typename T,
                   typename std::enable_if<refl::IsReflected<typename std::decay<T>::type>::value>::type * = nullptr>
         void serializeObj(const T &obj, const char *fieldName = "")
         {
-            m_ss << fieldName << '{';
+            put(fieldName);
+            put('{');
             refl::forEach(obj, RECLOG::fLambdaLog(*this));
-            m_ss << '}';
+            put('}');
         }
     };
 
@@ -309,46 +776,68 @@ namespace RECLOG
         }
     };
 
+    // what a site logs with, kept in its descriptor.
+    template <typename T>
+    struct CodecOf;
+
+    template <>
+    struct CodecOf<Codec_RAW>
+    {
+        static constexpr CodeType value = CodeType::RAW;
+    };
+
+    template <>
+    struct CodecOf<Codec_CBO>
+    {
+        static constexpr CodeType value = CodeType::CBOR;
+    };
+
+    template <>
+    struct CodecOf<Codec_STR>
+    {
+        static constexpr CodeType value = CodeType::LOG;
+    };
+
     template <typename T>
     typename std::enable_if<std::is_same<T, Codec_RAW>::value, Codec_RAW>::type
-    make_RecLog(const char *, unsigned)
+    make_RecLog(const LogSite *site)
     {
-        return Codec_RAW(RECONFIG::GetCurLogFp(), false);
+        return Codec_RAW(nullptr, site);
     }
 
     template <typename T>
     typename std::enable_if<std::is_same<T, Codec_CBO>::value, Codec_CBO>::type
-    make_RecLog(const char *, unsigned)
+    make_RecLog(const LogSite *site)
     {
-        return Codec_CBO(RECONFIG::GetCurLogFp(), false);
+        return Codec_CBO(nullptr, site);
     }
 
     template <typename T>
     typename std::enable_if<std::is_same<T, Codec_STR>::value, Codec_STR>::type
-    make_RecLog(const char *file, unsigned line)
+    make_RecLog(const LogSite *site)
     {
-        return Codec_STR(RECLOG::RECONFIG::GetCurLogFp(), false, 0, file, line);
+        return Codec_STR(nullptr, site);
     }
 
     template <typename T>
     typename std::enable_if<std::is_same<T, Codec_STR>::value, Codec_STR>::type
-    make_RecFile(const char *file, unsigned line)
+    make_RecFile(const LogSite *site)
     {
-        return Codec_STR(RECONFIG::g_flist_log.GetCurFileFp(), true, 0, file, line);
+        return Codec_STR(&RECONFIG::g_flist_log, site);
     }
 
     template <typename T>
     typename std::enable_if<std::is_same<T, Codec_RAW>::value, Codec_RAW>::type
-    make_RecFile(const char *, unsigned)
+    make_RecFile(const LogSite *site)
     {
-        return Codec_RAW(RECONFIG::g_flist_raw.GetCurFileFp(), true);
+        return Codec_RAW(&RECONFIG::g_flist_raw, site);
     }
 
     template <typename T>
     typename std::enable_if<std::is_same<T, Codec_CBO>::value, Codec_CBO>::type
-    make_RecFile(const char *, unsigned)
+    make_RecFile(const LogSite *site)
     {
-        return Codec_CBO(RECONFIG::g_flist_cbor.GetCurFileFp(), true);
+        return Codec_CBO(&RECONFIG::g_flist_cbor, site);
     }
 }
 
@@ -6,6 +6,8 @@
 #include <direct.h>
 #define localtime_r(a, b) localtime_s(b, a) // No localtime_r with MSVC, but arguments are swapped for localtime_s
 #endif
+#include "rec_clock.h"
+#include "rec_format.h"
 #include <chrono>
 #include <thread>
 #include <mutex>
@@ -15,8 +17,17 @@ namespace
     constexpr int REC_THREADNAME_WIDTH = 8;
     constexpr int REC_FILENAME_WIDTH = 23;
     constexpr int REC_PREAMBLE_WIDTH = 54 + REC_THREADNAME_WIDTH + REC_FILENAME_WIDTH;
-    constexpr int REC_MAX_FILENUM = 12;
-    constexpr size_t REC_MAX_FILESIZE = 500000;
+    constexpr size_t REC_RING_SIZE = 1 << 20;
+    constexpr size_t REC_MAP_CHUNK = 1 << 20;
+    // a batch stops growing here, rotation is checked between batches.
+    constexpr size_t REC_BATCH_BYTES = 1 << 16;
+    constexpr int REC_WRITER_IDLE_MS = 1;
+    // how often the writer notes records lost to the overload policy or collapsed as repeats.
+    constexpr long long REC_DROP_REPORT_MS = 1000;
+    // how often the writer maps clock ticks to the wall clock again.
+    constexpr long long REC_CALIBRATE_MS = 1000;
+    // screen output collects here and leaves with one write once full or flushed.
+    constexpr size_t REC_SCREEN_BUFFER = 1 << 16;
 
     inline const char *filename(const char *path)
     {
@@ -50,7 +61,7 @@ namespace
 
     inline unsigned int get_thread_name()
     {
-        return static_cast<unsigned int>(std::hash<std::thread::id>{}(std::this_thread::get_id()));
+        return RECLOG::ThisThread().index;
     }
 
     inline const char *get_verbosity_name(int verbosity)
@@ -72,6 +83,11 @@ namespace
         {
             name = "0";
         }
+        else
+        {
+            static const char *const verbose[] = {"1", "2", "3", "4", "5", "6", "7", "8", "9"};
+            name = verbose[(verbosity > 9 ? 9 : verbosity) - 1];
+        }
 
         return name;
     }
@@ -110,56 +126,110 @@ namespace
         update_bytes(snprintf(out_buff + pos, out_buff_size - pos, "   l |"));
     }
 
-    // focus on thread safety.
-    inline void print_preamble(char *out_buff, size_t out_buff_size, int verbosity, const char *file, unsigned int line)
+    // the file:line column of the preamble, sites keep it so records do not format it again.
+    inline void format_where(char *out_buff, size_t out_buff_size, const char *file, unsigned int line)
+    {
+        // the precision keeps the head of a long name, no temporary to truncate into.
+        snprintf(out_buff, out_buff_size, "%*.*s:%-6u ", REC_FILENAME_WIDTH, REC_FILENAME_WIDTH, filename(file), line);
+    }
+
+    // everything the preamble shows is given, so records can be rendered far from where they were made.
+    inline void format_preamble(char *out_buff, size_t out_buff_size, long long ms_since_epoch, long long start_time,
+                                const char *thread, int verbosity, const char *where)
     {
         if (out_buff_size == 0)
         {
             return;
         }
         out_buff[0] = '\0';
-        long long ms_since_epoch = get_date_time();
+        // lines of one second share the date, localtime_r runs once per second and thread.
+        static thread_local time_t cached_sec = -1;
+        static thread_local char cached_date[24];
         time_t sec_since_epoch = time_t(ms_since_epoch / 1000);
-        tm time_info;
-        localtime_r(&sec_since_epoch, &time_info);
-
-        auto uptime_ms = ms_since_epoch - RECLOG::RECONFIG::start_time;
-        auto uptime_sec = static_cast<double>(uptime_ms) / 1000.0;
-
-        char thread_name[REC_THREADNAME_WIDTH + 1] = {0};
-        print_thread_name(get_thread_name(), thread_name, REC_THREADNAME_WIDTH + 1, true);
-
-        const char *level_buff = get_verbosity_name(verbosity);
-
-        file = filename(file);
+        if (sec_since_epoch != cached_sec)
+        {
+            tm time_info;
+            localtime_r(&sec_since_epoch, &time_info);
+            // clamped to the digits the format shows, so the date is never longer than 19 chars.
+            auto field = [](int v, unsigned limit)
+            { return static_cast<unsigned>(v < 0 ? 0 : v) % limit; };
+            snprintf(cached_date, sizeof(cached_date), "%04u-%02u-%02u %02u:%02u:%02u",
+                     field(1900 + time_info.tm_year, 10000), field(1 + time_info.tm_mon, 100),
+                     field(time_info.tm_mday, 100), field(time_info.tm_hour, 100), field(time_info.tm_min, 100),
+                     field(time_info.tm_sec, 100));
+            cached_sec = sec_since_epoch;
+        }
 
+        // "%s.%03lld (%8.3fs) [%-*s]%s%4s | " without a printf, every field is known to fit.
+        char line[160];
         size_t pos = 0;
-
-        auto update_bytes = [&pos](int bytes)
+        auto put = [&line, &pos](const char *text, size_t len)
         {
-            if (bytes > 0)
+            memcpy(line + pos, text, len);
+            pos += len;
+        };
+        auto pad = [&line, &pos](size_t len, size_t width)
+        {
+            for (; len < width; ++len)
             {
-                pos += bytes;
+                line[pos++] = ' ';
             }
         };
+        put(cached_date, strlen(cached_date));
+        auto ms = ms_since_epoch % 1000;
+        line[pos++] = '.';
+        line[pos++] = static_cast<char>('0' + ms / 100);
+        put(RECLOG::digit_pairs() + 2 * (ms % 100), 2);
+        line[pos++] = ' ';
+
+        auto uptime_ms = ms_since_epoch - start_time;
+        auto uptime_abs = static_cast<uint64_t>(uptime_ms < 0 ? -uptime_ms : uptime_ms);
+        char uptime[RECLOG::REC_NUMBER_CHARS];
+        size_t len = 0;
+        if (uptime_ms < 0)
+        {
+            uptime[len++] = '-';
+        }
+        len += RECLOG::FormatUInt(uptime + len, uptime_abs / 1000);
+        uptime[len++] = '.';
+        uptime[len++] = static_cast<char>('0' + uptime_abs % 1000 / 100);
+        memcpy(uptime + len, RECLOG::digit_pairs() + 2 * (uptime_abs % 100), 2);
+        len += 2;
+        line[pos++] = '(';
+        pad(len, 8);
+        put(uptime, len);
+        put("s) [", 4);
+
+        len = strnlen(thread, RECLOG::REC_THREAD_TEXT);
+        put(thread, len);
+        pad(len, REC_THREADNAME_WIDTH);
+        line[pos++] = ']';
+        put(where, strnlen(where, RECLOG::REC_SITE_WHERE));
 
-        // date-time
-        update_bytes(snprintf(out_buff + pos, out_buff_size - pos, "%04d-%02d-%02d %02d:%02d:%02d.%03lld ",
-                              1900 + time_info.tm_year, 1 + time_info.tm_mon, time_info.tm_mday,
-                              time_info.tm_hour, time_info.tm_min, time_info.tm_sec, ms_since_epoch % 1000));
-        // update_time
-        update_bytes(snprintf(out_buff + pos, out_buff_size - pos, "(%8.3fs) ", uptime_sec));
-        // thread_id
-        update_bytes(snprintf(out_buff + pos, out_buff_size - pos, "[%-*s]", REC_THREADNAME_WIDTH, thread_name));
-        // file
-        char shortened_filename[REC_FILENAME_WIDTH + 1];
-        snprintf(shortened_filename, REC_FILENAME_WIDTH + 1, "%s", file);
-        update_bytes(snprintf(out_buff + pos, out_buff_size - pos, "%*s:%-6u ",
-                              REC_FILENAME_WIDTH, shortened_filename, line));
-        // level
-        update_bytes(snprintf(out_buff + pos, out_buff_size - pos, "%4s | ", level_buff));
-        // delimiter
-        // update_bytes(snprintf(out_buff + pos, out_buff_size - pos, " | "));
+        const char *level_buff = get_verbosity_name(verbosity);
+        len = strlen(level_buff);
+        pad(len, 4);
+        put(level_buff, len);
+        put(" | ", 3);
+
+        pos = pos < out_buff_size ? pos : out_buff_size - 1;
+        memcpy(out_buff, line, pos);
+        out_buff[pos] = '\0';
+    }
+
+    inline void format_preamble(char *out_buff, size_t out_buff_size, long long ms_since_epoch, long long start_time,
+                                const char *thread, int verbosity, const char *file, unsigned int line)
+    {
+        char where[RECLOG::REC_SITE_WHERE];
+        format_where(where, sizeof(where), file, line);
+        format_preamble(out_buff, out_buff_size, ms_since_epoch, start_time, thread, verbosity, where);
+    }
+
+    // focus on thread safety.
+    inline void print_preamble(char *out_buff, size_t out_buff_size, const RECLOG::LogSite &site)
+    {
+        format_preamble(out_buff, out_buff_size, RECLOG::Clock::Now() / 1000000, RECLOG::RECONFIG::start_time,
+                        RECLOG::ThisThread().text, site.verbosity, site.where);
     }
 
     inline void print_header()
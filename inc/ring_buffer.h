@@ -0,0 +1,197 @@
+#ifndef CBOR_RING_BUFFER_H
+#define CBOR_RING_BUFFER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace RECLOG
+{
+    constexpr size_t REC_CACHELINE_SIZE = 64;
+    constexpr uint32_t REC_RING_WRAP = 0xFFFFFFFFu;
+
+    // single producer single consumer byte queue.
+    // entries are contiguous, 8 bytes aligned and start with a uint32_t length,
+    // so the consumer can walk them without any extra bookkeeping.
+    class RingBuffer
+    {
+    public:
+        explicit RingBuffer(size_t capacity)
+            : m_capacity(capacity), m_mask(capacity - 1), m_data(new unsigned char[capacity]),
+              m_head(0), m_cached_tail(0), m_reserved(0), m_tail(0), m_claim(0), m_cached_head(0), m_last(0) {}
+
+        size_t Capacity() const
+        {
+            return m_capacity;
+        }
+
+        // bytes published and not yet released, a snapshot from either side.
+        size_t Used() const
+        {
+            // the tail first, the head read after it can only be further along.
+            auto tail = m_tail.load(std::memory_order_acquire);
+            return m_head.load(std::memory_order_acquire) - tail;
+        }
+
+        static size_t Align(size_t len)
+        {
+            return (len + 7) & ~static_cast<size_t>(7);
+        }
+
+        // producer: contiguous room for len bytes, or nullptr when full.
+        unsigned char *Reserve(size_t len)
+        {
+            len = Align(len);
+            auto head = m_head.load(std::memory_order_relaxed);
+            auto to_end = m_capacity - (head & m_mask);
+            auto need = to_end < len ? to_end + len : len;
+            if (need > m_capacity - (head - m_cached_tail))
+            {
+                m_cached_tail = m_tail.load(std::memory_order_acquire);
+                if (need > m_capacity - (head - m_cached_tail))
+                {
+                    return nullptr;
+                }
+            }
+            if (to_end < len)
+            {
+                // not enough room before the end, mark the rest as skipped.
+                Word(m_data.get() + (head & m_mask)).store(REC_RING_WRAP, std::memory_order_relaxed);
+                head += to_end;
+            }
+            m_reserved = need;
+            return m_data.get() + (head & m_mask);
+        }
+
+        // producer: publish the entry handed out by the last Reserve.
+        void Commit()
+        {
+            m_head.store(m_head.load(std::memory_order_relaxed) + m_reserved, std::memory_order_release);
+            m_reserved = 0;
+        }
+
+        // consumer: take the next entry, nullptr when empty. it stays readable until Release.
+        const unsigned char *Claim()
+        {
+            size_t start = 0, end = 0;
+            while (true)
+            {
+                auto pos = m_claim.load(std::memory_order_acquire);
+                if (pos >= m_cached_head)
+                {
+                    m_cached_head = m_head.load(std::memory_order_acquire);
+                    if (pos >= m_cached_head)
+                    {
+                        return nullptr;
+                    }
+                }
+                auto ptr = TryClaim(pos, start, end);
+                if (ptr != nullptr)
+                {
+                    m_last = start;
+                    return ptr;
+                }
+            }
+        }
+
+        // consumer: hand everything claimed so far back to the producer,
+        // keep_last holds on to the entry returned by the last Claim.
+        void Release(bool keep_last = false)
+        {
+            auto claim = keep_last ? m_last : m_claim.load(std::memory_order_acquire);
+            auto tail = m_tail.load(std::memory_order_relaxed);
+            while (tail < claim && !m_tail.compare_exchange_weak(tail, claim, std::memory_order_release))
+            {
+            }
+        }
+
+        // producer: take the oldest entry the consumer has not claimed yet, nullptr when there is none
+        // or the consumer still holds older ones, freeing it would not give any room back then.
+        // start and end bound the space it held, wrap padding included.
+        unsigned char *ClaimOldest(size_t &start, size_t &end)
+        {
+            auto head = m_head.load(std::memory_order_relaxed);
+            while (true)
+            {
+                auto pos = m_claim.load(std::memory_order_acquire);
+                // the tail never passes the claim, once claimed at pos it stays there for ReleaseOldest.
+                if (pos >= head || m_tail.load(std::memory_order_acquire) != pos)
+                {
+                    return nullptr;
+                }
+                auto ptr = TryClaim(pos, start, end);
+                if (ptr != nullptr)
+                {
+                    return const_cast<unsigned char *>(ptr);
+                }
+            }
+        }
+
+        // producer: free an entry taken by ClaimOldest.
+        bool ReleaseOldest(size_t start, size_t end)
+        {
+            return m_tail.compare_exchange_strong(start, end, std::memory_order_release);
+        }
+
+        // producer: more than half of the ring is in use.
+        bool Crowded() const
+        {
+            return m_head.load(std::memory_order_relaxed) - m_tail.load(std::memory_order_relaxed) > m_capacity / 2;
+        }
+
+        bool Empty() const
+        {
+            return m_tail.load(std::memory_order_acquire) == m_head.load(std::memory_order_acquire);
+        }
+
+    private:
+        // the length word leading every entry.
+        static std::atomic<uint32_t> &Word(unsigned char *ptr)
+        {
+            return *reinterpret_cast<std::atomic<uint32_t> *>(ptr);
+        }
+
+        // producer and consumer both claim entries, a wrap marker goes with the entry after it.
+        const unsigned char *TryClaim(size_t pos, size_t &start, size_t &end)
+        {
+            auto entry = pos;
+            auto ptr = m_data.get() + (entry & m_mask);
+            // pos may be stale and its bytes reused by a producer dropping the oldest, the words are
+            // read atomically and the failing exchange below throws such a read away.
+            // Commit publishes a marker together with its entry, there is always one behind it.
+            if (Word(ptr).load(std::memory_order_relaxed) == REC_RING_WRAP)
+            {
+                entry += m_capacity - (entry & m_mask);
+                ptr = m_data.get();
+            }
+            auto next = entry + Align(Word(ptr).load(std::memory_order_relaxed));
+            if (!m_claim.compare_exchange_weak(pos, next, std::memory_order_acq_rel))
+            {
+                return nullptr;
+            }
+            start = pos;
+            end = next;
+            return ptr;
+        }
+
+        const size_t m_capacity;
+        const size_t m_mask;
+        std::unique_ptr<unsigned char[]> m_data;
+        // producer side, padded so both ends never share a cache line.
+        char m_pad0[REC_CACHELINE_SIZE];
+        std::atomic_size_t m_head;
+        size_t m_cached_tail;
+        size_t m_reserved;
+        // consumer side
+        char m_pad1[REC_CACHELINE_SIZE];
+        std::atomic_size_t m_tail;
+        // first entry nobody claimed, moved by the consumer and by a producer dropping the oldest.
+        std::atomic_size_t m_claim;
+        size_t m_cached_head;
+        size_t m_last;
+        char m_pad2[REC_CACHELINE_SIZE];
+    };
+}
+
+#endif
@@ -1,28 +1,916 @@
 #ifndef THREAD_POOL_H
 #define THREAD_POOL_H
 
-#include <queue>
+#include <algorithm>
+#include <atomic>
 #include <functional>
+#include <memory>
 #include <mutex>
+#include <new>
 #include <condition_variable>
 #include <thread>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
 #include <cassert>
+#include <exception>
+#include <type_traits>
+#include <utility>
+#include <string>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
+// move only callable for the pool. closures up to inline_size live in the task itself,
+// larger ones or ones that may throw while moving go to the heap.
+class PoolTask
+{
+public:
+    static constexpr size_t inline_size = 64;
+
+    PoolTask() : m_ops(nullptr) {}
+
+    template <typename F, typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, PoolTask>::value>::type>
+    PoolTask(F &&f) : m_ops(nullptr)
+    {
+        using Fn = typename std::decay<F>::type;
+        emplace<Fn>(std::forward<F>(f), std::integral_constant<bool, fits<Fn>()>());
+    }
+
+    PoolTask(PoolTask &&other) noexcept : m_ops(other.m_ops)
+    {
+        if (m_ops != nullptr)
+        {
+            m_ops->move(&m_storage, &other.m_storage);
+            other.m_ops = nullptr;
+        }
+    }
+
+    PoolTask &operator=(PoolTask &&other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            if (other.m_ops != nullptr)
+            {
+                other.m_ops->move(&m_storage, &other.m_storage);
+                m_ops = other.m_ops;
+                other.m_ops = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    PoolTask(const PoolTask &) = delete;
+    PoolTask &operator=(const PoolTask &) = delete;
+
+    ~PoolTask()
+    {
+        reset();
+    }
+
+    void operator()()
+    {
+        m_ops->call(&m_storage);
+    }
+
+    explicit operator bool() const
+    {
+        return m_ops != nullptr;
+    }
+
+    // drops the closure and whatever it captured.
+    void reset()
+    {
+        if (m_ops != nullptr)
+        {
+            m_ops->destroy(&m_storage);
+            m_ops = nullptr;
+        }
+    }
+
+private:
+    struct Ops
+    {
+        void (*call)(void *);
+        // move constructs into dst and destroys src.
+        void (*move)(void *dst, void *src);
+        void (*destroy)(void *);
+    };
+
+    template <typename Fn>
+    static constexpr bool fits()
+    {
+        return sizeof(Fn) <= inline_size && alignof(Fn) <= alignof(std::max_align_t) &&
+               std::is_nothrow_move_constructible<Fn>::value;
+    }
+
+    template <typename Fn>
+    struct InlineOps
+    {
+        static void call(void *p)
+        {
+            (*static_cast<Fn *>(p))();
+        }
+        static void move(void *dst, void *src)
+        {
+            new (dst) Fn(std::move(*static_cast<Fn *>(src)));
+            static_cast<Fn *>(src)->~Fn();
+        }
+        static void destroy(void *p)
+        {
+            static_cast<Fn *>(p)->~Fn();
+        }
+        static const Ops *ops()
+        {
+            static const Ops table = {call, move, destroy};
+            return &table;
+        }
+    };
+
+    template <typename Fn>
+    struct HeapOps
+    {
+        static void call(void *p)
+        {
+            (**static_cast<Fn **>(p))();
+        }
+        static void move(void *dst, void *src)
+        {
+            *static_cast<Fn **>(dst) = *static_cast<Fn **>(src);
+        }
+        static void destroy(void *p)
+        {
+            delete *static_cast<Fn **>(p);
+        }
+        static const Ops *ops()
+        {
+            static const Ops table = {call, move, destroy};
+            return &table;
+        }
+    };
+
+    template <typename Fn, typename F>
+    void emplace(F &&f, std::true_type)
+    {
+        new (&m_storage) Fn(std::forward<F>(f));
+        m_ops = InlineOps<Fn>::ops();
+    }
+
+    template <typename Fn, typename F>
+    void emplace(F &&f, std::false_type)
+    {
+        *reinterpret_cast<Fn **>(&m_storage) = new Fn(std::forward<F>(f));
+        m_ops = HeapOps<Fn>::ops();
+    }
+
+    typename std::aligned_storage<inline_size, alignof(std::max_align_t)>::type m_storage;
+    const Ops *m_ops;
+};
+
+// Chase-Lev deque, the owner pushes and takes at the bottom, thieves steal from the top.
+template <typename T>
+class WorkStealingDeque
+{
+private:
+    struct Array
+    {
+        explicit Array(int64_t capacity) : mask(capacity - 1), slots(new std::atomic<T *>[capacity]) {}
+        int64_t mask;
+        std::unique_ptr<std::atomic<T *>[]> slots;
+
+        T *get(int64_t i) const
+        {
+            return slots[i & mask].load(std::memory_order_relaxed);
+        }
+        void put(int64_t i, T *item)
+        {
+            slots[i & mask].store(item, std::memory_order_relaxed);
+        }
+    };
+
+    std::atomic<int64_t> m_top;
+    std::atomic<int64_t> m_bottom;
+    std::atomic<Array *> m_array;
+    // outgrown arrays, a thief may still read one until the deque goes.
+    std::vector<std::unique_ptr<Array>> m_arrays;
+
+public:
+    explicit WorkStealingDeque(int64_t capacity = 256) : m_top(0), m_bottom(0)
+    {
+        m_arrays.emplace_back(new Array(capacity));
+        m_array.store(m_arrays.back().get(), std::memory_order_relaxed);
+    }
+
+    // owner only.
+    void push(T *item)
+    {
+        auto b = m_bottom.load(std::memory_order_relaxed);
+        auto t = m_top.load(std::memory_order_acquire);
+        auto a = m_array.load(std::memory_order_relaxed);
+        if (b - t > a->mask)
+        {
+            auto bigger = new Array(2 * (a->mask + 1));
+            for (auto i = t; i < b; ++i)
+            {
+                bigger->put(i, a->get(i));
+            }
+            m_arrays.emplace_back(bigger);
+            m_array.store(bigger, std::memory_order_release);
+            a = bigger;
+        }
+        a->put(b, item);
+        std::atomic_thread_fence(std::memory_order_release);
+        m_bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    // owner only, newest first.
+    T *take()
+    {
+        auto b = m_bottom.load(std::memory_order_relaxed) - 1;
+        auto a = m_array.load(std::memory_order_relaxed);
+        m_bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto t = m_top.load(std::memory_order_relaxed);
+        if (t > b)
+        {
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        auto item = a->get(b);
+        if (t == b)
+        {
+            // the last one, a thief may be after it too.
+            if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            {
+                item = nullptr;
+            }
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    // any thread, oldest first. nullptr when empty or another thief won.
+    T *steal()
+    {
+        auto t = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto b = m_bottom.load(std::memory_order_acquire);
+        if (t >= b)
+        {
+            return nullptr;
+        }
+        auto item = m_array.load(std::memory_order_acquire)->get(t);
+        if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        {
+            return nullptr;
+        }
+        return item;
+    }
+
+    bool empty() const
+    {
+        return m_top.load(std::memory_order_acquire) >= m_bottom.load(std::memory_order_acquire);
+    }
+};
+
+class FunctionPool;
+
+// how the workers of a pool are scheduled, see FunctionPool::configure. linux only.
+struct PoolOptions
+{
+    // workers are called name/0, name/1 ... in top and perf, the kernel keeps 15 chars.
+    std::string name;
+    // cpus the workers may run on, empty leaves the affinity alone.
+    std::vector<int> cpus;
+    int nice = 0;
+    // the last low_workers workers run the post_low lane and nothing else, one worker at
+    // least stays for post. 0 lets every worker take low tasks once nothing else is queued.
+    size_t low_workers = 0;
+    int low_nice = 0;
+    // SCHED_IDLE for the low lane, it only gets cpus that would otherwise idle.
+    bool low_idle = false;
+};
+
+// totals since the pool started, see FunctionPool::stats.
+struct PoolStats
+{
+    size_t workers = 0;
+    uint64_t executed = 0;
+    // tasks taken from another worker's deque.
+    uint64_t stolen = 0;
+    // times a worker went to sleep for lack of work.
+    uint64_t parked = 0;
+    // waiting in the shared queues, the deques are not counted.
+    size_t queued = 0;
+    size_t queued_low = 0;
+};
+
+// set once when a submitted task or a parallel_for finished.
+class PoolSignal
+{
+public:
+    PoolSignal() : m_ready(false) {}
+
+    bool ready() const
+    {
+        return m_ready.load(std::memory_order_acquire);
+    }
+
+    void set()
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_ready.store(true, std::memory_order_release);
+        m_cond.notify_all();
+    }
+
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(m_lock);
+        m_cond.wait(lock, [this]()
+                    { return ready(); });
+    }
+
+    std::exception_ptr error;
+
+private:
+    std::atomic_bool m_ready;
+    std::mutex m_lock;
+    std::condition_variable m_cond;
+};
+
+template <typename T>
+class PoolResult : public PoolSignal
+{
+public:
+    PoolResult() : m_has(false) {}
+    ~PoolResult()
+    {
+        if (m_has)
+        {
+            value()->~T();
+        }
+    }
+
+    template <typename F>
+    void run(F &f)
+    {
+        try
+        {
+            new (&m_value) T(f());
+            m_has = true;
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+        set();
+    }
+
+    T take()
+    {
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+        return std::move(*value());
+    }
+
+private:
+    T *value()
+    {
+        return reinterpret_cast<T *>(&m_value);
+    }
+
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type m_value;
+    bool m_has;
+};
+
+template <>
+class PoolResult<void> : public PoolSignal
+{
+public:
+    template <typename F>
+    void run(F &f)
+    {
+        try
+        {
+            f();
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+        set();
+    }
+
+    void take()
+    {
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+    }
+};
+
+// what submit returns. waiting on a worker of the same pool runs other tasks meanwhile,
+// so tasks may wait on tasks without starving the pool.
+template <typename T>
+class PoolFuture
+{
+public:
+    PoolFuture() : m_pool(nullptr) {}
+    PoolFuture(FunctionPool *pool, std::shared_ptr<PoolResult<T>> result) : m_pool(pool), m_result(std::move(result)) {}
+
+    bool valid() const
+    {
+        return m_result != nullptr;
+    }
+
+    bool ready() const
+    {
+        return m_result->ready();
+    }
+
+    void wait() const;
+    // once only, rethrows what the task threw.
+    T get();
+
+private:
+    FunctionPool *m_pool;
+    std::shared_ptr<PoolResult<T>> m_result;
+};
+
+// work stealing pool. tasks posted by a worker go to its own deque, the rest to a shared
+// injection queue. idle workers steal, spin a while and only then sleep.
 class FunctionPool
 {
 private:
-    std::vector<std::thread> m_workers;
-    std::queue<std::function<void()>> m_function_queue;
+    struct Worker
+    {
+        ~Worker()
+        {
+            for (auto node : cache)
+            {
+                delete node;
+            }
+        }
+        WorkStealingDeque<PoolTask> deque;
+        std::thread thread;
+        size_t index = 0;
+        // set by the worker once it runs, under m_config_lock.
+        bool started = false;
+#ifdef __linux__
+        pid_t tid = 0;
+        pthread_t handle;
+#endif
+        // takes low lane tasks only, besides what it posts itself.
+        std::atomic_bool low_only{false};
+        // picks the victims, xorshift.
+        uint32_t seed;
+        // emptied deque nodes, only touched by the worker's own thread.
+        std::vector<PoolTask *> cache;
+        // written by the worker only, stats() reads them from anywhere.
+        std::atomic<uint64_t> executed{0};
+        std::atomic<uint64_t> stolen{0};
+        std::atomic<uint64_t> parked{0};
+    };
+
+    // the worker running on this thread, if it belongs to this pool.
+    struct Current
+    {
+        FunctionPool *pool;
+        Worker *worker;
+    };
+
+    template <typename R, typename Fn>
+    struct Submitted
+    {
+        std::shared_ptr<PoolResult<R>> result;
+        Fn fn;
+        void operator()()
+        {
+            result->run(fn);
+        }
+    };
+
+    template <typename Fn>
+    struct ForLoop : PoolSignal
+    {
+        ForLoop(Fn &&fn, size_t count, size_t grain) : body(std::move(fn)), left(count), grain(grain), failed(false) {}
+        Fn body;
+        std::atomic_size_t left;
+        size_t grain;
+        std::atomic_bool failed;
+        std::mutex lock;
+    };
+
+    template <typename Fn>
+    struct ForPiece
+    {
+        FunctionPool *pool;
+        std::shared_ptr<ForLoop<Fn>> loop;
+        size_t begin;
+        size_t end;
+        void operator()()
+        {
+            pool->run_range(loop, begin, end);
+        }
+    };
+
+    template <typename T>
+    friend class PoolFuture;
+
+    template <typename T, typename... Args>
+    using result_of_task = typename std::result_of<typename std::decay<T>::type &(typename std::decay<Args>::type &...)>::type;
+
+    // rounds of looking for work before a worker sleeps.
+    static constexpr int spin_rounds = 64;
+    static constexpr size_t cache_limit = 1024;
+
+    // tasks posted from outside, grows by doubling and never shrinks.
+    struct TaskRing
+    {
+        std::vector<PoolTask> slots;
+        size_t head = 0;
+        size_t count = 0;
+        std::atomic_size_t queued{0};
+
+        void push(PoolTask &&task)
+        {
+            if (count == slots.size())
+            {
+                std::vector<PoolTask> bigger(slots.empty() ? 64 : 2 * slots.size());
+                for (size_t i = 0; i < count; ++i)
+                {
+                    bigger[i] = std::move(slots[(head + i) % slots.size()]);
+                }
+                slots.swap(bigger);
+                head = 0;
+            }
+            slots[(head + count++) % slots.size()] = std::move(task);
+            queued.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        bool pop(PoolTask &task)
+        {
+            if (count == 0)
+            {
+                return false;
+            }
+            task = std::move(slots[head]);
+            head = (head + 1) % slots.size();
+            --count;
+            queued.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+
+        bool empty() const
+        {
+            return queued.load(std::memory_order_relaxed) == 0;
+        }
+    };
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    TaskRing m_injection;
+    TaskRing m_low;
+    std::mutex m_inject_lock;
+    std::atomic_size_t m_low_workers;
     std::mutex m_lock;
     std::condition_variable m_data_condition;
-    bool m_terminated;
+    std::atomic_int m_sleepers;
+    std::atomic_bool m_terminated;
+    std::mutex m_config_lock;
+    PoolOptions m_options;
+    bool m_configured;
+#ifdef __linux__
+    pid_t m_pid;
+#endif
+
+    static void bump(std::atomic<uint64_t> &counter)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    static Current &current()
+    {
+        static thread_local Current cur = {nullptr, nullptr};
+        return cur;
+    }
+
+    void push(PoolTask &&task)
+    {
+        auto &cur = current();
+        if (cur.pool == this)
+        {
+            push_local(*cur.worker, std::move(task));
+        }
+        else
+        {
+            std::lock_guard<std::mutex> lock(m_inject_lock);
+            m_injection.push(std::move(task));
+        }
+        wake(1);
+    }
+
+    void push_local(Worker &self, PoolTask &&task)
+    {
+        PoolTask *node = nullptr;
+        if (self.cache.empty())
+        {
+            node = new PoolTask(std::move(task));
+        }
+        else
+        {
+            node = self.cache.back();
+            self.cache.pop_back();
+            *node = std::move(task);
+        }
+        self.deque.push(node);
+    }
+
+    void wake(size_t tasks)
+    {
+        // pairs with the fence in park, either we see the sleeper or it sees the task.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_sleepers.load(std::memory_order_relaxed) > 0)
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            // a low lane worker may be the one woken, it cannot take a normal task.
+            if (tasks > 1 || m_low_workers.load(std::memory_order_relaxed) != 0)
+            {
+                m_data_condition.notify_all();
+            }
+            else
+            {
+                m_data_condition.notify_one();
+            }
+        }
+    }
+
+    bool take_injected(TaskRing &ring, PoolTask &task)
+    {
+        if (ring.empty())
+        {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(m_inject_lock);
+        return ring.pop(task);
+    }
+
+    // own deque, outside posts, other deques and the low lane last. the node a task came
+    // in goes to our cache.
+    bool find_task(Worker &self, PoolTask &task)
+    {
+        auto node = self.deque.take();
+        if (node == nullptr && self.low_only.load(std::memory_order_relaxed))
+        {
+            return take_injected(m_low, task);
+        }
+        if (node == nullptr && take_injected(m_injection, task))
+        {
+            return true;
+        }
+        auto n = m_workers.size();
+        for (size_t i = 0; node == nullptr && i < n; ++i)
+        {
+            self.seed ^= self.seed << 13;
+            self.seed ^= self.seed >> 17;
+            self.seed ^= self.seed << 5;
+            auto &victim = *m_workers[(self.seed + i) % n];
+            if (&victim != &self && (node = victim.deque.steal()) != nullptr)
+            {
+                bump(self.stolen);
+            }
+        }
+        if (node == nullptr)
+        {
+            return m_low_workers.load(std::memory_order_relaxed) == 0 && take_injected(m_low, task);
+        }
+        task = std::move(*node);
+        if (self.cache.size() < cache_limit)
+        {
+            self.cache.push_back(node);
+        }
+        else
+        {
+            delete node;
+        }
+        return true;
+    }
+
+    void wait(PoolSignal &signal)
+    {
+        auto &cur = current();
+        if (cur.pool != this)
+        {
+            signal.wait();
+            return;
+        }
+        PoolTask task;
+        while (!signal.ready())
+        {
+            if (find_task(*cur.worker, task))
+            {
+                task();
+                task.reset();
+                bump(cur.worker->executed);
+            }
+            else
+            {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    // nothing queued where a thief would look, time to hand out more of a range.
+    bool starving() const
+    {
+        auto &cur = current();
+        if (cur.pool == this)
+        {
+            return cur.worker->deque.empty();
+        }
+        return m_injection.empty();
+    }
+
+    // lazy binary splitting, half of what is left goes out whenever the last half was taken.
+    template <typename Fn>
+    void run_range(const std::shared_ptr<ForLoop<Fn>> &loop, size_t begin, size_t end)
+    {
+        while (begin < end)
+        {
+            if (end - begin >= 2 * loop->grain && starving())
+            {
+                auto mid = begin + (end - begin) / 2;
+                push(PoolTask(ForPiece<Fn>{this, loop, mid, end}));
+                end = mid;
+                continue;
+            }
+            auto n = std::min(loop->grain, end - begin);
+            if (!loop->failed.load(std::memory_order_relaxed))
+            {
+                try
+                {
+                    loop->body(begin, begin + n);
+                }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> lock(loop->lock);
+                    if (!loop->failed.exchange(true))
+                    {
+                        loop->error = std::current_exception();
+                    }
+                }
+            }
+            begin += n;
+            if (loop->left.fetch_sub(n, std::memory_order_acq_rel) == n)
+            {
+                loop->set();
+            }
+        }
+    }
+
+    bool has_work(const Worker &self) const
+    {
+        if (!m_low.empty() && (self.low_only.load(std::memory_order_relaxed) || m_low_workers.load() == 0))
+        {
+            return true;
+        }
+        if (self.low_only.load(std::memory_order_relaxed))
+        {
+            return !self.deque.empty();
+        }
+        if (!m_injection.empty())
+        {
+            return true;
+        }
+        for (auto &w : m_workers)
+        {
+            if (!w->deque.empty())
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void park(Worker &self)
+    {
+        std::unique_lock<std::mutex> lock(m_lock);
+        m_sleepers.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!has_work(self) && !m_terminated.load())
+        {
+            bump(self.parked);
+            m_data_condition.wait(lock);
+        }
+        m_sleepers.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // m_config_lock held.
+    bool apply(const Worker &worker)
+    {
+        bool lane = worker.low_only.load();
+#ifdef __linux__
+        bool applied = true;
+        if (!m_options.name.empty())
+        {
+            auto name = (m_options.name + "/" + std::to_string(worker.index)).substr(0, 15);
+            applied = pthread_setname_np(worker.handle, name.c_str()) == 0 && applied;
+        }
+        if (!m_options.cpus.empty())
+        {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            for (auto cpu : m_options.cpus)
+            {
+                CPU_SET(cpu, &set);
+            }
+            applied = pthread_setaffinity_np(worker.handle, sizeof(set), &set) == 0 && applied;
+        }
+        auto nice = lane ? m_options.low_nice : m_options.nice;
+        if (nice != 0)
+        {
+            applied = setpriority(PRIO_PROCESS, static_cast<id_t>(worker.tid), nice) == 0 && applied;
+        }
+        if (lane && m_options.low_idle)
+        {
+            sched_param param = {};
+            applied = sched_setscheduler(worker.tid, SCHED_IDLE, &param) == 0 && applied;
+        }
+        return applied;
+#else
+        return m_options.name.empty() && m_options.cpus.empty() && m_options.nice == 0 && m_options.low_nice == 0 &&
+               !(lane && m_options.low_idle);
+#endif
+    }
+
+    void infinite_loop_func(Worker *self)
+    {
+        current() = {this, self};
+        {
+            // a pool configured before its workers ran, they apply the options themselves.
+            std::lock_guard<std::mutex> lock(m_config_lock);
+            self->started = true;
+#ifdef __linux__
+            self->tid = static_cast<pid_t>(syscall(SYS_gettid));
+            self->handle = pthread_self();
+#endif
+            if (m_configured)
+            {
+                apply(*self);
+            }
+        }
+        int idle = 0;
+        PoolTask task;
+        while (true)
+        {
+            if (find_task(*self, task))
+            {
+                task();
+                task.reset();
+                bump(self->executed);
+                idle = 0;
+                continue;
+            }
+            if (m_terminated.load() && !has_work(*self))
+            {
+                // finish the thread loop and let it join in the main thread.
+                return;
+            }
+            if (++idle < spin_rounds)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            park(*self);
+            idle = 0;
+        }
+    }
 
 public:
-    FunctionPool(int workers = 1) : m_function_queue(), m_lock(), m_data_condition(), m_terminated(false)
+    FunctionPool(int workers = 1)
+        : m_low_workers(0), m_sleepers(0), m_terminated(false), m_configured(false)
     {
+#ifdef __linux__
+        m_pid = getpid();
+#endif
         for (auto i = 0; i < workers; ++i)
         {
-            m_workers.push_back(std::thread(&FunctionPool::infinite_loop_func, this));
+            std::unique_ptr<Worker> worker(new Worker());
+            worker->index = static_cast<size_t>(i);
+            worker->seed = 0x9E3779B9u * static_cast<uint32_t>(i + 1);
+            m_workers.push_back(std::move(worker));
+        }
+        // every deque exists before a thief can look at it.
+        for (auto &worker : m_workers)
+        {
+            worker->thread = std::thread(&FunctionPool::infinite_loop_func, this, worker.get());
         }
     }
     ~FunctionPool()
@@ -30,48 +918,160 @@ public:
         done();
         for (auto &i : m_workers)
         {
-            i.join();
+            i->thread.join();
         }
     };
 
+    template <typename T>
+    void post(T &&f)
+    {
+        push(PoolTask(std::forward<T>(f)));
+    }
+
+    // the arguments are stored with the task and passed as lvalues, like std::bind.
+    template <typename T, typename Arg, typename... Args>
+    void post(T &&f, Arg &&arg, Args &&...args)
+    {
+        push(PoolTask(std::bind(std::forward<T>(f), std::forward<Arg>(arg), std::forward<Args>(args)...)));
+    }
+
+    // the low lane, run after everything posted normally or on the low_workers only.
     template <typename T, typename... Args>
-    void post(T &&f, Args &&...args)
+    void post_low(T &&f, Args &&...args)
     {
-        auto func = std::bind(std::forward<T>(f), std::forward<Args>(args)...);
-        std::unique_lock<std::mutex> lock(m_lock);
-        m_function_queue.push(func);
-        lock.unlock();
-        m_data_condition.notify_one();
+        {
+            std::lock_guard<std::mutex> lock(m_inject_lock);
+            m_low.push(PoolTask(std::bind(std::forward<T>(f), std::forward<Args>(args)...)));
+        }
+        wake(1);
     }
 
-    void done()
+    // names, pins and prioritizes the workers, false if the system refused any of it.
+    bool configure(const PoolOptions &options)
     {
-        std::unique_lock<std::mutex> lock(m_lock);
-        m_terminated = true;
+        std::unique_lock<std::mutex> lock(m_config_lock);
+        m_options = options;
+        m_configured = true;
+        auto low = std::min(options.low_workers, m_workers.size() - (m_workers.empty() ? 0 : 1));
+        bool applied = true;
+        for (auto &worker : m_workers)
+        {
+            worker->low_only.store(worker->index >= m_workers.size() - low);
+#ifdef __linux__
+            // a forked child has none of the threads, the ids would name the parent's.
+            if (getpid() != m_pid)
+            {
+                applied = false;
+                continue;
+            }
+#endif
+            if (worker->started)
+            {
+                applied = apply(*worker) && applied;
+            }
+        }
+        m_low_workers.store(low);
         lock.unlock();
+        // sleepers pick up their lane.
+        std::lock_guard<std::mutex> wake_lock(m_lock);
         m_data_condition.notify_all();
+        return applied;
     }
 
-    void infinite_loop_func()
+    // f(args...) on the pool, its result or exception comes back through the future.
+    template <typename T, typename... Args>
+    PoolFuture<result_of_task<T, Args...>> submit(T &&f, Args &&...args)
     {
-        std::function<void()> func;
-        while (true)
+        using R = result_of_task<T, Args...>;
+        using Fn = decltype(std::bind(std::forward<T>(f), std::forward<Args>(args)...));
+        auto result = std::make_shared<PoolResult<R>>();
+        push(PoolTask(Submitted<R, Fn>{result, std::bind(std::forward<T>(f), std::forward<Args>(args)...)}));
+        return PoolFuture<R>(this, std::move(result));
+    }
+
+    // every callable in [first, last) moved into a task, queued under one lock with one wakeup.
+    template <typename Iter>
+    void post_bulk(Iter first, Iter last)
+    {
+        size_t n = 0;
+        auto &cur = current();
+        if (cur.pool == this)
         {
+            for (; first != last; ++first, ++n)
             {
-                std::unique_lock<std::mutex> lock(m_lock);
-                m_data_condition.wait(lock, [this]()
-                                      { return !m_function_queue.empty() || m_terminated; });
-                if (m_terminated && m_function_queue.empty())
-                {
-                    // finish the thread loop and let it join in the main thread.
-                    return;
-                }
-                func = m_function_queue.front();
-                m_function_queue.pop();
+                push_local(*cur.worker, PoolTask(std::move(*first)));
+            }
+        }
+        else
+        {
+            std::lock_guard<std::mutex> lock(m_inject_lock);
+            for (; first != last; ++first, ++n)
+            {
+                m_injection.push(PoolTask(std::move(*first)));
             }
-            func();
         }
+        if (n != 0)
+        {
+            wake(n);
+        }
+    }
+
+    // body(first, last) over [begin, end) in pieces of grain, split only as far as idle
+    // workers ask for. the caller works on the range too and returns when all of it ran.
+    template <typename F>
+    void parallel_for(size_t begin, size_t end, size_t grain, F &&body)
+    {
+        if (begin >= end)
+        {
+            return;
+        }
+        using Fn = typename std::decay<F>::type;
+        auto loop = std::make_shared<ForLoop<Fn>>(Fn(std::forward<F>(body)), end - begin, grain == 0 ? 1 : grain);
+        run_range(loop, begin, end);
+        wait(*loop);
+        if (loop->error)
+        {
+            std::rethrow_exception(loop->error);
+        }
+    }
+
+    // relaxed sums, a task may be counted as queued and executed at once.
+    PoolStats stats() const
+    {
+        PoolStats st;
+        st.workers = m_workers.size();
+        for (auto &worker : m_workers)
+        {
+            st.executed += worker->executed.load(std::memory_order_relaxed);
+            st.stolen += worker->stolen.load(std::memory_order_relaxed);
+            st.parked += worker->parked.load(std::memory_order_relaxed);
+        }
+        st.queued = m_injection.queued.load(std::memory_order_relaxed);
+        st.queued_low = m_low.queued.load(std::memory_order_relaxed);
+        return st;
+    }
+
+    void done()
+    {
+        std::unique_lock<std::mutex> lock(m_lock);
+        m_terminated.store(true);
+        lock.unlock();
+        m_data_condition.notify_all();
     }
 };
 
-#endif
\ No newline at end of file
+template <typename T>
+void PoolFuture<T>::wait() const
+{
+    m_pool->wait(*m_result);
+}
+
+template <typename T>
+T PoolFuture<T>::get()
+{
+    m_pool->wait(*m_result);
+    auto result = std::move(m_result);
+    return result->take();
+}
+
+#endif
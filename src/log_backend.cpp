@@ -0,0 +1,1019 @@
+#include "log_backend.h"
+#include "rec_stats.h"
+#include "reclog_impl.h"
+#include <algorithm>
+
+// records made on the writer itself, the dropped-record markers, skip the rings.
+static thread_local bool writer_thread = false;
+
+namespace
+{
+    const RECLOG::Route *find_route(const RECLOG::RouteTable &table, RECLOG::DiskFileCluster *dest)
+    {
+        for (auto &route : table)
+        {
+            if (route.dest == dest)
+            {
+                return &route;
+            }
+        }
+        return nullptr;
+    }
+
+    RECLOG::RecordPart gather_part(const unsigned char *payload, size_t i)
+    {
+        RECLOG::RecordPart part;
+        memcpy(&part, payload + sizeof(RECLOG::RecordGather) + i * sizeof(part), sizeof(part));
+        return part;
+    }
+
+    const unsigned char *gather_inline(const unsigned char *payload, const RECLOG::RecordGather &gather)
+    {
+        return payload + sizeof(gather) + gather.count * sizeof(RECLOG::RecordPart);
+    }
+
+    // the record as one piece, for everything that is not a file write.
+    void flatten_gather(const unsigned char *payload, std::string &out)
+    {
+        RECLOG::RecordGather gather;
+        memcpy(&gather, payload, sizeof(gather));
+        auto data = reinterpret_cast<const char *>(gather_inline(payload, gather));
+        size_t done = 0;
+        for (size_t i = 0; i < gather.count; ++i)
+        {
+            auto part = gather_part(payload, i);
+            out.append(data + done, part.offset - done);
+            out.append(static_cast<const char *>(part.data), part.len);
+            done = part.offset;
+        }
+        out.append(data + done, gather.len - done);
+    }
+
+    void release_gather(const unsigned char *payload)
+    {
+        RECLOG::RecordGather gather;
+        memcpy(&gather, payload, sizeof(gather));
+        for (size_t i = 0; i < gather.count; ++i)
+        {
+            delete gather_part(payload, i).owner;
+        }
+    }
+
+    int site_verbosity(uint32_t id)
+    {
+        auto site = id == RECLOG::REC_NO_SITE ? nullptr : RECLOG::SiteRegistry::At(id);
+        return site == nullptr ? RECLOG::REC_LEVEL_INFO : site->verbosity;
+    }
+}
+
+RECLOG::LogBackend &RECLOG::LogBackend::Instance()
+{
+    static LogBackend backend;
+    return backend;
+}
+
+void RECLOG::LogBackend::Start(FunctionPool &pool)
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+    if (m_alive)
+    {
+        return;
+    }
+    m_alive = true;
+    m_running.store(true);
+    m_sync_ms = RECONFIG::g_option.fsync_ms;
+    m_sync_bytes = RECONFIG::g_option.fsync_bytes;
+    m_last_sync = get_date_time();
+    m_screen_policy = RECONFIG::g_option.overload;
+    m_last_report = m_last_sync;
+    m_last_calibrate = m_last_sync;
+    m_collapse = RECONFIG::g_option.collapse;
+    m_stats_ms = RECONFIG::g_option.stats_ms;
+    m_last_stats = m_last_sync;
+    lock.unlock();
+    pool.post([this]()
+              { Run(); });
+}
+
+void RECLOG::LogBackend::Stop()
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+    m_running.store(false);
+    m_wakeup.notify_all();
+    m_finish.wait(lock, [this]()
+                  { return !m_alive; });
+}
+
+void RECLOG::LogBackend::Flush()
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+    if (!m_alive)
+    {
+        return;
+    }
+    auto ticket = ++m_flush_req;
+    m_wakeup.notify_all();
+    m_finish.wait(lock, [this, ticket]()
+                  { return m_flush_done >= ticket || !m_alive; });
+}
+
+bool RECLOG::LogBackend::Flush(bool durable, int timeout_ms)
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+    if (!m_alive)
+    {
+        return true;
+    }
+    auto ticket = durable ? ++m_sync_req : ++m_flush_req;
+    m_wakeup.notify_all();
+    return m_finish.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this, durable, ticket]()
+                             { return (durable ? m_sync_done : m_flush_done) >= ticket || !m_alive; });
+}
+
+void RECLOG::DeliverRecord(CodeType type, DiskFileCluster *dest, const void *src, size_t len, uint8_t flags)
+{
+    if (flags & REC_FLAG_DEFERRED)
+    {
+        WriteDeferred(dest, src, len);
+    }
+    else
+    {
+        WriteRecord(type, dest, src, len);
+    }
+}
+
+void RECLOG::LogBackend::Submit(CodeType type, DiskFileCluster *dest, const void *src, size_t len, uint8_t flags,
+                                 uint32_t site, uint16_t stamp)
+{
+    StatRegistry::Count(StatId::RECORDS);
+    StatRegistry::Count(StatId::BYTES, len);
+    if (!Enqueue(type, dest, src, len, flags, site, stamp, nullptr))
+    {
+        Dispatch(type, dest, src, len, flags, site);
+    }
+}
+
+void RECLOG::LogBackend::Submit(CodeType type, DiskFileCluster *dest, const void *src, size_t len,
+                                const std::vector<BlobRef> &blobs, uint32_t site)
+{
+    auto size = sizeof(RecordHead) + sizeof(RecordGather) + blobs.size() * sizeof(RecordPart) + len;
+    if (!blobs.empty() && size <= REC_RING_SIZE / 4 && Enqueue(type, dest, src, len, 0, site, 0, &blobs))
+    {
+        StatRegistry::Count(StatId::RECORDS);
+        StatRegistry::Count(StatId::BYTES, len);
+        return;
+    }
+    // written right here or too large to refer to, one copy it is.
+    std::string flat;
+    size_t done = 0;
+    for (auto &ref : blobs)
+    {
+        flat.append(static_cast<const char *>(src) + done, ref.offset - done);
+        flat.append(static_cast<const char *>(ref.blob.data), ref.blob.len);
+        done = ref.offset;
+    }
+    flat.append(static_cast<const char *>(src) + done, len - done);
+    Submit(type, dest, flat.data(), flat.size(), 0, site);
+}
+
+bool RECLOG::LogBackend::Enqueue(CodeType type, DiskFileCluster *dest, const void *src, size_t len, uint8_t flags,
+                                 uint32_t site, uint16_t stamp, const std::vector<BlobRef> *blobs)
+{
+    if (!m_running.load(std::memory_order_relaxed) || writer_thread)
+    {
+        return false;
+    }
+    auto start = Clock::Ticks();
+    auto q = LocalQueue();
+    // pairs with the check in Run, either we see the writer stopping or it waits for us.
+    q->busy.store(true);
+    bool queued = m_running.load();
+    if (queued)
+    {
+        Push(*q, type, dest, src, len, flags, site, stamp, blobs);
+    }
+    q->busy.store(false, std::memory_order_release);
+    if (queued)
+    {
+        StatRegistry::Latency(LatencyId::ENQUEUE, start);
+    }
+    return queued;
+}
+
+RECLOG::Route &RECLOG::LogBackend::EditRoute(RouteTable &table, DiskFileCluster *dest)
+{
+    for (auto &route : table)
+    {
+        if (route.dest == dest)
+        {
+            return route;
+        }
+    }
+    std::shared_ptr<LogSink> primary;
+    if (dest == nullptr)
+    {
+        primary = std::make_shared<ScreenSink>();
+    }
+    else
+    {
+        primary = std::make_shared<ClusterSink>(dest);
+    }
+    Route route;
+    route.dest = dest;
+    route.primary = primary.get();
+    route.sinks.push_back(std::move(primary));
+    table.push_back(std::move(route));
+    return table.back();
+}
+
+void RECLOG::LogBackend::AddSink(DiskFileCluster *dest, std::shared_ptr<LogSink> sink)
+{
+    std::lock_guard<std::mutex> lock(m_rlock);
+    auto table = std::make_shared<RouteTable>(*m_routes);
+    EditRoute(*table, dest).sinks.push_back(std::move(sink));
+    m_routes = std::move(table);
+    ++m_rversion;
+}
+
+void RECLOG::LogBackend::RemoveSink(DiskFileCluster *dest, const std::shared_ptr<LogSink> &sink)
+{
+    std::lock_guard<std::mutex> lock(m_rlock);
+    auto table = std::make_shared<RouteTable>(*m_routes);
+    auto &sinks = EditRoute(*table, dest).sinks;
+    sinks.erase(std::remove(sinks.begin(), sinks.end(), sink), sinks.end());
+    m_routes = std::move(table);
+    ++m_rversion;
+}
+
+std::vector<std::shared_ptr<RECLOG::LogSink>> RECLOG::LogBackend::Sinks(DiskFileCluster *dest)
+{
+    std::lock_guard<std::mutex> lock(m_rlock);
+    auto route = find_route(*m_routes, dest);
+    if (route != nullptr)
+    {
+        return route->sinks;
+    }
+    // the primary has to outlive this call for its level to mean anything.
+    auto table = std::make_shared<RouteTable>(*m_routes);
+    auto sinks = EditRoute(*table, dest).sinks;
+    m_routes = std::move(table);
+    ++m_rversion;
+    return sinks;
+}
+
+void RECLOG::LogBackend::RefreshRoutes()
+{
+    auto version = m_rversion.load(std::memory_order_acquire);
+    if (version == m_route_version)
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_rlock);
+    m_route_snapshot = m_routes;
+    m_route_version = m_rversion.load(std::memory_order_relaxed);
+}
+
+void RECLOG::LogBackend::Dispatch(CodeType type, DiskFileCluster *dest, const void *src, size_t len, uint8_t flags,
+                                  uint32_t site)
+{
+    std::shared_ptr<const RouteTable> table;
+    if (writer_thread)
+    {
+        table = m_route_snapshot;
+    }
+    else
+    {
+        std::lock_guard<std::mutex> lock(m_rlock);
+        table = m_routes;
+    }
+    auto route = find_route(*table, dest);
+    if (route == nullptr)
+    {
+        DeliverRecord(type, dest, src, len, flags);
+    }
+    else
+    {
+        Fanout(*route, type, src, len, flags, site);
+    }
+    if (!writer_thread)
+    {
+        // no writer flushes the screen buffer behind us.
+        RECONFIG::GetCurLogFp()->Flush();
+    }
+}
+
+void RECLOG::LogBackend::Fanout(const Route &route, CodeType type, const void *src, size_t len, uint8_t flags,
+                                uint32_t site)
+{
+    auto verbosity = site_verbosity(site);
+    // every sink gets the bytes the statement encoded, a deferred record is rendered once for all that want text.
+    std::string text;
+    bool rendered = false;
+    for (auto &sink : route.sinks)
+    {
+        if (!sink->Accepts(verbosity))
+        {
+            continue;
+        }
+        if (!(flags & REC_FLAG_DEFERRED))
+        {
+            sink->Write(type, src, len);
+        }
+        else if (!sink->WriteDeferred(src, len))
+        {
+            if (!rendered)
+            {
+                rendered = RenderDeferred(static_cast<const unsigned char *>(src), len, text);
+                if (!rendered)
+                {
+                    continue;
+                }
+            }
+            sink->Write(CodeType::LOG, text.data(), text.size());
+        }
+    }
+    if (writer_thread)
+    {
+        m_sinks_dirty = true;
+        m_sinks_unsynced = true;
+    }
+}
+
+RECLOG::LogBackend::ThreadQueue *RECLOG::LogBackend::LocalQueue()
+{
+    struct QueueHolder
+    {
+        ThreadQueue *queue = nullptr;
+        ~QueueHolder()
+        {
+            if (queue != nullptr)
+            {
+                queue->orphaned.store(true, std::memory_order_release);
+            }
+        }
+    };
+    static thread_local QueueHolder holder;
+    if (holder.queue == nullptr)
+    {
+        std::unique_ptr<ThreadQueue> q(new ThreadQueue(REC_RING_SIZE));
+        holder.queue = q.get();
+        std::lock_guard<std::mutex> lock(m_qlock);
+        m_queues.push_back(std::move(q));
+        ++m_qversion;
+    }
+    return holder.queue;
+}
+
+void RECLOG::LogBackend::Push(ThreadQueue &q, CodeType type, DiskFileCluster *dest, const void *src, size_t len, uint8_t flags,
+                              uint32_t site, uint16_t stamp, const std::vector<BlobRef> *blobs)
+{
+    auto &policy = dest != nullptr ? dest->Overload() : m_screen_policy;
+    if (policy.mode == RECOVERLOAD::SAMPLE && policy.sample_rate > 1 && q.ring.Crowded())
+    {
+        // xorshift, cheap and good enough to spread the kept records.
+        q.seed ^= q.seed << 13;
+        q.seed ^= q.seed >> 17;
+        q.seed ^= q.seed << 5;
+        if (q.seed % policy.sample_rate != 0)
+        {
+            CountDropped(dest, 1);
+            return;
+        }
+    }
+    size_t parts = blobs != nullptr ? sizeof(RecordGather) + blobs->size() * sizeof(RecordPart) : 0;
+    bool block = blobs == nullptr && sizeof(RecordHead) + len > q.ring.Capacity() / 4;
+    size_t size = sizeof(RecordHead) + (block ? sizeof(RecordBlock) : parts + len);
+    unsigned char *ptr = q.ring.Reserve(size);
+    if (ptr == nullptr && (ptr = MakeRoom(q, policy, size)) == nullptr)
+    {
+        CountDropped(dest, 1);
+        return;
+    }
+    RecordHead head;
+    head.size = static_cast<uint32_t>(size);
+    head.type = static_cast<uint8_t>(type);
+    head.flags = flags | (block ? REC_FLAG_BLOCK : 0) | (blobs != nullptr ? REC_FLAG_GATHER : 0);
+    head.stamp = stamp;
+    head.site = site;
+    head.dest = dest;
+    memcpy(ptr, &head, sizeof(head));
+    if (block)
+    {
+        RecordBlock blk;
+        blk.data = new unsigned char[len];
+        blk.len = len;
+        memcpy(blk.data, src, len);
+        memcpy(ptr + sizeof(head), &blk, sizeof(blk));
+    }
+    else if (blobs != nullptr)
+    {
+        auto dst = ptr + sizeof(head);
+        RecordGather gather = {static_cast<uint32_t>(blobs->size()), static_cast<uint32_t>(len)};
+        memcpy(dst, &gather, sizeof(gather));
+        dst += sizeof(gather);
+        for (auto &ref : *blobs)
+        {
+            RecordPart part = {ref.offset, ref.blob.data, ref.blob.len, new std::shared_ptr<const void>(ref.blob.owner)};
+            memcpy(dst, &part, sizeof(part));
+            dst += sizeof(part);
+        }
+        memcpy(dst, src, len);
+    }
+    else
+    {
+        memcpy(ptr + sizeof(head), src, len);
+    }
+    q.ring.Commit();
+}
+
+unsigned char *RECLOG::LogBackend::MakeRoom(ThreadQueue &q, const OverloadPolicy &policy, size_t size)
+{
+    unsigned char *ptr = nullptr;
+    switch (policy.mode)
+    {
+    case RECOVERLOAD::BLOCK:
+    {
+        // the writer keeps draining until we leave, so waiting here always ends.
+        auto deadline = policy.timeout_ms == 0 ? 0 : get_date_time() + policy.timeout_ms;
+        do
+        {
+            m_wakeup.notify_one();
+            std::this_thread::yield();
+            ptr = q.ring.Reserve(size);
+        } while (ptr == nullptr && (deadline == 0 || get_date_time() < deadline));
+        break;
+    }
+    case RECOVERLOAD::DROP_OLDEST:
+        while (ptr == nullptr && DropOldest(q))
+        {
+            ptr = q.ring.Reserve(size);
+        }
+        break;
+    default:
+        break;
+    }
+    if (ptr == nullptr)
+    {
+        m_wakeup.notify_one();
+    }
+    return ptr;
+}
+
+bool RECLOG::LogBackend::DropOldest(ThreadQueue &q)
+{
+    size_t start = 0;
+    size_t end = 0;
+    auto ptr = q.ring.ClaimOldest(start, end);
+    if (ptr == nullptr)
+    {
+        // empty, or the writer still holds older records and only the new one is lost.
+        return false;
+    }
+    RecordHead head;
+    memcpy(&head, ptr, sizeof(head));
+    if (head.flags & REC_FLAG_BLOCK)
+    {
+        RecordBlock blk;
+        memcpy(&blk, ptr + sizeof(head), sizeof(blk));
+        delete[] blk.data;
+    }
+    else if (head.flags & REC_FLAG_GATHER)
+    {
+        release_gather(ptr + sizeof(head));
+    }
+    CountDropped(head.dest, 1);
+    return q.ring.ReleaseOldest(start, end);
+}
+
+void RECLOG::LogBackend::CountDropped(DiskFileCluster *dest, size_t n)
+{
+    if (dest != nullptr)
+    {
+        dest->IncreaseDropped(n);
+    }
+    else
+    {
+        m_screen_dropped.fetch_add(n, std::memory_order_relaxed);
+    }
+}
+
+void RECLOG::LogBackend::ReportDropped()
+{
+    m_last_report = get_date_time();
+    auto screen = ScreenDropped();
+    if (screen != m_reported.screen)
+    {
+        Codec_STR(nullptr, REC_SITE(-1, CodeType::LOG)) << screen - m_reported.screen << " records dropped";
+        m_reported.screen = screen;
+        MarkDirty(nullptr, 0);
+    }
+    auto log = RECONFIG::g_flist_log.Dropped();
+    if (log != m_reported.log)
+    {
+        Codec_STR(&RECONFIG::g_flist_log, REC_SITE(-1, CodeType::LOG)) << log - m_reported.log << " records dropped";
+        m_reported.log = log;
+        MarkDirty(&RECONFIG::g_flist_log, 0);
+    }
+    auto cbor = RECONFIG::g_flist_cbor.Dropped();
+    if (cbor != m_reported.cbor)
+    {
+        Codec_CBO(&RECONFIG::g_flist_cbor) << "REC_DROPPED" << cbor - m_reported.cbor;
+        m_reported.cbor = cbor;
+        MarkDirty(&RECONFIG::g_flist_cbor, 0);
+    }
+    // raw files have no framing to mark a gap with, RECONFIG::Dropped still counts them.
+}
+
+void RECLOG::LogBackend::ReportStats()
+{
+    m_last_stats = get_date_time();
+    // the log file once there is one, the screen until then.
+    auto dest = RECONFIG::g_flist_log.FileNo() != 0 ? &RECONFIG::g_flist_log : nullptr;
+    auto st = RECONFIG::Stats();
+    auto ns = [](double v)
+    { return static_cast<uint64_t>(v); };
+    Codec_STR(dest, REC_SITE(-1, CodeType::LOG))
+        << "stats records " << st.records << " bytes " << st.bytes << " written " << st.written << " dropped "
+        << st.dropped << " queued " << st.queued << "/" << st.queued_peak << " rotations " << st.rotations
+        << " syncs " << st.syncs << " compressions " << st.compressions << " enqueue p99 " << ns(st.enqueue.p99)
+        << "ns write p99 " << ns(st.write.p99) << "ns max " << ns(st.write.max) << "ns sync max "
+        << ns(st.sync.max) << "ns";
+    MarkDirty(dest, 0);
+}
+
+bool RECLOG::LogBackend::Collapse(ThreadQueue &q, const RecordHead &head, const unsigned char *payload)
+{
+    if (!m_collapse || (m_repeats.empty() && !(head.flags & REC_FLAG_COLLAPSE)))
+    {
+        return false;
+    }
+    auto rep = std::find_if(m_repeats.begin(), m_repeats.end(), [&head](const Repeat &r)
+                            { return r.dest == head.dest; });
+    if (!(head.flags & REC_FLAG_COLLAPSE))
+    {
+        if (rep != m_repeats.end())
+        {
+            if (rep->count != 0)
+            {
+                WriteBatch();
+                q.ring.Release(true);
+                ReportRepeat(*rep);
+            }
+            rep->armed = false;
+        }
+        return false;
+    }
+    auto data = payload;
+    size_t len = head.size - sizeof(head);
+    RecordBlock blk = {nullptr, 0};
+    if (head.flags & REC_FLAG_BLOCK)
+    {
+        memcpy(&blk, payload, sizeof(blk));
+        data = blk.data;
+        len = blk.len;
+    }
+    if (head.stamp > len)
+    {
+        return false;
+    }
+    auto text = reinterpret_cast<const char *>(data) + head.stamp;
+    len -= head.stamp;
+    if (rep == m_repeats.end())
+    {
+        m_repeats.emplace_back();
+        rep = m_repeats.end() - 1;
+        rep->dest = head.dest;
+    }
+    else if (rep->armed && rep->site == head.site && rep->text.size() == len && memcmp(rep->text.data(), text, len) == 0)
+    {
+        ++rep->count;
+        delete[] blk.data;
+        return true;
+    }
+    else if (rep->count != 0)
+    {
+        WriteBatch();
+        q.ring.Release(true);
+        ReportRepeat(*rep);
+    }
+    rep->armed = true;
+    rep->site = head.site;
+    rep->text.assign(text, len);
+    return false;
+}
+
+void RECLOG::LogBackend::ReportRepeat(Repeat &rep)
+{
+    Codec_STR(rep.dest, REC_SITE(0, CodeType::LOG)) << "previous record repeated " << rep.count << " times";
+    MarkDirty(rep.dest, 0);
+    rep.count = 0;
+}
+
+void RECLOG::LogBackend::ReportRepeats()
+{
+    for (auto &rep : m_repeats)
+    {
+        if (rep.count != 0)
+        {
+            ReportRepeat(rep);
+        }
+    }
+}
+
+void RECLOG::LogBackend::Run()
+{
+    writer_thread = true;
+    while (true)
+    {
+        bool stopping = !m_running.load();
+        uint64_t flush_req = 0;
+        uint64_t sync_req = 0;
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            flush_req = m_flush_req;
+            sync_req = m_sync_req;
+        }
+        auto drained = DrainAll();
+        if (stopping)
+        {
+            bool quiet = true;
+            for (auto q : m_snapshot)
+            {
+                quiet = quiet && !q->busy.load();
+            }
+            if (quiet)
+            {
+                DrainAll();
+                ReportRepeats();
+                ReportDropped();
+                FlushFiles();
+                if (m_sync_ms != 0 || m_sync_bytes != 0 || sync_req != m_sync_done)
+                {
+                    SyncFiles();
+                }
+                std::lock_guard<std::mutex> lock(m_lock);
+                m_alive = false;
+                m_flush_done = m_flush_req;
+                m_sync_done = m_sync_req;
+                m_finish.notify_all();
+                return;
+            }
+            continue;
+        }
+        if (get_date_time() - m_last_report >= REC_DROP_REPORT_MS)
+        {
+            ReportRepeats();
+            ReportDropped();
+        }
+        if (m_stats_ms != 0 && get_date_time() - m_last_stats >= m_stats_ms)
+        {
+            ReportStats();
+        }
+        if (get_date_time() - m_last_calibrate >= REC_CALIBRATE_MS)
+        {
+            Clock::Calibrate();
+            m_last_calibrate = get_date_time();
+        }
+        if (drained == 0 || flush_req != m_flush_done || sync_req != m_sync_done)
+        {
+            FlushFiles();
+        }
+        if (sync_req != m_sync_done || SyncDue())
+        {
+            // group commit, one sync covers every producer since the last one.
+            SyncFiles();
+        }
+        std::unique_lock<std::mutex> lock(m_lock);
+        if (flush_req != m_flush_done || sync_req != m_sync_done)
+        {
+            m_flush_done = flush_req;
+            m_sync_done = sync_req;
+            m_finish.notify_all();
+        }
+        if (drained == 0 && m_flush_req == m_flush_done && m_sync_req == m_sync_done && m_running.load())
+        {
+            m_wakeup.wait_for(lock, std::chrono::milliseconds(REC_WRITER_IDLE_MS));
+        }
+    }
+}
+
+size_t RECLOG::LogBackend::DrainAll()
+{
+    Refresh();
+    RefreshRoutes();
+    size_t records = 0;
+    size_t queued = 0;
+    bool orphans = false;
+    for (auto q : m_snapshot)
+    {
+        queued += q->ring.Used();
+    }
+    StatRegistry::Queued(queued);
+    for (auto q : m_snapshot)
+    {
+        records += Drain(*q);
+        orphans = orphans || q->orphaned.load(std::memory_order_acquire);
+    }
+    if (orphans)
+    {
+        // threads gone and nothing left to write, release their rings.
+        {
+            std::lock_guard<std::mutex> lock(m_qlock);
+            auto iter = std::remove_if(m_queues.begin(), m_queues.end(),
+                                       [](const std::unique_ptr<ThreadQueue> &q)
+                                       { return q->orphaned.load(std::memory_order_acquire) && q->ring.Empty(); });
+            if (iter != m_queues.end())
+            {
+                m_queues.erase(iter, m_queues.end());
+                ++m_qversion;
+            }
+        }
+        Refresh();
+    }
+    return records;
+}
+
+size_t RECLOG::LogBackend::Drain(ThreadQueue &q)
+{
+    // bounded so one busy producer cannot starve the others.
+    size_t records = 0;
+    size_t bytes = 0;
+    const unsigned char *ptr = nullptr;
+    while (bytes < q.ring.Capacity() && (ptr = q.ring.Claim()) != nullptr)
+    {
+        RecordHead head;
+        memcpy(&head, ptr, sizeof(head));
+        auto payload = ptr + sizeof(head);
+        if (Collapse(q, head, payload))
+        {
+            bytes += head.size;
+            ++records;
+            continue;
+        }
+        auto route = find_route(*m_route_snapshot, head.dest);
+        if (route != nullptr && route->Plain() && !route->primary->Accepts(site_verbosity(head.site)))
+        {
+            Discard(head, payload);
+        }
+        else if (route != nullptr && !route->Plain())
+        {
+            WriteBatch();
+            q.ring.Release(true);
+            Consume(head, payload, route);
+        }
+        else if (head.dest != nullptr && !(head.flags & REC_FLAG_DEFERRED) && SpansOf(head, payload) <= REC_MAX_IOV &&
+                 !((head.flags & REC_FLAG_GATHER) && head.dest->Transported()))
+        {
+            if (m_batch.count + SpansOf(head, payload) > REC_MAX_IOV || m_batch.bytes >= REC_BATCH_BYTES ||
+                (m_batch.count != 0 && m_batch.dest != head.dest))
+            {
+                WriteBatch();
+                q.ring.Release(true);
+            }
+            m_batch.dest = head.dest;
+            if (head.flags & REC_FLAG_GATHER)
+            {
+                BatchGather(payload);
+            }
+            else
+            {
+                // the payload stays in the ring until the batch is written.
+                IoSpan span = {payload, head.size - sizeof(head)};
+                if (head.flags & REC_FLAG_BLOCK)
+                {
+                    RecordBlock blk;
+                    memcpy(&blk, payload, sizeof(blk));
+                    span.data = blk.data;
+                    span.len = blk.len;
+                    m_batch.blocks.push_back(blk.data);
+                }
+                m_batch.spans[m_batch.count++] = span;
+                m_batch.bytes += span.len;
+            }
+        }
+        else
+        {
+            // a transport makes one entry of every span, a gathered record reaches it flattened.
+            WriteBatch();
+            q.ring.Release(true);
+            Consume(head, payload, nullptr);
+        }
+        bytes += head.size;
+        ++records;
+    }
+    WriteBatch();
+    q.ring.Release();
+    return records;
+}
+
+void RECLOG::LogBackend::Consume(const RecordHead &head, const unsigned char *payload, const Route *route)
+{
+    auto type = static_cast<CodeType>(head.type);
+    uint8_t flags = head.flags & ~(REC_FLAG_BLOCK | REC_FLAG_COLLAPSE | REC_FLAG_GATHER);
+    const unsigned char *data = payload;
+    size_t len = head.size - sizeof(head);
+    RecordBlock blk = {nullptr, 0};
+    std::string flat;
+    if (head.flags & REC_FLAG_BLOCK)
+    {
+        memcpy(&blk, payload, sizeof(blk));
+        data = blk.data;
+        len = blk.len;
+    }
+    else if (head.flags & REC_FLAG_GATHER)
+    {
+        // screen and sinks take one piece, they get a copy.
+        flatten_gather(payload, flat);
+        release_gather(payload);
+        data = reinterpret_cast<const unsigned char *>(flat.data());
+        len = flat.size();
+    }
+    if (route != nullptr)
+    {
+        Fanout(*route, type, data, len, flags, head.site);
+        m_unsynced_bytes += len;
+    }
+    else
+    {
+        DeliverRecord(type, head.dest, data, len, flags);
+        MarkDirty(head.dest, len);
+    }
+    delete[] blk.data;
+}
+
+void RECLOG::LogBackend::Discard(const RecordHead &head, const unsigned char *payload)
+{
+    if (head.flags & REC_FLAG_BLOCK)
+    {
+        RecordBlock blk;
+        memcpy(&blk, payload, sizeof(blk));
+        delete[] blk.data;
+    }
+    else if (head.flags & REC_FLAG_GATHER)
+    {
+        release_gather(payload);
+    }
+}
+
+size_t RECLOG::LogBackend::SpansOf(const RecordHead &head, const unsigned char *payload)
+{
+    if (!(head.flags & REC_FLAG_GATHER))
+    {
+        return 1;
+    }
+    RecordGather gather;
+    memcpy(&gather, payload, sizeof(gather));
+    return 2 * gather.count + 1;
+}
+
+void RECLOG::LogBackend::BatchGather(const unsigned char *payload)
+{
+    RecordGather gather;
+    memcpy(&gather, payload, sizeof(gather));
+    auto data = gather_inline(payload, gather);
+    size_t done = 0;
+    auto add = [this](const void *src, size_t len)
+    {
+        if (len != 0)
+        {
+            m_batch.spans[m_batch.count++] = IoSpan{src, len};
+            m_batch.bytes += len;
+        }
+    };
+    for (size_t i = 0; i < gather.count; ++i)
+    {
+        auto part = gather_part(payload, i);
+        add(data + done, part.offset - done);
+        add(part.data, part.len);
+        m_batch.owners.push_back(part.owner);
+        done = part.offset;
+    }
+    add(data + done, gather.len - done);
+}
+
+void RECLOG::LogBackend::WriteBatch()
+{
+    if (m_batch.count == 0)
+    {
+        return;
+    }
+    auto handle = m_batch.dest->GetCurFileFp();
+    auto start = Clock::Ticks();
+    auto bytes = WriteSchemas(m_batch.dest, handle);
+    bytes += handle->WriteBatch(m_batch.spans, m_batch.count);
+    StatRegistry::Latency(LatencyId::WRITE, start);
+    StatRegistry::Count(StatId::WRITTEN, bytes);
+    m_batch.dest->IncraeseBytes(bytes);
+    MarkDirty(m_batch.dest, bytes);
+    for (auto blk : m_batch.blocks)
+    {
+        delete[] blk;
+    }
+    m_batch.blocks.clear();
+    // the blobs are written, their owners may let go.
+    for (auto owner : m_batch.owners)
+    {
+        delete owner;
+    }
+    m_batch.owners.clear();
+    m_batch.count = 0;
+    m_batch.bytes = 0;
+}
+
+void RECLOG::LogBackend::MarkDirty(DiskFileCluster *dest, size_t bytes)
+{
+    if (std::find(m_dirty.begin(), m_dirty.end(), dest) == m_dirty.end())
+    {
+        m_dirty.push_back(dest);
+    }
+    if (std::find(m_unsynced.begin(), m_unsynced.end(), dest) == m_unsynced.end())
+    {
+        m_unsynced.push_back(dest);
+    }
+    m_unsynced_bytes += bytes;
+}
+
+void RECLOG::LogBackend::FlushFiles()
+{
+    for (auto dest : m_dirty)
+    {
+        if (dest == nullptr)
+        {
+            RECONFIG::GetCurLogFp()->Flush();
+        }
+        else
+        {
+            dest->Flush();
+        }
+    }
+    m_dirty.clear();
+    if (m_sinks_dirty)
+    {
+        for (auto &route : *m_route_snapshot)
+        {
+            for (auto &sink : route.sinks)
+            {
+                sink->Flush();
+            }
+        }
+        m_sinks_dirty = false;
+    }
+}
+
+bool RECLOG::LogBackend::SyncDue() const
+{
+    if (m_unsynced_bytes == 0)
+    {
+        return false;
+    }
+    return (m_sync_bytes != 0 && m_unsynced_bytes >= m_sync_bytes) ||
+           (m_sync_ms != 0 && get_date_time() - m_last_sync >= m_sync_ms);
+}
+
+void RECLOG::LogBackend::SyncFiles()
+{
+    for (auto dest : m_unsynced)
+    {
+        if (dest == nullptr)
+        {
+            RECONFIG::GetCurLogFp()->Flush();
+        }
+        else
+        {
+            auto start = Clock::Ticks();
+            dest->Sync();
+            StatRegistry::Latency(LatencyId::SYNC, start);
+            StatRegistry::Count(StatId::SYNCS);
+        }
+    }
+    m_unsynced.clear();
+    if (m_sinks_unsynced)
+    {
+        for (auto &route : *m_route_snapshot)
+        {
+            for (auto &sink : route.sinks)
+            {
+                sink->Sync();
+            }
+        }
+        m_sinks_unsynced = false;
+    }
+    m_unsynced_bytes = 0;
+    m_last_sync = get_date_time();
+}
+
+void RECLOG::LogBackend::Refresh()
+{
+    auto version = m_qversion.load(std::memory_order_acquire);
+    if (version == m_version)
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_qlock);
+    m_snapshot.clear();
+    for (auto &q : m_queues)
+    {
+        m_snapshot.push_back(q.get());
+    }
+    m_version = m_qversion.load(std::memory_order_relaxed);
+}
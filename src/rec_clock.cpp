@@ -0,0 +1,134 @@
+#include "rec_clock.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <mutex>
+
+namespace
+{
+    // a steady interval long enough to measure the tick rate at startup.
+    constexpr long long REC_CLOCK_SPIN_NS = 1000000;
+
+    // seqlock, odd while Calibrate rewrites the fields.
+    std::atomic<uint32_t> clock_seq{0};
+    std::atomic<uint64_t> clock_base{0};
+    std::atomic<long long> clock_wall{0};
+    std::atomic<uint64_t> clock_rate{0};
+
+    std::mutex clock_lock;
+    std::once_flag clock_once;
+    // first tick and steady pair, later calibrations measure the rate against it.
+    uint64_t anchor_ticks = 0;
+    long long anchor_steady = 0;
+
+    long long steady_nanos()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    long long system_nanos()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::system_clock::now().time_since_epoch())
+            .count();
+    }
+
+    uint64_t double_bits(double v)
+    {
+        uint64_t bits;
+        memcpy(&bits, &v, sizeof(bits));
+        return bits;
+    }
+
+    double bits_double(uint64_t bits)
+    {
+        double v;
+        memcpy(&v, &bits, sizeof(v));
+        return v;
+    }
+
+    void publish(const RECLOG::ClockCalibration &cal)
+    {
+        auto seq = clock_seq.load(std::memory_order_relaxed);
+        clock_seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        clock_base.store(cal.base, std::memory_order_relaxed);
+        clock_wall.store(cal.wall, std::memory_order_relaxed);
+        clock_rate.store(double_bits(cal.ns_per_tick), std::memory_order_relaxed);
+        clock_seq.store(seq + 2, std::memory_order_release);
+    }
+}
+
+RECLOG::ClockCalibration RECLOG::Clock::Current()
+{
+    if (clock_seq.load(std::memory_order_acquire) == 0)
+    {
+        std::call_once(clock_once, Calibrate);
+    }
+    ClockCalibration cal;
+    uint32_t before, after;
+    do
+    {
+        before = clock_seq.load(std::memory_order_acquire);
+        cal.base = clock_base.load(std::memory_order_relaxed);
+        cal.wall = clock_wall.load(std::memory_order_relaxed);
+        cal.ns_per_tick = bits_double(clock_rate.load(std::memory_order_relaxed));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        after = clock_seq.load(std::memory_order_relaxed);
+    } while ((before & 1) != 0 || before != after);
+    return cal;
+}
+
+bool RECLOG::Clock::TryCurrent(ClockCalibration &cal)
+{
+    auto before = clock_seq.load(std::memory_order_acquire);
+    cal.base = clock_base.load(std::memory_order_relaxed);
+    cal.wall = clock_wall.load(std::memory_order_relaxed);
+    cal.ns_per_tick = bits_double(clock_rate.load(std::memory_order_relaxed));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    auto after = clock_seq.load(std::memory_order_relaxed);
+    return before != 0 && (before & 1) == 0 && before == after;
+}
+
+uint32_t RECLOG::Clock::Generation()
+{
+    return clock_seq.load(std::memory_order_acquire) / 2;
+}
+
+void RECLOG::Clock::Calibrate()
+{
+    std::lock_guard<std::mutex> lock(clock_lock);
+    ClockCalibration cal;
+#ifdef RECLOG_USE_TSC
+    if (anchor_steady == 0)
+    {
+        anchor_ticks = Ticks();
+        anchor_steady = steady_nanos();
+        while (steady_nanos() - anchor_steady < REC_CLOCK_SPIN_NS)
+        {
+        }
+    }
+    auto ticks = Ticks();
+    auto steady = steady_nanos();
+    auto elapsed = ticks - anchor_ticks;
+    cal.ns_per_tick = elapsed == 0 ? 1.0 : static_cast<double>(steady - anchor_steady) / static_cast<double>(elapsed);
+#else
+    auto ticks = Ticks();
+    cal.ns_per_tick = 1.0;
+#endif
+    cal.base = ticks;
+    cal.wall = system_nanos();
+    if (clock_seq.load(std::memory_order_relaxed) != 0)
+    {
+        // rebased where the old mapping puts ticks, or later. converted times never run
+        // backwards, steps of the wall clock are followed forwards only.
+        ClockCalibration last;
+        last.base = clock_base.load(std::memory_order_relaxed);
+        last.wall = clock_wall.load(std::memory_order_relaxed);
+        last.ns_per_tick = bits_double(clock_rate.load(std::memory_order_relaxed));
+        cal.wall = std::max(cal.wall, ToNanos(ticks, last));
+    }
+    publish(cal);
+}
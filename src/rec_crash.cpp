@@ -0,0 +1,394 @@
+#include "rec_crash.h"
+#include "reclog.h"
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+
+#if __GNUC__
+#include <fcntl.h>  // for open
+#include <unistd.h> // for write
+#endif
+
+namespace
+{
+    struct CrashSlot
+    {
+        // 2n + 1 while record n is copied in, 2n + 2 once it is complete.
+        std::atomic<uint64_t> seq;
+        // orders the records of all threads in a dump.
+        std::atomic<uint64_t> ticks;
+        const RECLOG::LogSite *site;
+        uint32_t len;
+        bool deferred;
+        char data[RECLOG::REC_CRASH_BYTES];
+    };
+}
+
+namespace RECLOG
+{
+    // one writer, the thread that claimed it, the handler only reads.
+    struct CrashLane
+    {
+        std::atomic<uint64_t> next{0};
+        std::atomic_bool free{false};
+        CrashSlot slots[REC_CRASH_SLOTS];
+    };
+}
+
+namespace
+{
+    std::atomic<RECLOG::CrashLane *> crash_lanes[RECLOG::REC_CRASH_THREADS];
+    int crash_fd = -1;
+    char crash_path[256];
+
+    // gives the ring back when its thread exits, the records stay for the dump.
+    struct LaneOwner
+    {
+        RECLOG::CrashLane *lane = nullptr;
+        ~LaneOwner()
+        {
+            if (lane != nullptr)
+            {
+                RECLOG::ThisThread().crash = nullptr;
+                lane->free.store(true, std::memory_order_release);
+            }
+        }
+    };
+
+    RECLOG::CrashLane *own(RECLOG::CrashLane *lane)
+    {
+        static thread_local LaneOwner owner;
+        owner.lane = lane;
+        return lane;
+    }
+
+    // a new ring while there is room, the records of exited threads stay longest that way.
+    // once every place is taken a ring given back by an exited thread.
+    RECLOG::CrashLane *claim_lane()
+    {
+        for (auto &place : crash_lanes)
+        {
+            if (place.load(std::memory_order_acquire) == nullptr)
+            {
+                // never freed, the handler may read it at any time.
+                std::unique_ptr<RECLOG::CrashLane> fresh(new RECLOG::CrashLane());
+                RECLOG::CrashLane *empty = nullptr;
+                if (place.compare_exchange_strong(empty, fresh.get(), std::memory_order_release))
+                {
+                    return own(fresh.release());
+                }
+            }
+        }
+        for (auto &place : crash_lanes)
+        {
+            auto lane = place.load(std::memory_order_acquire);
+            bool idle = true;
+            if (lane->free.compare_exchange_strong(idle, false, std::memory_order_acquire))
+            {
+                return own(lane);
+            }
+        }
+        return nullptr;
+    }
+
+#if __GNUC__
+    // formats into a fixed buffer, nothing here may allocate or take a lock.
+    class CrashWriter
+    {
+    public:
+        explicit CrashWriter(int fd) : m_fd(fd), m_pos(0) {}
+        ~CrashWriter()
+        {
+            Flush();
+        }
+
+        CrashWriter &Put(char c)
+        {
+            if (m_pos == sizeof(m_buf))
+            {
+                Flush();
+            }
+            m_buf[m_pos++] = c;
+            return *this;
+        }
+
+        CrashWriter &Put(const char *str)
+        {
+            for (; *str; ++str)
+            {
+                Put(*str);
+            }
+            return *this;
+        }
+
+        CrashWriter &Dec(uint64_t v)
+        {
+            char digits[24];
+            int n = 0;
+            do
+            {
+                digits[n++] = static_cast<char>('0' + v % 10);
+                v /= 10;
+            } while (v != 0);
+            while (n > 0)
+            {
+                Put(digits[--n]);
+            }
+            return *this;
+        }
+
+        CrashWriter &Int(int64_t v)
+        {
+            if (v < 0)
+            {
+                Put('-');
+            }
+            return Dec(v < 0 ? 0 - static_cast<uint64_t>(v) : static_cast<uint64_t>(v));
+        }
+
+        CrashWriter &Hex(uint64_t v)
+        {
+            Put("0x");
+            for (int shift = 60; shift >= 0; shift -= 4)
+            {
+                Put("0123456789abcdef"[(v >> shift) & 0xF]);
+            }
+            return *this;
+        }
+
+        void Flush()
+        {
+            size_t done = 0;
+            while (done < m_pos)
+            {
+                auto n = write(m_fd, m_buf + done, m_pos - done);
+                if (n <= 0)
+                {
+                    break;
+                }
+                done += static_cast<size_t>(n);
+            }
+            m_pos = 0;
+        }
+
+    private:
+        int m_fd;
+        size_t m_pos;
+        char m_buf[512];
+    };
+
+    void dump_maps(CrashWriter &out)
+    {
+#ifdef __linux__
+        auto fd = open("/proc/self/maps", O_RDONLY);
+        if (fd < 0)
+        {
+            return;
+        }
+        char chunk[512];
+        bool line_start = true;
+        ssize_t n;
+        while ((n = read(fd, chunk, sizeof(chunk))) > 0)
+        {
+            for (ssize_t i = 0; i < n; ++i)
+            {
+                if (line_start)
+                {
+                    out.Put("map ");
+                }
+                out.Put(chunk[i]);
+                line_start = chunk[i] == '\n';
+            }
+        }
+        close(fd);
+#else
+        (void)out;
+#endif
+    }
+#endif
+}
+
+void RECLOG::CrashRing::Note(const LogSite *site, bool deferred, const void *src, size_t len)
+{
+    auto &ctx = ThisThread();
+    if (!ctx.crash_claimed)
+    {
+        ctx.crash_claimed = true;
+        ctx.crash = claim_lane();
+    }
+    auto lane = ctx.crash;
+    if (lane == nullptr)
+    {
+        return;
+    }
+    // only this thread writes the lane, nothing here is shared with other producers.
+    auto n = lane->next.load(std::memory_order_relaxed);
+    auto &slot = lane->slots[n % REC_CRASH_SLOTS];
+    slot.seq.store(2 * n + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.ticks.store(Clock::Ticks(), std::memory_order_relaxed);
+    slot.site = site;
+    slot.deferred = deferred;
+    slot.len = static_cast<uint32_t>(len < REC_CRASH_BYTES ? len : REC_CRASH_BYTES);
+    memcpy(slot.data, src, slot.len);
+    slot.seq.store(2 * n + 2, std::memory_order_release);
+    lane->next.store(n + 1, std::memory_order_release);
+}
+
+bool RECLOG::CrashRing::Open(const char *path)
+{
+#if __GNUC__
+    if (crash_fd >= 0)
+    {
+        return true;
+    }
+    snprintf(crash_path, sizeof(crash_path), "%s", path);
+    crash_fd = open(crash_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    return crash_fd >= 0;
+#else
+    (void)path;
+    return false;
+#endif
+}
+
+void RECLOG::CrashRing::Close()
+{
+#if __GNUC__
+    if (crash_fd >= 0)
+    {
+        close(crash_fd);
+        unlink(crash_path);
+        crash_fd = -1;
+    }
+#endif
+}
+
+void RECLOG::CrashRing::DumpRecords(int fd)
+{
+#if __GNUC__
+    CrashWriter out(fd);
+    // each lane is in order already, merged by ticks with a cursor per lane.
+    CrashLane *lanes[REC_CRASH_THREADS];
+    uint64_t cursor[REC_CRASH_THREADS];
+    uint64_t end[REC_CRASH_THREADS];
+    for (size_t i = 0; i < REC_CRASH_THREADS; ++i)
+    {
+        lanes[i] = crash_lanes[i].load(std::memory_order_acquire);
+        end[i] = lanes[i] == nullptr ? 0 : lanes[i]->next.load(std::memory_order_acquire);
+        cursor[i] = end[i] > REC_CRASH_SLOTS ? end[i] - REC_CRASH_SLOTS : 0;
+    }
+    char copy[REC_CRASH_BYTES];
+    while (true)
+    {
+        size_t best = REC_CRASH_THREADS;
+        uint64_t best_ticks = 0;
+        for (size_t i = 0; i < REC_CRASH_THREADS; ++i)
+        {
+            if (cursor[i] == end[i])
+            {
+                continue;
+            }
+            auto ticks = lanes[i]->slots[cursor[i] % REC_CRASH_SLOTS].ticks.load(std::memory_order_relaxed);
+            if (best == REC_CRASH_THREADS || ticks < best_ticks)
+            {
+                best = i;
+                best_ticks = ticks;
+            }
+        }
+        if (best == REC_CRASH_THREADS)
+        {
+            break;
+        }
+        auto n = cursor[best]++;
+        auto &slot = lanes[best]->slots[n % REC_CRASH_SLOTS];
+        auto seq = slot.seq.load(std::memory_order_acquire);
+        if (seq != 2 * n + 2)
+        {
+            continue;
+        }
+        auto site = slot.site;
+        auto deferred = slot.deferred;
+        auto len = slot.len;
+        memcpy(copy, slot.data, len);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.seq.load(std::memory_order_relaxed) != seq || site == nullptr)
+        {
+            // overwritten while copied.
+            continue;
+        }
+        if (deferred)
+        {
+            out.Put("args ").Put(site->file).Put(' ').Dec(site->line).Put(' ').Int(site->verbosity).Put(' ');
+            for (uint32_t i = 0; i < len; ++i)
+            {
+                auto byte = static_cast<unsigned char>(copy[i]);
+                out.Put("0123456789abcdef"[byte >> 4]).Put("0123456789abcdef"[byte & 0xF]);
+            }
+        }
+        else
+        {
+            out.Put("text ");
+            for (uint32_t i = 0; i < len; ++i)
+            {
+                if (copy[i] == '\n')
+                {
+                    out.Put("\\n");
+                }
+                else if (copy[i] == '\\')
+                {
+                    out.Put("\\\\");
+                }
+                else
+                {
+                    out.Put(copy[i]);
+                }
+            }
+        }
+        out.Put('\n');
+    }
+#else
+    (void)fd;
+#endif
+}
+
+void RECLOG::CrashRing::Dump(int signal_number, const char *signal_name, void *const *callstack, int frames)
+{
+#if __GNUC__
+    auto fd = crash_fd >= 0 ? crash_fd : STDERR_FILENO;
+    {
+        CrashWriter out(fd);
+        out.Put("REC crash ").Put(signal_name).Put(' ').Dec(static_cast<uint64_t>(signal_number));
+        out.Put(" pid ").Dec(static_cast<uint64_t>(getpid()));
+        out.Put(" start ").Int(RECONFIG::start_time).Put('\n');
+        // Current may spin or calibrate, a crash in the middle of Calibrate would hang here.
+        ClockCalibration cal;
+        if (Clock::TryCurrent(cal))
+        {
+            uint64_t rate;
+            memcpy(&rate, &cal.ns_per_tick, sizeof(rate));
+            out.Put("clock ").Dec(cal.base).Put(' ').Dec(static_cast<uint64_t>(cal.wall)).Put(' ').Hex(rate).Put('\n');
+        }
+        else
+        {
+            out.Put("clock uncalibrated\n");
+        }
+        for (int i = 0; i < frames; ++i)
+        {
+            out.Put("frame ").Hex(reinterpret_cast<uintptr_t>(callstack[i])).Put('\n');
+        }
+        dump_maps(out);
+    }
+    DumpRecords(fd);
+    if (fd != STDERR_FILENO)
+    {
+        CrashWriter err(STDERR_FILENO);
+        err.Put("REC caught ").Put(signal_name).Put(", see ").Put(crash_path).Put('\n');
+    }
+#else
+    (void)signal_number;
+    (void)signal_name;
+    (void)callstack;
+    (void)frames;
+#endif
+}
@@ -0,0 +1,350 @@
+#include "rec_deferred.h"
+#include "log_backend.h"
+#include "reclog_impl.h"
+#include <iomanip>
+
+namespace
+{
+    constexpr uint32_t REC_SITE_CHUNK = 1024;
+    constexpr uint32_t REC_SITE_CHUNKS = 256;
+
+    std::mutex site_lock;
+    std::atomic<const RECLOG::LogSite **> site_chunks[REC_SITE_CHUNKS];
+    std::atomic<uint32_t> site_count{0};
+
+    const RECLOG::Manipulator manipulators[] = {
+        std::boolalpha, std::noboolalpha, std::showbase, std::noshowbase,
+        std::showpoint, std::noshowpoint, std::showpos, std::noshowpos,
+        std::uppercase, std::nouppercase, std::left, std::right, std::internal,
+        std::dec, std::hex, std::oct, std::fixed, std::scientific,
+        std::hexfloat, std::defaultfloat};
+    constexpr int manipulator_count = sizeof(manipulators) / sizeof(manipulators[0]);
+
+    // numbers the way Codec_STR writes them, so rendered text matches text made on the spot.
+    template <typename T>
+    void put_number(std::ostream &os, T v)
+    {
+        if (RECLOG::PlainFormat(os))
+        {
+            char buf[RECLOG::REC_NUMBER_CHARS];
+            os.write(buf, static_cast<std::streamsize>(RECLOG::FormatNumber(buf, v)));
+        }
+        else
+        {
+            os << v;
+        }
+    }
+
+    bool get_varint(const unsigned char *&p, const unsigned char *end, uint64_t &v)
+    {
+        v = 0;
+        for (int shift = 0; p < end && shift < 64; shift += 7)
+        {
+            auto byte = *p++;
+            v |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    size_t write_frame(RECLOG::FileBase &fp, uint8_t kind, const void *payload, size_t len)
+    {
+        unsigned char head[5];
+        head[0] = kind;
+        RECLOG::store_le(head + 1, len, 4);
+        return fp.WriteData(head, sizeof(char), sizeof(head)) + fp.WriteData(payload, sizeof(char), len);
+    }
+}
+
+RECLOG::LogSite::LogSite(const char *file, unsigned line, int verbosity, CodeType codec)
+    : file(file), name(filename(file)), line(line), verbosity(verbosity), codec(codec), id(0)
+{
+    format_where(where, sizeof(where), file, line);
+    // published complete, the writer may read it as soon as it has an id.
+    id = SiteRegistry::Add(this);
+}
+
+uint32_t RECLOG::SiteRegistry::Add(const LogSite *site)
+{
+    std::lock_guard<std::mutex> lock(site_lock);
+    auto id = site_count.load(std::memory_order_relaxed);
+    if (id >= REC_SITE_CHUNK * REC_SITE_CHUNKS)
+    {
+        return id;
+    }
+    auto chunk = site_chunks[id / REC_SITE_CHUNK].load(std::memory_order_relaxed);
+    if (chunk == nullptr)
+    {
+        chunk = new const LogSite *[REC_SITE_CHUNK];
+        site_chunks[id / REC_SITE_CHUNK].store(chunk, std::memory_order_release);
+    }
+    chunk[id % REC_SITE_CHUNK] = site;
+    site_count.store(id + 1, std::memory_order_release);
+    return id;
+}
+
+uint32_t RECLOG::SiteRegistry::Size()
+{
+    return site_count.load(std::memory_order_acquire);
+}
+
+const RECLOG::LogSite *RECLOG::SiteRegistry::At(uint32_t id)
+{
+    if (id >= Size())
+    {
+        return nullptr;
+    }
+    return site_chunks[id / REC_SITE_CHUNK].load(std::memory_order_acquire)[id % REC_SITE_CHUNK];
+}
+
+int RECLOG::FindManipulator(Manipulator f)
+{
+    for (int i = 0; i < manipulator_count; ++i)
+    {
+        if (manipulators[i] == f)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool RECLOG::RenderArgs(const unsigned char *data, size_t len, std::ostream &os)
+{
+    auto p = data;
+    auto end = data + len;
+    uint64_t v = 0;
+    while (p < end)
+    {
+        switch (*p++)
+        {
+        case ARG_CHAR:
+            if (p == end)
+            {
+                return false;
+            }
+            os << static_cast<char>(*p++);
+            break;
+        case ARG_BOOL:
+            if (p == end)
+            {
+                return false;
+            }
+            os << (*p++ != 0);
+            break;
+        case ARG_INT:
+            if (!get_varint(p, end, v))
+            {
+                return false;
+            }
+            put_number(os, static_cast<long long>((v >> 1) ^ (~(v & 1) + 1)));
+            break;
+        case ARG_UINT:
+            if (!get_varint(p, end, v))
+            {
+                return false;
+            }
+            put_number(os, static_cast<unsigned long long>(v));
+            break;
+        case ARG_FLOAT:
+        {
+            float f = 0;
+            if (end - p < static_cast<ptrdiff_t>(sizeof(f)))
+            {
+                return false;
+            }
+            memcpy(&f, p, sizeof(f));
+            p += sizeof(f);
+            put_number(os, f);
+            break;
+        }
+        case ARG_DOUBLE:
+        {
+            double d = 0;
+            if (end - p < static_cast<ptrdiff_t>(sizeof(d)))
+            {
+                return false;
+            }
+            memcpy(&d, p, sizeof(d));
+            p += sizeof(d);
+            put_number(os, d);
+            break;
+        }
+        case ARG_STRING:
+            if (!get_varint(p, end, v) || v > static_cast<uint64_t>(end - p))
+            {
+                return false;
+            }
+            os << std::string(reinterpret_cast<const char *>(p), static_cast<size_t>(v));
+            p += v;
+            break;
+        case ARG_POINTER:
+            if (!get_varint(p, end, v))
+            {
+                return false;
+            }
+            os << reinterpret_cast<const void *>(static_cast<uintptr_t>(v));
+            break;
+        case ARG_MANIP:
+            if (p == end || *p >= manipulator_count)
+            {
+                return false;
+            }
+            os << manipulators[*p++];
+            break;
+        case ARG_FORMAT:
+        {
+            uint64_t flags = 0, precision = 0, width = 0;
+            if (p == end)
+            {
+                return false;
+            }
+            auto changed = *p++;
+            if (!get_varint(p, end, flags) || !get_varint(p, end, precision) ||
+                !get_varint(p, end, width) || p == end)
+            {
+                return false;
+            }
+            auto fill = static_cast<char>(*p++);
+            if (changed & FORMAT_FLAGS)
+            {
+                os.flags(os.flags() ^ static_cast<std::ios_base::fmtflags>(flags));
+            }
+            if (changed & FORMAT_PRECISION)
+            {
+                os.precision(static_cast<std::streamsize>(precision));
+            }
+            if (changed & FORMAT_WIDTH)
+            {
+                os.width(static_cast<std::streamsize>(width));
+            }
+            if (changed & FORMAT_FILL)
+            {
+                os.fill(fill);
+            }
+            break;
+        }
+        default:
+            return false;
+        }
+    }
+    return true;
+}
+
+bool RECLOG::RenderDeferred(const unsigned char *data, size_t len, long long start_time, const ClockCalibration &cal,
+                            const std::string &thread, const char *file, unsigned line, int verbosity, std::string &out)
+{
+    if (len < REC_DEFERRED_PREFIX)
+    {
+        return false;
+    }
+    auto ms_since_epoch = Clock::ToNanos(load_le(data + 4, 8), cal) / 1000000;
+    char thread_name[REC_THREADNAME_WIDTH + 1];
+    if (thread.empty())
+    {
+        print_thread_name(static_cast<unsigned int>(load_le(data + 12, 4)), thread_name, sizeof(thread_name), true);
+    }
+    else
+    {
+        snprintf(thread_name, sizeof(thread_name), "%s", thread.c_str());
+    }
+    char preamble_buffer[REC_PREAMBLE_WIDTH];
+    format_preamble(preamble_buffer, sizeof(preamble_buffer), ms_since_epoch, start_time,
+                    thread_name, verbosity, file, line);
+    std::ostringstream ss;
+    ss << preamble_buffer;
+    auto ok = RenderArgs(data + REC_DEFERRED_PREFIX, len - REC_DEFERRED_PREFIX, ss);
+    out = ss.str();
+    return ok;
+}
+
+bool RECLOG::RenderDeferred(const unsigned char *data, size_t len, std::string &out)
+{
+    if (len < REC_DEFERRED_PREFIX)
+    {
+        return false;
+    }
+    auto site = SiteRegistry::At(static_cast<uint32_t>(load_le(data, 4)));
+    return site != nullptr &&
+           RenderDeferred(data, len, RECONFIG::start_time, Clock::Current(),
+                          ThreadRegistry::Name(static_cast<uint32_t>(load_le(data + 12, 4))), site->file, site->line,
+                          site->verbosity, out);
+}
+
+void RECLOG::WriteDeferred(DiskFileCluster *dest, const void *src, size_t len)
+{
+    auto data = static_cast<const unsigned char *>(src);
+    if (len < REC_DEFERRED_PREFIX)
+    {
+        return;
+    }
+    if (dest == nullptr)
+    {
+        // nobody reads the screen offline, render it here.
+        std::string text;
+        if (RenderDeferred(data, len, text))
+        {
+            WriteRecord(CodeType::LOG, nullptr, text.data(), text.size());
+        }
+        return;
+    }
+    auto handle = dest->GetCurFileFp();
+    auto &fp = *handle;
+    auto &state = handle.Header();
+    // held up to the record, the frames it depends on come first even with producers writing directly.
+    std::lock_guard<std::mutex> lock(state.lock);
+    size_t bytes_writed = 0;
+    if (!state.started)
+    {
+        state.started = true;
+        unsigned char start[8];
+        store_le(start, static_cast<uint64_t>(RECONFIG::start_time), 8);
+        bytes_writed += fp.WriteData(REC_BIN_MAGIC, sizeof(char), REC_BIN_MAGIC_LEN);
+        bytes_writed += write_frame(fp, FRAME_START, start, sizeof(start));
+        state.clock = Clock::Generation() + 1;
+    }
+    if (state.clock != Clock::Generation())
+    {
+        // readers convert the ticks with the calibration last seen in the file.
+        state.clock = Clock::Generation();
+        auto cal = Clock::Current();
+        unsigned char frame[24];
+        uint64_t rate;
+        memcpy(&rate, &cal.ns_per_tick, sizeof(rate));
+        store_le(frame, cal.base, 8);
+        store_le(frame + 8, static_cast<uint64_t>(cal.wall), 8);
+        store_le(frame + 16, rate, 8);
+        bytes_writed += write_frame(fp, FRAME_CLOCK, frame, sizeof(frame));
+    }
+    for (auto count = SiteRegistry::Size(); state.sites < count; ++state.sites)
+    {
+        auto site = SiteRegistry::At(state.sites);
+        if (site->codec != CodeType::LOG)
+        {
+            // records of other codecs never land here.
+            continue;
+        }
+        auto name_len = strlen(site->file);
+        std::string desc(12 + name_len, '\0');
+        auto ptr = reinterpret_cast<unsigned char *>(&desc[0]);
+        store_le(ptr, site->id, 4);
+        store_le(ptr + 4, site->line, 4);
+        store_le(ptr + 8, static_cast<uint32_t>(site->verbosity), 4);
+        memcpy(ptr + 12, site->file, name_len);
+        bytes_writed += write_frame(fp, FRAME_SITE, desc.data(), desc.size());
+    }
+    for (auto count = ThreadRegistry::Size(); state.threads < count; ++state.threads)
+    {
+        auto entry = ThreadRegistry::At(state.threads);
+        std::string desc(4 + entry.name.size(), '\0');
+        auto ptr = reinterpret_cast<unsigned char *>(&desc[0]);
+        store_le(ptr, entry.index, 4);
+        memcpy(ptr + 4, entry.name.data(), entry.name.size());
+        bytes_writed += write_frame(fp, FRAME_THREAD, desc.data(), desc.size());
+    }
+    bytes_writed += write_frame(fp, FRAME_RECORD, data, len);
+    dest->IncraeseBytes(bytes_writed);
+}
@@ -0,0 +1,331 @@
+#include "rec_format.h"
+#include <vector>
+
+namespace
+{
+    // v = f * 2^e
+    struct DiyFp
+    {
+        uint64_t f;
+        int e;
+    };
+
+    DiyFp multiply(const DiyFp &x, const DiyFp &y)
+    {
+        const uint64_t mask = 0xFFFFFFFFu;
+        uint64_t a = x.f >> 32, b = x.f & mask, c = y.f >> 32, d = y.f & mask;
+        uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+        // rounded, the low half only decides the last bit.
+        uint64_t mid = (bd >> 32) + (ad & mask) + (bc & mask) + (1u << 31);
+        return {ac + (ad >> 32) + (bc >> 32) + (mid >> 32), x.e + y.e + 64};
+    }
+
+    DiyFp normalize(DiyFp v)
+    {
+        while (!(v.f & (static_cast<uint64_t>(1) << 63)))
+        {
+            v.f <<= 1;
+            --v.e;
+        }
+        return v;
+    }
+
+    // 10^k for k = -348, -340 ... 340, normalized and rounded to 64 bits. made once from exact
+    // big integers, 2^n / 10^-k for the negative ones, instead of a table of literals.
+    class CachedPowers
+    {
+    public:
+        static const CachedPowers &Instance()
+        {
+            static const CachedPowers powers;
+            return powers;
+        }
+
+        DiyFp operator[](size_t i) const
+        {
+            return m_powers[i];
+        }
+
+    private:
+        DiyFp m_powers[87];
+
+        CachedPowers()
+        {
+            for (int i = 0; i < 87; ++i)
+            {
+                int k = -348 + 8 * i;
+                // little endian 32 bit words.
+                std::vector<uint32_t> big;
+                int shift = 0;
+                if (k >= 0)
+                {
+                    big.push_back(1);
+                    for (int n = 0; n < k; ++n)
+                    {
+                        uint64_t carry = 0;
+                        for (auto &word : big)
+                        {
+                            carry += static_cast<uint64_t>(word) * 10;
+                            word = static_cast<uint32_t>(carry);
+                            carry >>= 32;
+                        }
+                        if (carry != 0)
+                        {
+                            big.push_back(static_cast<uint32_t>(carry));
+                        }
+                    }
+                }
+                else
+                {
+                    // enough bits that the quotient keeps more than 64 of them.
+                    shift = 4 * -k + 96;
+                    big.assign(static_cast<size_t>(shift / 32 + 1), 0);
+                    big.back() = static_cast<uint32_t>(1) << (shift % 32);
+                    for (int n = 0; n < -k; ++n)
+                    {
+                        uint64_t rem = 0;
+                        for (size_t w = big.size(); w-- > 0;)
+                        {
+                            auto cur = (rem << 32) | big[w];
+                            big[w] = static_cast<uint32_t>(cur / 10);
+                            rem = cur % 10;
+                        }
+                        while (big.back() == 0)
+                        {
+                            big.pop_back();
+                        }
+                    }
+                }
+                int bits = static_cast<int>(big.size()) * 32;
+                for (auto top = big.back(); !(top & 0x80000000u); top <<= 1)
+                {
+                    --bits;
+                }
+                auto bit = [&big](int n) -> uint64_t
+                {
+                    return n < 0 ? 0 : (big[static_cast<size_t>(n / 32)] >> (n % 32)) & 1;
+                };
+                uint64_t f = 0;
+                for (int n = bits - 1; n >= bits - 64; --n)
+                {
+                    f = (f << 1) | bit(n);
+                }
+                int e = bits - 64 - shift;
+                if (bit(bits - 65) && ++f == 0)
+                {
+                    f = static_cast<uint64_t>(1) << 63;
+                    ++e;
+                }
+                m_powers[i] = {f, e};
+            }
+        }
+    };
+
+    const uint32_t pow10[] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000};
+
+    uint64_t pow10_64(int n)
+    {
+        uint64_t v = 1;
+        while (n-- > 0)
+        {
+            v *= 10;
+        }
+        return v;
+    }
+
+    int count_digits(uint32_t n)
+    {
+        int digits = 1;
+        while (digits < 10 && n >= pow10[digits])
+        {
+            ++digits;
+        }
+        return digits;
+    }
+
+    void grisu_round(char *buffer, int len, uint64_t delta, uint64_t rest, uint64_t ten_kappa, uint64_t wp_w)
+    {
+        while (rest < wp_w && delta - rest >= ten_kappa &&
+               (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w))
+        {
+            --buffer[len - 1];
+            rest += ten_kappa;
+        }
+    }
+
+    void digit_gen(const DiyFp &w, const DiyFp &mp, uint64_t delta, char *buffer, int &len, int &k)
+    {
+        const DiyFp one = {static_cast<uint64_t>(1) << -mp.e, mp.e};
+        const uint64_t wp_w = mp.f - w.f;
+        auto p1 = static_cast<uint32_t>(mp.f >> -one.e);
+        uint64_t p2 = mp.f & (one.f - 1);
+        int kappa = count_digits(p1);
+        len = 0;
+        while (kappa > 0)
+        {
+            uint32_t d = p1 / pow10[kappa - 1];
+            p1 %= pow10[kappa - 1];
+            if (d != 0 || len != 0)
+            {
+                buffer[len++] = static_cast<char>('0' + d);
+            }
+            --kappa;
+            uint64_t rest = (static_cast<uint64_t>(p1) << -one.e) + p2;
+            if (rest <= delta)
+            {
+                k += kappa;
+                grisu_round(buffer, len, delta, rest, static_cast<uint64_t>(pow10[kappa]) << -one.e, wp_w);
+                return;
+            }
+        }
+        while (true)
+        {
+            p2 *= 10;
+            delta *= 10;
+            auto d = static_cast<char>(p2 >> -one.e);
+            if (d != 0 || len != 0)
+            {
+                buffer[len++] = static_cast<char>('0' + d);
+            }
+            p2 &= one.f - 1;
+            --kappa;
+            if (p2 < delta)
+            {
+                k += kappa;
+                grisu_round(buffer, len, delta, p2, one.f, -kappa < 20 ? wp_w * pow10_64(-kappa) : 0);
+                return;
+            }
+        }
+    }
+
+    // digits of f * 2^e, the value is digits * 10^k. lower_closer when the next smaller value is nearer.
+    void grisu2(uint64_t f, int e, bool lower_closer, char *buffer, int &len, int &k)
+    {
+        auto mp = normalize({(f << 1) + 1, e - 1});
+        DiyFp mm = lower_closer ? DiyFp{(f << 2) - 1, e - 2} : DiyFp{(f << 1) - 1, e - 1};
+        mm.f <<= mm.e - mp.e;
+        mm.e = mp.e;
+        // the cached power that brings the exponent of mp into [-60, -32].
+        double dk = (-61 - mp.e) * 0.30102999566398114 + 347;
+        auto ik = static_cast<int>(dk);
+        if (dk - ik > 0.0)
+        {
+            ++ik;
+        }
+        auto index = static_cast<size_t>((ik >> 3) + 1);
+        k = -(-348 + static_cast<int>(index << 3));
+        auto c = CachedPowers::Instance()[index];
+        auto w = multiply(normalize({f, e}), c);
+        auto wp = multiply(mp, c);
+        auto wm = multiply(mm, c);
+        ++wm.f;
+        --wp.f;
+        digit_gen(w, wp, wp.f - wm.f, buffer, len, k);
+    }
+
+    size_t write_exponent(char *buf, int exp)
+    {
+        size_t n = 0;
+        buf[n++] = 'e';
+        buf[n++] = exp < 0 ? '-' : '+';
+        exp = exp < 0 ? -exp : exp;
+        if (exp < 10)
+        {
+            buf[n++] = '0';
+        }
+        return n + RECLOG::FormatUInt(buf + n, static_cast<uint64_t>(exp));
+    }
+
+    // digits * 10^k as text.
+    size_t layout(char *buf, const char *digits, int len, int k)
+    {
+        // decimal exponent of the first digit.
+        int exp = len + k - 1;
+        size_t n = 0;
+        if (exp >= -5 && exp < 17)
+        {
+            if (k >= 0)
+            {
+                memcpy(buf, digits, static_cast<size_t>(len));
+                memset(buf + len, '0', static_cast<size_t>(k));
+                return static_cast<size_t>(len + k);
+            }
+            if (exp >= 0)
+            {
+                memcpy(buf, digits, static_cast<size_t>(exp + 1));
+                buf[exp + 1] = '.';
+                memcpy(buf + exp + 2, digits + exp + 1, static_cast<size_t>(len - exp - 1));
+                return static_cast<size_t>(len + 1);
+            }
+            buf[n++] = '0';
+            buf[n++] = '.';
+            memset(buf + n, '0', static_cast<size_t>(-exp - 1));
+            n += static_cast<size_t>(-exp - 1);
+            memcpy(buf + n, digits, static_cast<size_t>(len));
+            return n + static_cast<size_t>(len);
+        }
+        buf[n++] = digits[0];
+        if (len > 1)
+        {
+            buf[n++] = '.';
+            memcpy(buf + n, digits + 1, static_cast<size_t>(len - 1));
+            n += static_cast<size_t>(len - 1);
+        }
+        return n + write_exponent(buf + n, exp);
+    }
+
+    size_t format_binary(char *buf, bool negative, uint64_t fraction, int biased, int fraction_bits, int bias)
+    {
+        size_t n = 0;
+        if (negative)
+        {
+            buf[n++] = '-';
+        }
+        if (biased == 0 && fraction == 0)
+        {
+            buf[n++] = '0';
+            return n;
+        }
+        auto hidden = static_cast<uint64_t>(1) << fraction_bits;
+        uint64_t f = biased == 0 ? fraction : fraction + hidden;
+        int e = (biased == 0 ? 1 : biased) - bias - fraction_bits;
+        char digits[20];
+        int len = 0, k = 0;
+        grisu2(f, e, biased > 1 && fraction == 0, digits, len, k);
+        return n + layout(buf + n, digits, len, k);
+    }
+}
+
+size_t RECLOG::FormatDouble(char *buf, double v)
+{
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    bool negative = (bits >> 63) != 0;
+    auto biased = static_cast<int>((bits >> 52) & 0x7FF);
+    uint64_t fraction = bits & ((static_cast<uint64_t>(1) << 52) - 1);
+    if (biased == 0x7FF)
+    {
+        const char *text = fraction != 0 ? "nan" : negative ? "-inf" : "inf";
+        auto len = strlen(text);
+        memcpy(buf, text, len);
+        return len;
+    }
+    return format_binary(buf, negative, fraction, biased, 52, 1023);
+}
+
+size_t RECLOG::FormatFloat(char *buf, float v)
+{
+    uint32_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    bool negative = (bits >> 31) != 0;
+    auto biased = static_cast<int>((bits >> 23) & 0xFF);
+    uint64_t fraction = bits & ((1u << 23) - 1);
+    if (biased == 0xFF)
+    {
+        const char *text = fraction != 0 ? "nan" : negative ? "-inf" : "inf";
+        auto len = strlen(text);
+        memcpy(buf, text, len);
+        return len;
+    }
+    return format_binary(buf, negative, fraction, biased, 23, 127);
+}
@@ -0,0 +1,87 @@
+#include "rec_schema.h"
+#include "reclog.h"
+#include <mutex>
+#include <vector>
+
+namespace
+{
+    std::mutex schema_lock;
+    std::vector<std::string> schema_bodies;
+    std::atomic<uint32_t> schema_count{0};
+}
+
+uint32_t RECLOG::SchemaRegistry::Add(const unsigned char *body, size_t len)
+{
+    std::lock_guard<std::mutex> lock(schema_lock);
+    schema_bodies.emplace_back(reinterpret_cast<const char *>(body), len);
+    auto id = static_cast<uint32_t>(schema_bodies.size() - 1);
+    schema_count.store(id + 1, std::memory_order_release);
+    return id;
+}
+
+uint32_t RECLOG::SchemaRegistry::Size()
+{
+    return schema_count.load(std::memory_order_acquire);
+}
+
+std::string RECLOG::SchemaRegistry::At(uint32_t id)
+{
+    cborio::ustring head(16);
+    cborio::encoder cbs(head);
+    cbs.write_tag(REC_SCHEMA_DEF_TAG);
+    cbs.write_array_head(3);
+    cbs << id;
+    std::string def(reinterpret_cast<const char *>(head.data()), head.size());
+    std::lock_guard<std::mutex> lock(schema_lock);
+    if (id < schema_bodies.size())
+    {
+        def += schema_bodies[id];
+    }
+    return def;
+}
+
+size_t RECLOG::WriteSchemas(DiskFileCluster *dest, FileHandle &handle)
+{
+    if (dest->Type() != CodeType::CBOR)
+    {
+        return 0;
+    }
+    auto count = SchemaRegistry::Size();
+    auto threads = ThreadRegistry::Size();
+    auto &state = handle.Header();
+    std::lock_guard<std::mutex> lock(state.lock);
+    size_t bytes_writed = 0;
+    if (state.clock == 0 || state.clock != Clock::Generation())
+    {
+        // the ticks of the records after it are converted with this one.
+        state.clock = Clock::Generation();
+        auto cal = Clock::Current();
+        cborio::ustring def(48);
+        cborio::encoder cbs(def);
+        cbs.write_tag(REC_CLOCK_TAG);
+        cbs.write_array_head(3);
+        cbs << cal.base << cal.wall << cal.ns_per_tick;
+        bytes_writed += handle->WriteData(def.data(), sizeof(char), def.size());
+    }
+    // only files in schema mode carry definitions, plain files stay plain.
+    if (count == 0)
+    {
+        return bytes_writed;
+    }
+    for (; state.schemas < count; ++state.schemas)
+    {
+        auto def = SchemaRegistry::At(state.schemas);
+        bytes_writed += handle->WriteData(def.data(), sizeof(char), def.size());
+    }
+    for (; state.threads < threads; ++state.threads)
+    {
+        auto entry = ThreadRegistry::At(state.threads);
+        cborio::ustring def(32);
+        cborio::encoder cbs(def);
+        cbs.write_tag(REC_THREAD_TAG);
+        cbs.write_array_head(2);
+        cbs << entry.index << entry.name;
+        bytes_writed += handle->WriteData(def.data(), sizeof(char), def.size());
+    }
+    return bytes_writed;
+}
@@ -0,0 +1,388 @@
+#include "rec_shm.h"
+#include "log_backend.h"
+#include "reclog_impl.h"
+#include <algorithm>
+#include <iterator>
+#include <limits>
+
+#ifdef __linux__
+#include <dirent.h>   // for opendir
+#include <fcntl.h>    // for open
+#include <signal.h>   // for kill
+#include <sys/mman.h> // for mmap
+#include <sys/stat.h> // for fstat
+#include <unistd.h>   // for getpid
+#endif
+
+namespace
+{
+    constexpr char REC_SHM_MAGIC[] = "RECSHM01";
+    constexpr size_t REC_SHM_ENTRY = 16;
+    // how often the collector looks for new producers.
+    constexpr long long REC_SHM_SCAN_MS = 100;
+
+    std::atomic<uint32_t> producer_count{0};
+
+    size_t align8(size_t n)
+    {
+        return (n + 7) & ~static_cast<size_t>(7);
+    }
+
+    std::atomic<uint32_t> &size_word(unsigned char *entry)
+    {
+        return *reinterpret_cast<std::atomic<uint32_t> *>(entry);
+    }
+}
+
+struct RECLOG::ShmRingHead
+{
+    char magic[8];
+    uint64_t capacity;
+    int64_t pid;
+    // producers reserve at head, the collector frees up to tail.
+    std::atomic<uint64_t> head;
+    std::atomic<uint64_t> tail;
+    std::atomic<uint64_t> dropped;
+    std::atomic<uint32_t> closed;
+    uint32_t reserved;
+};
+
+RECLOG::ShmProducer::ShmProducer(const std::string &channel, size_t capacity)
+    : m_head(nullptr), m_data(nullptr), m_mapsize(0)
+{
+#ifdef __linux__
+    capacity = align8(std::max<size_t>(capacity, 4096));
+    m_path = std::string(REC_SHM_DIR) + "rec." + channel + "." + std::to_string(getpid()) + "." +
+             std::to_string(producer_count.fetch_add(1));
+    auto fd = open(m_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        return;
+    }
+    m_mapsize = sizeof(ShmRingHead) + capacity;
+    void *base = MAP_FAILED;
+    // pages are taken now, a full /dev/shm fails here instead of raising SIGBUS later.
+    if (posix_fallocate(fd, 0, static_cast<off_t>(m_mapsize)) == 0)
+    {
+        base = mmap(nullptr, m_mapsize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (base == MAP_FAILED)
+    {
+        unlink(m_path.c_str());
+        return;
+    }
+    auto head = static_cast<ShmRingHead *>(base);
+    head->capacity = capacity;
+    head->pid = getpid();
+    m_data = static_cast<unsigned char *>(base) + sizeof(ShmRingHead);
+    // the collector ignores the ring until the magic is there.
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(head->magic, REC_SHM_MAGIC, sizeof(head->magic));
+    m_head = head;
+#else
+    (void)channel;
+    (void)capacity;
+#endif
+}
+
+RECLOG::ShmProducer::~ShmProducer()
+{
+#ifdef __linux__
+    if (m_head != nullptr)
+    {
+        // the collector drains what is left and removes the ring.
+        m_head->closed.store(1, std::memory_order_release);
+        munmap(m_head, m_mapsize);
+    }
+#endif
+}
+
+bool RECLOG::ShmProducer::Put(CodeType type, const void *src, size_t len)
+{
+    if (m_head == nullptr)
+    {
+        return false;
+    }
+    // taken before the reservation, threads sharing the ring may still publish a little out of order.
+    auto wall = Clock::Now();
+    auto capacity = m_head->capacity;
+    auto total = align8(REC_SHM_ENTRY + len);
+    if (total > capacity / 2)
+    {
+        m_head->dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    uint64_t head, need, pos;
+    do
+    {
+        head = m_head->head.load(std::memory_order_relaxed);
+        auto tail = m_head->tail.load(std::memory_order_acquire);
+        pos = head % capacity;
+        // an entry never wraps, the rest of the ring is skipped instead.
+        need = capacity - pos < total ? capacity - pos + total : total;
+        if (head + need - tail > capacity)
+        {
+            m_head->dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+    } while (!m_head->head.compare_exchange_weak(head, head + need, std::memory_order_relaxed));
+    if (need != total)
+    {
+        size_word(m_data + pos).store(static_cast<uint32_t>(capacity - pos) | REC_SHM_PAD, std::memory_order_release);
+        pos = 0;
+    }
+    auto entry = m_data + pos;
+    entry[4] = static_cast<unsigned char>(type);
+    store_le(entry + 8, static_cast<uint64_t>(wall), 8);
+    memcpy(entry + REC_SHM_ENTRY, src, len);
+    // the collector reads nothing of an entry before its size.
+    size_word(entry).store(static_cast<uint32_t>(REC_SHM_ENTRY + len), std::memory_order_release);
+    return true;
+}
+
+size_t RECLOG::ShmProducer::Dropped() const
+{
+    return m_head == nullptr ? 0 : static_cast<size_t>(m_head->dropped.load(std::memory_order_relaxed));
+}
+
+RECLOG::ShmCollector::ShmCollector(const std::string &channel, const std::string &rootname, const RECOPTION &option)
+    : m_channel(channel), m_rootname(rootname), m_last_scan(0), m_running(false)
+{
+    const CodeType types[] = {CodeType::CBOR, CodeType::RAW, CodeType::LOG};
+    for (int i = 0; i < 3; ++i)
+    {
+        m_clusters[i].reset(new DiskFileCluster(m_rootname.c_str(), types[i]));
+        m_clusters[i]->SetPolicy(option);
+    }
+}
+
+RECLOG::ShmCollector::~ShmCollector()
+{
+    Stop();
+}
+
+RECLOG::DiskFileCluster *RECLOG::ShmCollector::Cluster(CodeType type)
+{
+    return m_clusters[static_cast<int>(type)].get();
+}
+
+void RECLOG::ShmCollector::Scan()
+{
+#ifdef __linux__
+    auto prefix = "rec." + m_channel + ".";
+    auto dir = opendir(REC_SHM_DIR);
+    if (dir == nullptr)
+    {
+        return;
+    }
+    while (auto entry = readdir(dir))
+    {
+        std::string name(entry->d_name);
+        auto path = REC_SHM_DIR + name;
+        if (name.compare(0, prefix.size(), prefix) != 0 ||
+            std::find_if(m_rings.begin(), m_rings.end(), [&path](const std::unique_ptr<Ring> &r)
+                         { return r->path == path; }) != m_rings.end())
+        {
+            continue;
+        }
+        auto fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+        if (fd < 0)
+        {
+            continue;
+        }
+        struct stat st;
+        void *base = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) > sizeof(ShmRingHead))
+        {
+            base = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+        if (base == MAP_FAILED)
+        {
+            continue;
+        }
+        auto head = static_cast<ShmRingHead *>(base);
+        if (memcmp(head->magic, REC_SHM_MAGIC, sizeof(head->magic)) != 0 ||
+            head->capacity + sizeof(ShmRingHead) > static_cast<size_t>(st.st_size))
+        {
+            // still being set up, the next scan sees it.
+            munmap(base, static_cast<size_t>(st.st_size));
+            continue;
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        std::unique_ptr<Ring> ring(new Ring());
+        ring->path = path;
+        ring->head = head;
+        ring->data = static_cast<unsigned char *>(base) + sizeof(ShmRingHead);
+        ring->mapsize = static_cast<size_t>(st.st_size);
+        m_rings.push_back(std::move(ring));
+    }
+    closedir(dir);
+#endif
+}
+
+void RECLOG::ShmCollector::Read(Ring &ring)
+{
+    auto capacity = ring.head->capacity;
+    auto tail = ring.head->tail.load(std::memory_order_relaxed);
+    while (tail != ring.head->head.load(std::memory_order_acquire))
+    {
+        auto entry = ring.data + tail % capacity;
+        auto size = size_word(entry).load(std::memory_order_acquire);
+        if (size == 0)
+        {
+            // reserved, not written yet.
+            break;
+        }
+        size_t len = size & REC_SHM_PAD ? size & ~REC_SHM_PAD : align8(size);
+        if (!(size & REC_SHM_PAD) && entry[4] <= static_cast<unsigned char>(CodeType::LOG))
+        {
+            Pending rec;
+            rec.type = static_cast<CodeType>(entry[4]);
+            rec.wall = static_cast<long long>(load_le(entry + 8, 8));
+            rec.data.assign(reinterpret_cast<const char *>(entry + REC_SHM_ENTRY), size - REC_SHM_ENTRY);
+            // kept in time order, a stamp only ever trails the ones before it by a little.
+            auto pos = ring.pending.end();
+            while (pos != ring.pending.begin() && std::prev(pos)->wall > rec.wall)
+            {
+                --pos;
+            }
+            ring.pending.insert(pos, std::move(rec));
+        }
+        // every later entry start has to read as zero until it is written.
+        memset(entry, 0, len);
+        tail += len;
+        ring.head->tail.store(tail, std::memory_order_release);
+    }
+}
+
+bool RECLOG::ShmCollector::Finished(const Ring &ring) const
+{
+    if (ring.head->tail.load() != ring.head->head.load())
+    {
+#ifdef __linux__
+        // a producer that died in the middle of a record never finishes it.
+        return kill(static_cast<pid_t>(ring.head->pid), 0) != 0 && errno == ESRCH;
+#else
+        return false;
+#endif
+    }
+#ifdef __linux__
+    return ring.head->closed.load() != 0 ||
+           (kill(static_cast<pid_t>(ring.head->pid), 0) != 0 && errno == ESRCH);
+#else
+    return ring.head->closed.load() != 0;
+#endif
+}
+
+void RECLOG::ShmCollector::Unmap(Ring &ring)
+{
+#ifdef __linux__
+    unlink(ring.path.c_str());
+    munmap(ring.head, ring.mapsize);
+#endif
+    ring.head = nullptr;
+}
+
+size_t RECLOG::ShmCollector::Poll(bool final)
+{
+    auto now = get_date_time();
+    if (final || now - m_last_scan >= REC_SHM_SCAN_MS)
+    {
+        Scan();
+        m_last_scan = now;
+    }
+    for (auto &ring : m_rings)
+    {
+        Read(*ring);
+    }
+    // Read keeps each ring in time order, merge their fronts.
+    auto horizon = final ? std::numeric_limits<long long>::max() : Clock::Now() - REC_SHM_HOLD_MS * 1000000;
+    size_t written = 0;
+    while (true)
+    {
+        Ring *next = nullptr;
+        for (auto &ring : m_rings)
+        {
+            if (!ring->pending.empty() && ring->pending.front().wall <= horizon &&
+                (next == nullptr || ring->pending.front().wall < next->pending.front().wall))
+            {
+                next = ring.get();
+            }
+        }
+        if (next == nullptr)
+        {
+            break;
+        }
+        auto &rec = next->pending.front();
+        WriteRecord(rec.type, Cluster(rec.type), rec.data.data(), rec.data.size());
+        next->pending.pop_front();
+        ++written;
+    }
+    for (auto iter = m_rings.begin(); iter != m_rings.end();)
+    {
+        auto &ring = **iter;
+        if (ring.pending.empty() && Finished(ring))
+        {
+            Unmap(ring);
+            iter = m_rings.erase(iter);
+        }
+        else
+        {
+            ++iter;
+        }
+    }
+    if (written != 0)
+    {
+        for (auto &cluster : m_clusters)
+        {
+            cluster->Flush();
+        }
+    }
+    return written;
+}
+
+void RECLOG::ShmCollector::Start()
+{
+    if (m_running.exchange(true))
+    {
+        return;
+    }
+    m_thread = std::thread([this]()
+                           {
+                               while (m_running.load())
+                               {
+                                   if (Poll() == 0)
+                                   {
+                                       std::this_thread::sleep_for(std::chrono::milliseconds(REC_WRITER_IDLE_MS));
+                                   }
+                               } });
+}
+
+void RECLOG::ShmCollector::Stop()
+{
+    m_running.store(false);
+    if (m_thread.joinable())
+    {
+        m_thread.join();
+    }
+    if (m_clusters[0] == nullptr)
+    {
+        return;
+    }
+    Poll(true);
+    for (auto &ring : m_rings)
+    {
+        // still open, the producer finds no collector anymore and its records are dropped.
+#ifdef __linux__
+        munmap(ring->head, ring->mapsize);
+#endif
+    }
+    m_rings.clear();
+    for (auto &cluster : m_clusters)
+    {
+        cluster->AtExit();
+        cluster.reset();
+    }
+}
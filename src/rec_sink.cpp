@@ -0,0 +1,71 @@
+#include "rec_sink.h"
+#include "log_backend.h"
+#include "rec_shm.h"
+
+void RECLOG::ScreenSink::Write(CodeType type, const void *data, size_t len)
+{
+    WriteRecord(type, nullptr, data, len);
+}
+
+bool RECLOG::ScreenSink::WriteDeferred(const void *data, size_t len)
+{
+    RECLOG::WriteDeferred(nullptr, data, len);
+    return true;
+}
+
+void RECLOG::ScreenSink::Flush()
+{
+    RECONFIG::GetCurLogFp()->Flush();
+}
+
+void RECLOG::ClusterSink::Write(CodeType type, const void *data, size_t len)
+{
+    WriteRecord(type, m_cluster, data, len);
+}
+
+bool RECLOG::ClusterSink::WriteDeferred(const void *data, size_t len)
+{
+    RECLOG::WriteDeferred(m_cluster, data, len);
+    return true;
+}
+
+void RECLOG::ClusterSink::Flush()
+{
+    m_cluster->Flush();
+}
+
+void RECLOG::ClusterSink::Sync()
+{
+    m_cluster->Sync();
+}
+
+void RECLOG::ShmSink::Write(CodeType type, const void *data, size_t len)
+{
+    m_producer->Put(type, data, len);
+}
+
+void RECLOG::MemorySink::Write(CodeType, const void *data, size_t len)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (m_capacity == 0)
+    {
+        return;
+    }
+    if (m_records.size() == m_capacity)
+    {
+        m_records.pop_front();
+    }
+    m_records.emplace_back(static_cast<const char *>(data), len);
+}
+
+std::vector<std::string> RECLOG::MemorySink::Records() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return std::vector<std::string>(m_records.begin(), m_records.end());
+}
+
+void RECLOG::MemorySink::Clear()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_records.clear();
+}
@@ -0,0 +1,102 @@
+#include "rec_stats.h"
+#include <algorithm>
+
+namespace
+{
+    // zeroed before any constructor runs, records made from static constructors count too.
+    RECLOG::StatCounter stat_counters[static_cast<size_t>(RECLOG::StatId::COUNT)];
+    RECLOG::LatencyHistogram stat_histograms[static_cast<size_t>(RECLOG::LatencyId::COUNT)];
+    std::atomic_size_t stat_queued{0};
+    std::atomic_size_t stat_queued_peak{0};
+
+    // the value at quantile q, the top of its bucket but never above the largest seen.
+    double quantile(const uint64_t *buckets, uint64_t count, uint64_t max, double q)
+    {
+        auto rank = static_cast<uint64_t>(q * static_cast<double>(count - 1)) + 1;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < RECLOG::REC_HIST_BUCKETS; ++i)
+        {
+            seen += buckets[i];
+            if (seen >= rank)
+            {
+                return static_cast<double>(std::min(RECLOG::LatencyHistogram::Upper(i), max));
+            }
+        }
+        return static_cast<double>(max);
+    }
+}
+
+RECLOG::LatencyStats RECLOG::LatencyHistogram::Snapshot(double ns_per_tick) const
+{
+    uint64_t buckets[REC_HIST_BUCKETS] = {};
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    uint64_t max = 0;
+    for (auto &shard : m_shards)
+    {
+        for (size_t i = 0; i < REC_HIST_BUCKETS; ++i)
+        {
+            auto n = shard.buckets[i].load(std::memory_order_relaxed);
+            buckets[i] += n;
+            count += n;
+        }
+        sum += shard.sum.load(std::memory_order_relaxed);
+        max = std::max(max, shard.max.load(std::memory_order_relaxed));
+    }
+    LatencyStats st;
+    if (count == 0)
+    {
+        return st;
+    }
+    st.count = count;
+    st.mean = static_cast<double>(sum) / static_cast<double>(count) * ns_per_tick;
+    st.p50 = quantile(buckets, count, max, 0.5) * ns_per_tick;
+    st.p90 = quantile(buckets, count, max, 0.9) * ns_per_tick;
+    st.p99 = quantile(buckets, count, max, 0.99) * ns_per_tick;
+    st.p999 = quantile(buckets, count, max, 0.999) * ns_per_tick;
+    st.max = static_cast<double>(max) * ns_per_tick;
+    return st;
+}
+
+RECLOG::StatCounter *RECLOG::StatRegistry::Counters()
+{
+    return stat_counters;
+}
+
+RECLOG::LatencyHistogram *RECLOG::StatRegistry::Histograms()
+{
+    return stat_histograms;
+}
+
+void RECLOG::StatRegistry::Queued(size_t bytes)
+{
+    stat_queued.store(bytes, std::memory_order_relaxed);
+    if (bytes > stat_queued_peak.load(std::memory_order_relaxed))
+    {
+        stat_queued_peak.store(bytes, std::memory_order_relaxed);
+    }
+}
+
+RECLOG::RecStats RECLOG::StatRegistry::Snapshot()
+{
+    auto count = [](StatId id)
+    { return stat_counters[static_cast<size_t>(id)].Load(); };
+    auto ns_per_tick = Clock::Current().ns_per_tick;
+    auto latency = [ns_per_tick](LatencyId id)
+    { return stat_histograms[static_cast<size_t>(id)].Snapshot(ns_per_tick); };
+    RecStats st;
+    st.records = count(StatId::RECORDS);
+    st.bytes = count(StatId::BYTES);
+    st.written = count(StatId::WRITTEN);
+    st.rotations = count(StatId::ROTATIONS);
+    st.compressions = count(StatId::COMPRESSIONS);
+    st.syncs = count(StatId::SYNCS);
+    st.queued = stat_queued.load(std::memory_order_relaxed);
+    st.queued_peak = stat_queued_peak.load(std::memory_order_relaxed);
+    st.enqueue = latency(LatencyId::ENQUEUE);
+    st.write = latency(LatencyId::WRITE);
+    st.sync = latency(LatencyId::SYNC);
+    st.rotate = latency(LatencyId::ROTATE);
+    st.compress = latency(LatencyId::COMPRESS);
+    return st;
+}
@@ -0,0 +1,58 @@
+#include "reclog.h"
+#include "reclog_impl.h"
+#include <vector>
+
+namespace
+{
+    std::atomic<uint32_t> thread_count{0};
+    thread_local RECLOG::ThreadContext thread_context = {0, {0}, nullptr, false};
+
+    std::mutex name_lock;
+    std::vector<RECLOG::ThreadRegistry::Entry> thread_names;
+    std::atomic<uint32_t> name_count{0};
+}
+
+const RECLOG::ThreadContext &RECLOG::ThisThread()
+{
+    auto &ctx = thread_context;
+    if (ctx.index == 0)
+    {
+        ctx.index = thread_count.fetch_add(1, std::memory_order_relaxed) + 1;
+        print_thread_name(ctx.index, ctx.text, REC_THREADNAME_WIDTH + 1, true);
+    }
+    return ctx;
+}
+
+void RECLOG::ThreadRegistry::SetName(const char *name)
+{
+    auto index = ThisThread().index;
+    // the column keeps its width, readers get the full name.
+    snprintf(thread_context.text, REC_THREADNAME_WIDTH + 1, "%s", name);
+    std::lock_guard<std::mutex> lock(name_lock);
+    thread_names.push_back(Entry{index, name});
+    name_count.store(static_cast<uint32_t>(thread_names.size()), std::memory_order_release);
+}
+
+uint32_t RECLOG::ThreadRegistry::Size()
+{
+    return name_count.load(std::memory_order_acquire);
+}
+
+RECLOG::ThreadRegistry::Entry RECLOG::ThreadRegistry::At(uint32_t n)
+{
+    std::lock_guard<std::mutex> lock(name_lock);
+    return n < thread_names.size() ? thread_names[n] : Entry{0, std::string()};
+}
+
+std::string RECLOG::ThreadRegistry::Name(uint32_t index)
+{
+    std::lock_guard<std::mutex> lock(name_lock);
+    for (auto iter = thread_names.rbegin(); iter != thread_names.rend(); ++iter)
+    {
+        if (iter->index == index)
+        {
+            return iter->name;
+        }
+    }
+    return std::string();
+}
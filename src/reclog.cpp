@@ -1,11 +1,20 @@
 #include "reclog.h"
 #include "reclog_impl.h"
+#include "decoder.h"
+#include "log_backend.h"
+#include "rec_crash.h"
+#include "rec_shm.h"
+#include "rec_stats.h"
+#include <algorithm>
 #include <fstream>
 #include <chrono>
 
+#ifdef __linux__
+#include <fcntl.h>    // for fallocate
+#include <sys/mman.h> // for mmap
+#include <sys/uio.h>  // for writev
+#endif
 #if __GNUC__
-#include <cxxabi.h>   // for __cxa_demangle
-#include <dlfcn.h>    // for dladdr
 #include <execinfo.h> // for backtrace
 #include <signal.h>   // for catch signals
 #include <unistd.h>   // for getpid
@@ -13,6 +22,8 @@
 
 long long RECLOG::RECONFIG::start_time{0};
 bool RECLOG::RECONFIG::g_compress{false};
+RECLOG::RECOPTION RECLOG::RECONFIG::g_option;
+std::atomic_int RECLOG::RECONFIG::g_verbosity{RECLOG_MAX_VERBOSITY};
 RECLOG::FilePtr RECLOG::RECONFIG::screenfile{new FileBase()};
 FunctionPool RECLOG::RECONFIG::g_copool(2);
 FunctionPool RECLOG::RECONFIG::g_expool(1);
@@ -22,73 +33,404 @@ RECLOG::DiskFileCluster RECLOG::RECONFIG::g_flist_log("", RECLOG::CodeType::LOG)
 
 std::once_flag RECInitFlag;
 
+namespace
+{
+    // two digits per byte, one lookup instead of a printf each.
+    struct HexTable
+    {
+        char pairs[512];
+        HexTable()
+        {
+            for (int i = 0; i < 256; ++i)
+            {
+                pairs[2 * i] = "0123456789ABCDEF"[i >> 4];
+                pairs[2 * i + 1] = "0123456789ABCDEF"[i & 0xF];
+            }
+        }
+    };
+    const HexTable hex_table;
+
+    class BufferInput : public cborio::input
+    {
+    public:
+        BufferInput(const unsigned char *data, size_t len) : m_ptr(data), m_end(data + len) {}
+        bool has_bytes(int count) override
+        {
+            return count >= 0 && static_cast<size_t>(count) <= static_cast<size_t>(m_end - m_ptr);
+        }
+        unsigned char get_byte() override
+        {
+            return *m_ptr++;
+        }
+        void get_bytes(void *to, int count) override
+        {
+            memcpy(to, m_ptr, count);
+            m_ptr += count;
+        }
+        // the decoder stops quietly at an item cut short.
+        bool Done() const
+        {
+            return m_ptr == m_end;
+        }
+
+    private:
+        const unsigned char *m_ptr;
+        const unsigned char *m_end;
+    };
+
+    // one line of diagnostic notation per record, e.g. "name" 1.5 [1, 2] {"x": 3}.
+    class CborText : public cborio::CBORIOHandler
+    {
+    public:
+        explicit CborText(std::string &out) : m_out(out) {}
+
+        void on_integer(int value) override
+        {
+            if (m_ticks && value >= 0)
+            {
+                on_extra_integer(static_cast<unsigned long long>(value), 1);
+                return;
+            }
+            Value(std::to_string(value));
+        }
+        void on_extra_integer(unsigned long long value, int sign) override
+        {
+            if (m_ticks && sign >= 0)
+            {
+                // the stamp of a record, shown as wall nanoseconds like the other outputs.
+                m_ticks = false;
+                Value(std::to_string(RECLOG::Clock::ToNanos(value)));
+                return;
+            }
+            Value(sign < 0 ? "-" + std::to_string(value) : std::to_string(value));
+        }
+        void on_float(float value) override
+        {
+            on_double(value);
+        }
+        void on_double(double value) override
+        {
+            char buf[32];
+            snprintf(buf, sizeof(buf), "%.17g", value);
+            Value(buf);
+        }
+        void on_bytes(unsigned char *data, size_t size) override
+        {
+            std::string text("h'");
+            for (size_t i = 0; i < size; ++i)
+            {
+                text.append(hex_table.pairs + 2 * data[i], 2);
+            }
+            Value(text + "'");
+        }
+        void on_string(std::string &str) override
+        {
+            Value('"' + str + '"');
+        }
+        void on_array(int size) override
+        {
+            Open('[', size);
+        }
+        void on_map(int size) override
+        {
+            Open('{', 2 * size);
+        }
+        void on_tag(unsigned int tag) override
+        {
+            if (tag == RECLOG::REC_TICKS_TAG)
+            {
+                m_ticks = true;
+                return;
+            }
+            Prefix();
+            m_out += std::to_string(tag);
+            m_nest.push_back({'(', 1, true});
+        }
+        void on_extra_tag(unsigned long long tag) override
+        {
+            on_tag(static_cast<unsigned int>(tag));
+        }
+        void on_special(unsigned int code) override
+        {
+            Value("simple(" + std::to_string(code) + ")");
+        }
+        void on_bool(bool value) override
+        {
+            Value(value ? "true" : "false");
+        }
+        void on_null() override
+        {
+            Value("null");
+        }
+        void on_undefined() override
+        {
+            Value("undefined");
+        }
+        void on_error(const char *) override
+        {
+            m_failed = true;
+        }
+
+        bool Failed() const
+        {
+            return m_failed || !m_nest.empty();
+        }
+
+    private:
+        struct Nest
+        {
+            char open;
+            int left;
+            bool first;
+        };
+
+        std::string &m_out;
+        std::vector<Nest> m_nest;
+        bool m_top = true;
+        bool m_failed = false;
+        // the next integer is a REC_TICKS_TAG stamp.
+        bool m_ticks = false;
+
+        void Prefix()
+        {
+            m_ticks = false;
+            if (m_nest.empty())
+            {
+                m_out += m_top ? "" : " ";
+                m_top = false;
+                return;
+            }
+            auto &nest = m_nest.back();
+            if (!nest.first)
+            {
+                m_out += nest.open == '{' && nest.left % 2 == 1 ? ": " : ", ";
+            }
+            nest.first = false;
+        }
+
+        void Open(char open, int items)
+        {
+            Prefix();
+            m_out += open;
+            m_nest.push_back({open, items, true});
+            Close();
+        }
+
+        void Value(const std::string &text)
+        {
+            Prefix();
+            m_out += text;
+            if (!m_nest.empty())
+            {
+                --m_nest.back().left;
+            }
+            Close();
+        }
+
+        // a finished container counts as one item of the one around it.
+        void Close()
+        {
+            while (!m_nest.empty() && m_nest.back().left == 0)
+            {
+                auto open = m_nest.back().open;
+                m_out += open == '[' ? ']' : open == '{' ? '}' : ')';
+                m_nest.pop_back();
+                if (!m_nest.empty())
+                {
+                    --m_nest.back().left;
+                }
+            }
+        }
+    };
+}
+
+// the writer fills the buffer and empties it with a single write per batch.
 class FileScreen : public RECLOG::FileBase
 {
 public:
+    ~FileScreen()
+    {
+        Flush();
+    }
+
     size_t WriteData(const void *src, size_t ele, size_t len) override
     {
+        auto data = static_cast<const unsigned char *>(src);
+        std::lock_guard<std::mutex> lock(m_lock);
         for (size_t i = 0; i < ele * len; ++i)
         {
-            printf("%02X", *((char *)src + i));
+            if (m_len + 2 > sizeof(m_buf))
+            {
+                Drain();
+            }
+            memcpy(m_buf + m_len, hex_table.pairs + 2 * data[i], 2);
+            m_len += 2;
         }
-        printf("\n");
-        fflush(stdout);
+        Put("\n", 1);
         return ele * len;
     }
-    
+
     size_t WriteData(const std::string &str) override
     {
-        return fprintf(stdout, "%s\n", str.c_str());
+        std::lock_guard<std::mutex> lock(m_lock);
+        Put(str.data(), str.size());
+        Put("\n", 1);
+        return str.size() + 1;
     };
-    
+
     size_t WriteData(const cborio::ustring &str) override
     {
-        for (auto iter = str.cbegin(); iter != str.cend(); ++iter)
+        return WriteData(str.data(), sizeof(unsigned char), str.size());
+    }
+
+    void Flush() override
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        Drain();
+    }
+
+private:
+    std::mutex m_lock;
+    size_t m_len = 0;
+    char m_buf[REC_SCREEN_BUFFER];
+
+    void Put(const char *src, size_t len)
+    {
+        while (len != 0)
+        {
+            if (m_len == sizeof(m_buf))
+            {
+                Drain();
+            }
+            auto n = std::min(len, sizeof(m_buf) - m_len);
+            memcpy(m_buf + m_len, src, n);
+            m_len += n;
+            src += n;
+            len -= n;
+        }
+    }
+
+    void Drain()
+    {
+        // whatever the program printed itself goes first.
+        fflush(stdout);
+#if __GNUC__
+        size_t done = 0;
+        while (done < m_len)
         {
-            printf("%02X", *iter);
+            auto n = write(STDOUT_FILENO, m_buf + done, m_len - done);
+            if (n <= 0)
+            {
+                break;
+            }
+            done += static_cast<size_t>(n);
         }
-        printf("\n");
+#else
+        fwrite(m_buf, 1, m_len, stdout);
         fflush(stdout);
-        return str.size();
+#endif
+        m_len = 0;
     }
 };
 
-class FileDisk : public RECLOG::FileBase
+// what happens to a file on disk once it is closed, shared by the disk sinks.
+class FileNamed : public RECLOG::FileBase
 {
 public:
-    FileDisk(const std::string &filename)
+    FileNamed(const std::string &filename, bool spare)
+        : m_tempfile(true), m_spare(spare), m_filename(filename) {}
+
+    void Mark(bool temp) override
+    {
+        m_tempfile = temp;
+    }
+
+    // a file opened ahead of time takes its real name once it becomes current.
+    void Publish(const std::string &filename)
+    {
+        m_spare = false;
+        if (rename(m_filename.c_str(), filename.c_str()) == 0)
+        {
+            m_filename = filename;
+        }
+    }
+
+protected:
+    void Closed()
     {
-        m_tempfile = true;
-        m_filename = filename;
+        if (m_spare)
+        {
+            // opened ahead but never used.
+            remove(m_filename.c_str());
+        }
+        else if (RECLOG::RECONFIG::g_compress)
+        {
+            RECLOG::RECONFIG::g_copool.post_low(
+                [](std::string str)
+                {
+                    auto start = RECLOG::Clock::Ticks();
+                    std::ifstream ifs(str, std::ios_base::binary);
+                    std::ofstream ofs(str + ".cpr", std::ios_base::binary);
+                    cborio::compress(ifs, ofs);
+                    ifs.close();
+                    ofs.close();
+                    remove(str.c_str());
+                    RECLOG::StatRegistry::Latency(RECLOG::LatencyId::COMPRESS, start);
+                    RECLOG::StatRegistry::Count(RECLOG::StatId::COMPRESSIONS);
+                },
+                m_filename);
+        }
+        else
+        {
+            if (m_tempfile)
+            {
+                remove(m_filename.c_str());
+            }
+        }
+    }
+
+private:
+    bool m_tempfile;
+    bool m_spare;
+    std::string m_filename;
+};
+
+class FileDisk : public FileNamed
+{
+public:
+    FileDisk(const std::string &filename, size_t reserve = 0, bool spare = false)
+        : FileNamed(filename, spare)
+    {
+        m_reserved = false;
         m_fp = fopen(filename.c_str(), "wb");
+#ifdef __linux__
+        // blocks are taken now, appends later do not have to find them.
+        if (m_fp != nullptr && reserve != 0)
+        {
+            m_reserved = fallocate(fileno(m_fp), FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(reserve)) == 0;
+        }
+#else
+        (void)reserve;
+#endif
     };
 
     ~FileDisk()
     {
-        if (m_fp != nullptr && fclose(m_fp) == 0)
+#ifdef __linux__
+        if (m_fp != nullptr && m_reserved && fflush(m_fp) == 0)
         {
-            if (RECLOG::RECONFIG::g_compress)
+            // give back what was reserved past the end.
+            auto size = ftell(m_fp);
+            if (size >= 0 && ftruncate(fileno(m_fp), static_cast<off_t>(size)) != 0)
             {
-                RECLOG::RECONFIG::g_copool.post(
-                    [](std::string str)
-                    {
-                        std::ifstream ifs(str, std::ios_base::binary);
-                        std::ofstream ofs(str + ".cpr", std::ios_base::binary);
-                        cborio::compress(ifs, ofs);
-                        ifs.close();
-                        ofs.close();
-                        remove(str.c_str());
-                    },
-                    m_filename);
-            }
-            else
-            {
-                if (m_tempfile)
-                {
-                    remove(m_filename.c_str());
-                }
+                m_reserved = false;
             }
         }
+#endif
+        if (m_fp != nullptr && fclose(m_fp) == 0)
+        {
+            Closed();
+        }
     };
 
     size_t WriteData(const void *src, size_t ele_size, size_t len) override
@@ -106,69 +448,293 @@ public:
         return m_fp == nullptr ? 0 : fwrite(ustr.data(), sizeof(unsigned char), ustr.size(), m_fp);
     }
 
-    void Mark(bool temp) override
+    void Flush() override
     {
-        m_tempfile = temp;
+        if (m_fp != nullptr)
+        {
+            fflush(m_fp);
+        }
+    }
+
+#ifdef __linux__
+    size_t WriteBatch(const RECLOG::IoSpan *spans, size_t count) override
+    {
+        // whatever went through stdio goes first, the batch follows in as few syscalls as the kernel allows.
+        if (m_fp == nullptr || fflush(m_fp) != 0)
+        {
+            return 0;
+        }
+        iovec iov[RECLOG::REC_MAX_IOV];
+        size_t bytes = 0;
+        while (count != 0)
+        {
+            auto n = std::min(count, RECLOG::REC_MAX_IOV);
+            size_t total = 0;
+            for (size_t i = 0; i < n; ++i)
+            {
+                iov[i].iov_base = const_cast<void *>(spans[i].data);
+                iov[i].iov_len = spans[i].len;
+                total += spans[i].len;
+            }
+            auto first = iov;
+            auto left = n;
+            auto pending = total;
+            while (pending != 0)
+            {
+                auto ret = writev(fileno(m_fp), first, static_cast<int>(left));
+                if (ret < 0)
+                {
+                    if (errno == EINTR)
+                    {
+                        continue;
+                    }
+                    return bytes + (total - pending);
+                }
+                // short write, resume where the kernel stopped.
+                auto done = static_cast<size_t>(ret);
+                pending -= done;
+                while (left != 0 && done >= first->iov_len)
+                {
+                    done -= first->iov_len;
+                    ++first;
+                    --left;
+                }
+                if (left != 0)
+                {
+                    first->iov_base = static_cast<char *>(first->iov_base) + done;
+                    first->iov_len -= done;
+                }
+            }
+            bytes += total;
+            spans += n;
+            count -= n;
+        }
+        return bytes;
     }
 
+    void Sync() override
+    {
+        if (m_fp != nullptr && fflush(m_fp) == 0)
+        {
+            fdatasync(fileno(m_fp));
+        }
+    }
+#endif
+
 private:
-    bool m_tempfile;
+    bool m_reserved;
     FILE *m_fp;
-    std::string m_filename;
 };
 
-#if __GNUC__
-
-std::string
-stacktrace_as_stdstring(void **callstack, int num_frames, int skip)
+#ifdef __linux__
+// writes land in a shared mapping, any number of threads append without a lock.
+class FileMapped : public FileNamed
 {
-    const auto max_frames = 128;
-    char **symbols = backtrace_symbols(callstack, num_frames);
+public:
+    FileMapped(const std::string &filename, size_t reserve = 0, bool spare = false)
+        : FileNamed(filename, spare), m_base(nullptr), m_mapsize(0), m_offset(0), m_filelen(0)
+    {
+        m_fd = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (m_fd < 0)
+        {
+            return;
+        }
+        // address space for the whole file up front, so the mapping never moves under a writer.
+        m_mapsize = (std::max(reserve, REC_MAP_CHUNK) * 2 + REC_MAP_CHUNK - 1) / REC_MAP_CHUNK * REC_MAP_CHUNK;
+        auto base = mmap(nullptr, m_mapsize, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+        m_base = base == MAP_FAILED ? nullptr : static_cast<unsigned char *>(base);
+        Grow(std::max(reserve, REC_MAP_CHUNK));
+    }
+
+    ~FileMapped()
+    {
+        if (m_fd < 0)
+        {
+            return;
+        }
+        if (m_base != nullptr)
+        {
+            munmap(m_base, m_mapsize);
+        }
+        // the file was grown in chunks, cut it back to what was written.
+        if (ftruncate(m_fd, static_cast<off_t>(m_offset.load())) == 0 && close(m_fd) == 0)
+        {
+            Closed();
+        }
+    }
+
+    size_t WriteData(const void *src, size_t ele_size, size_t len) override
+    {
+        auto bytes = ele_size * len;
+        size_t offset = 0;
+        unsigned char *dst = nullptr;
+        if (!Reserve(bytes, offset, dst))
+        {
+            return 0;
+        }
+        if (dst != nullptr)
+        {
+            memcpy(dst, src, bytes);
+            return bytes;
+        }
+        // past the mapped range, still lock free.
+        if (!Put(src, bytes, offset))
+        {
+            Unreserve(offset, bytes);
+            return 0;
+        }
+        return bytes;
+    }
 
-    std::string result;
-    // Print stack traces so the most relevant ones are written last
-    // Rationale: http://yellerapp.com/posts/2015-01-22-upside-down-stacktraces.html
-    for (int i = num_frames - 1; i >= skip; --i)
+    size_t WriteBatch(const RECLOG::IoSpan *spans, size_t count) override
     {
-        char buf[1024];
-        Dl_info info;
-        if (dladdr(callstack[i], &info) && info.dli_sname)
+        size_t bytes = 0;
+        for (size_t i = 0; i < count; ++i)
         {
-            char *demangled = NULL;
-            int status = -1;
-            if (info.dli_sname[0] == '_')
+            bytes += spans[i].len;
+        }
+        // one reservation for the whole batch, mapped or not.
+        size_t offset = 0;
+        unsigned char *dst = nullptr;
+        if (!Reserve(bytes, offset, dst))
+        {
+            return 0;
+        }
+        size_t done = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (dst != nullptr)
             {
-                demangled = abi::__cxa_demangle(info.dli_sname, 0, 0, &status);
+                memcpy(dst + done, spans[i].data, spans[i].len);
             }
-            snprintf(buf, sizeof(buf), "%-3d %*p %s + %zd\n",
-                     i - skip, int(2 + sizeof(void *) * 2), callstack[i],
-                     status == 0 ? demangled : info.dli_sname == 0 ? symbols[i]
-                                                                   : info.dli_sname,
-                     static_cast<char *>(callstack[i]) - static_cast<char *>(info.dli_saddr));
-            free(demangled);
+            else if (!Put(spans[i].data, spans[i].len, offset + done))
+            {
+                Unreserve(offset, bytes);
+                return 0;
+            }
+            done += spans[i].len;
         }
-        else
+        return bytes;
+    }
+
+    void Sync() override
+    {
+        if (m_fd >= 0)
         {
-            snprintf(buf, sizeof(buf), "%-3d %*p %s\n",
-                     i - skip, int(2 + sizeof(void *) * 2), callstack[i], symbols[i]);
+            // dirty pages of a shared mapping belong to the file, fdatasync writes them.
+            fdatasync(m_fd);
         }
-        result += buf;
     }
-    free(symbols);
 
-    if (num_frames == max_frames)
+    size_t WriteData(const std::string &str) override
+    {
+        return WriteData(str.data(), sizeof(char), str.size());
+    }
+
+    size_t WriteData(const cborio::ustring &ustr) override
     {
-        result = "[truncated]\n" + result;
+        return WriteData(ustr.data(), sizeof(unsigned char), ustr.size());
+    }
+
+private:
+    int m_fd;
+    unsigned char *m_base;
+    size_t m_mapsize;
+    std::atomic_size_t m_offset;
+    std::atomic_size_t m_filelen;
+    std::mutex m_grow;
+
+    // claims bytes at offset, dst is where they go in the mapping or nullptr for pwrite.
+    // false if the file could not grow, nothing is claimed then and the file has no gap.
+    bool Reserve(size_t bytes, size_t &offset, unsigned char *&dst)
+    {
+        if (m_fd < 0 || bytes == 0)
+        {
+            return false;
+        }
+        offset = m_offset.load(std::memory_order_relaxed);
+        do
+        {
+            // blocks first, a claim is only published once the disk has room for it.
+            if (!Grow(offset + bytes))
+            {
+                return false;
+            }
+        } while (!m_offset.compare_exchange_weak(offset, offset + bytes, std::memory_order_relaxed));
+        dst = m_base != nullptr && offset + bytes <= m_mapsize ? m_base + offset : nullptr;
+        return true;
     }
 
-    if (!result.empty() && result[result.size() - 1] == '\n')
+    // gives a failed claim back, possible as long as nobody claimed after it.
+    void Unreserve(size_t offset, size_t bytes)
     {
-        result.resize(result.size() - 1);
+        auto end = offset + bytes;
+        m_offset.compare_exchange_strong(end, offset, std::memory_order_relaxed);
     }
 
-    return result;
+    bool Put(const void *src, size_t bytes, size_t offset)
+    {
+        auto ptr = static_cast<const char *>(src);
+        while (bytes != 0)
+        {
+            auto ret = pwrite(m_fd, ptr, bytes, static_cast<off_t>(offset));
+            if (ret < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (ret <= 0)
+            {
+                return false;
+            }
+            ptr += ret;
+            offset += static_cast<size_t>(ret);
+            bytes -= static_cast<size_t>(ret);
+        }
+        return true;
+    }
+
+    bool Grow(size_t end)
+    {
+        if (end <= m_filelen.load(std::memory_order_acquire))
+        {
+            return true;
+        }
+        std::lock_guard<std::mutex> lock(m_grow);
+        auto len = m_filelen.load(std::memory_order_relaxed);
+        if (end <= len)
+        {
+            return true;
+        }
+        len = (end + REC_MAP_CHUNK - 1) / REC_MAP_CHUNK * REC_MAP_CHUNK;
+        // real blocks behind every mapped page, a full disk fails here instead of raising SIGBUS.
+        if (posix_fallocate(m_fd, 0, static_cast<off_t>(len)) != 0)
+        {
+            return false;
+        }
+        m_filelen.store(len, std::memory_order_release);
+        return true;
+    }
+};
+#endif
+
+namespace
+{
+    std::shared_ptr<FileNamed> open_file(const std::string &filename, bool mapped, size_t reserve = 0, bool spare = false)
+    {
+#ifdef __linux__
+        if (mapped)
+        {
+            return std::make_shared<FileMapped>(filename, reserve, spare);
+        }
+#else
+        (void)mapped;
+#endif
+        return std::make_shared<FileDisk>(filename, reserve, spare);
+    }
 }
 
+#if __GNUC__
+
 void call_default_signal_handler(int signal_number)
 {
     struct sigaction sig_action;
@@ -221,29 +787,26 @@ void signal_handler(int signal_number, siginfo_t *, void *)
     //      WARNING: FROM NOW ANY OPERATIONS IN USR SPACE IS NOT SAFE
     // --------------------------------------------------------------------
 
+    // only write(2) on the preopened crash file, crashsym symbolizes it later.
     void *callstack[128];
     const auto max_frames = sizeof(callstack) / sizeof(callstack[0]);
     int num_frames = backtrace(callstack, max_frames);
-    // guaranteed on most situations.
-    char err_file[32] = {0};
-    snprintf(err_file, 32, "%d.crash", getpid());
-    FILE *err_fd = fopen(err_file, "w");
-    backtrace_symbols_fd(callstack, num_frames, fileno(err_fd));
-    // guaranteed on most situations.
-    auto err_pretty_message = stacktrace_as_stdstring(callstack, num_frames, 0);
-    fprintf(err_fd, "%s", "********Readable MSGS:\n");
-    fprintf(err_fd, "%s", err_pretty_message.c_str());
-    // guaranteed on many situations.
-    RECLOG(STR) << "REC caught a signal: " << signal_name << "\n"
-                << err_pretty_message;
-    // guaranteed on some situations.
-    fclose(err_fd);
-    // fprintf(stderr, "%s", stacktrace_as_stdstring(0).c_str());
+    RECLOG::CrashRing::Dump(signal_number, signal_name, callstack, num_frames);
     call_default_signal_handler(signal_number);
 }
 
 void install_signal_handlers()
 {
+    // backtrace loads libgcc on first use, which must not happen in the handler.
+    void *warmup[1];
+    backtrace(warmup, 1);
+    char crash_file[32] = {0};
+    snprintf(crash_file, sizeof(crash_file), "%d.crash", getpid());
+    if (!RECLOG::CrashRing::Open(crash_file))
+    {
+        RECLOG(STR) << "Failed to open " << crash_file << ", crashes go to stderr";
+    }
+
     struct sigaction sig_action;
     memset(&sig_action, 0, sizeof(sig_action));
     sigemptyset(&sig_action.sa_mask);
@@ -281,49 +844,314 @@ void install_signal_handlers()
 }
 #endif
 
-std::string RECLOG::DiskFileCluster::GetCurFileName()
+RECLOG::FileBase RECLOG::FileHandle::closed;
+
+struct RECLOG::PreparedFile
+{
+    std::mutex lock;
+    std::shared_ptr<FileNamed> file;
+    bool pending = false;
+};
+
+RECLOG::DiskFileCluster::DiskFileCluster(const char *rootname, CodeType ftype)
+    : m_ftype(ftype), m_rootname(rootname), m_filesize(0), m_dropped(0), m_opened(0),
+      m_maxsize(REC_MAX_FILESIZE), m_maxnum(REC_MAX_FILENUM), m_period(0), m_budget(0), m_prealloc(true), m_mapped(false), m_durable(false),
+      m_gen(0), m_oldest(1), m_prepared(std::make_shared<PreparedFile>())
+{
+}
+
+void RECLOG::DiskFileCluster::SetPolicy(const RECOPTION &option)
+{
+    m_maxsize = option.max_filesize;
+    // the slot being replaced must never be the current one.
+    m_maxnum = std::max<size_t>(option.max_filenum, 2);
+    m_period = option.rotate_seconds * 1000LL;
+    m_budget = option.disk_budget;
+    m_prealloc = option.preallocate;
+    m_mapped = option.mapped;
+    m_durable = option.fsync_ms != 0 || option.fsync_bytes != 0;
+}
+
+std::string RECLOG::DiskFileCluster::GetExtension() const
 {
-    std::string filename = m_rootname + print_date_time(get_date_time());
     switch (m_ftype)
     {
     case CodeType::CBOR:
-        filename += ".cbor";
-        break;
+        return ".cbor";
     case CodeType::LOG:
-        filename += ".log";
-        break;
+        return ".log";
     case CodeType::RAW:
-        filename += ".dat";
-        break;
+        return ".dat";
     default:
-        break;
+        return "";
     };
-    return filename;
 }
 
-RECLOG::FilePtr &RECLOG::DiskFileCluster::GetCurFileFp()
+std::string RECLOG::DiskFileCluster::GetCurFileName()
+{
+    std::string filename = m_rootname + print_date_time(get_date_time());
+    // rotating twice within a millisecond must not truncate the file just retired.
+    if (m_lastname.compare(0, filename.size(), filename) == 0)
+    {
+        filename += "-" + std::to_string(m_gen.load());
+    }
+    m_lastname = filename;
+    return filename + GetExtension();
+}
+
+void RECLOG::DiskFileCluster::Prepare()
 {
-    std::call_once(m_fg, [&]()
-                   { m_filelist.push(std::move(std::make_shared<FileDisk>(GetCurFileName()))); });
-    size_t old_value = m_filesize.load();
-    bool size_reset = false;
-    do
     {
-        if (old_value < REC_MAX_FILESIZE)
+        std::lock_guard<std::mutex> lock(m_prepared->lock);
+        if (m_prepared->pending || m_prepared->file)
         {
-            break;
+            return;
         }
-        size_reset = m_filesize.compare_exchange_weak(old_value, 0);
-        if (size_reset)
+        m_prepared->pending = true;
+    }
+    auto name = m_rootname + ".next" + std::to_string(m_gen.load()) + GetExtension();
+    // a mapped file sizes its mapping after it, preallocated or not.
+    auto reserve = m_prealloc || m_mapped ? m_maxsize : 0;
+    auto prepared = m_prepared;
+    auto mapped = m_mapped;
+    // shares nothing with the cluster but the hand-over point, it may outlive the cluster.
+    RECONFIG::g_copool.post([prepared, name, reserve, mapped]()
+                            {
+                                auto file = open_file(name, mapped, reserve, true);
+                                std::lock_guard<std::mutex> lock(prepared->lock);
+                                prepared->file = file;
+                                prepared->pending = false; });
+}
+
+void RECLOG::DiskFileCluster::Retire(FileSlot &slot)
+{
+    // writers pinned it while it was current, they have to leave first.
+    while (slot.writers.load() != 0)
+    {
+        std::this_thread::yield();
+    }
+    // closing does not sync, what was written to it has to reach the disk first.
+    SyncRetired(slot);
+    FilePtr evicted;
+    evicted.swap(slot.file);
+    if (evicted)
+    {
+        // fclose and a possible compression job stay off the writer.
+        RECONFIG::g_copool.post([](FilePtr &fp)
+                                { fp.reset(); },
+                                std::move(evicted));
+    }
+}
+
+void RECLOG::DiskFileCluster::SyncRetired(FileSlot &slot)
+{
+    if (slot.synced || !slot.file)
+    {
+        return;
+    }
+    while (slot.writers.load() != 0)
+    {
+        std::this_thread::yield();
+    }
+    slot.file->Sync();
+    slot.synced = true;
+    StatRegistry::Count(StatId::SYNCS);
+}
+
+void RECLOG::DiskFileCluster::Sync()
+{
+    if (FileNo() == 0)
+    {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_rotate);
+        for (size_t i = 0; i < m_maxnum; ++i)
         {
-            m_filelist.push(std::move(std::make_shared<FileDisk>(GetCurFileName())));
-            if (m_filelist.size() > REC_MAX_FILENUM)
+            SyncRetired(m_slots[i]);
+        }
+    }
+    GetCurFileFp()->Sync();
+}
+
+void RECLOG::DiskFileCluster::Rotate(size_t retired_bytes)
+{
+    // waiting for another rotation counts, a writer stalls on it all the same.
+    auto start = Clock::Ticks();
+    std::lock_guard<std::mutex> lock(m_rotate);
+    auto name = GetCurFileName();
+    std::shared_ptr<FileNamed> next;
+    {
+        std::lock_guard<std::mutex> plock(m_prepared->lock);
+        next.swap(m_prepared->file);
+    }
+    if (next)
+    {
+        next->Publish(name);
+    }
+    else
+    {
+        // first file, or the background open has not finished yet.
+        next = open_file(name, m_mapped, m_mapped ? m_maxsize : 0);
+    }
+    auto gen = m_gen.load() + 1;
+    if (gen > 1)
+    {
+        m_slots[(gen - 1) % m_maxnum].bytes = retired_bytes;
+    }
+    auto &slot = m_slots[gen % m_maxnum];
+    Retire(slot);
+    if (gen > m_maxnum)
+    {
+        m_oldest = std::max(m_oldest, gen - m_maxnum + 1);
+    }
+    // retired, nobody holds the slot until the new generation is published.
+    slot.header.Reset();
+    slot.file = next;
+    slot.gen = gen;
+    slot.bytes = 0;
+    slot.synced = true;
+    m_opened.store(get_date_time());
+    m_gen.store(gen);
+    if (gen > 1)
+    {
+        // the next Sync or its eviction catches up, durable clusters do it right away.
+        auto &retired = m_slots[(gen - 1) % m_maxnum];
+        retired.synced = false;
+        if (m_durable)
+        {
+            SyncRetired(retired);
+        }
+    }
+    if (m_budget != 0)
+    {
+        size_t kept = 0;
+        for (auto i = m_oldest; i < gen; ++i)
+        {
+            kept += m_slots[i % m_maxnum].bytes;
+        }
+        while (kept > m_budget && m_oldest < gen)
+        {
+            auto &oldest = m_slots[m_oldest % m_maxnum];
+            kept -= oldest.bytes;
+            Retire(oldest);
+            ++m_oldest;
+        }
+    }
+    Prepare();
+    if (gen > 1)
+    {
+        StatRegistry::Count(StatId::ROTATIONS);
+    }
+    StatRegistry::Latency(LatencyId::ROTATE, start);
+}
+
+RECLOG::FileHandle RECLOG::DiskFileCluster::GetCurFileFp()
+{
+    std::call_once(m_fg, [this]()
+                   {
+                       m_slots.reset(new FileSlot[m_maxnum]);
+                       if (m_transport)
+                       {
+                           m_slots[1].file = m_transport;
+                           m_slots[1].gen = 1;
+                           m_gen.store(1);
+                       }
+                       else
+                       {
+                           Rotate(0);
+                       } });
+    size_t old_value = m_filesize.load(std::memory_order_relaxed);
+    if (m_maxsize != 0 && old_value >= m_maxsize && m_filesize.compare_exchange_strong(old_value, 0))
+    {
+        // whoever resets the size rotates, everyone else keeps writing the current file.
+        Rotate(old_value);
+    }
+    else if (m_period != 0)
+    {
+        auto opened = m_opened.load(std::memory_order_relaxed);
+        auto now = get_date_time();
+        if (now - opened >= m_period && m_opened.compare_exchange_strong(opened, now))
+        {
+            Rotate(m_filesize.exchange(0));
+        }
+    }
+    while (true)
+    {
+        auto gen = m_gen.load();
+        auto &slot = m_slots[gen % m_maxnum];
+        slot.writers.fetch_add(1);
+        // pairs with the writers check in Retire, either the slot is still current or we back off.
+        if (m_gen.load() == gen)
+        {
+            return FileHandle(&slot);
+        }
+        slot.writers.fetch_sub(1, std::memory_order_release);
+    }
+}
+
+void RECLOG::DiskFileCluster::AtExit()
+{
+    std::lock_guard<std::mutex> lock(m_rotate);
+    {
+        std::lock_guard<std::mutex> plock(m_prepared->lock);
+        m_prepared->file.reset();
+    }
+    if (!m_slots)
+    {
+        return;
+    }
+    for (size_t i = 0; i < m_maxnum; ++i)
+    {
+        auto &slot = m_slots[i];
+        while (slot.writers.load() != 0)
+        {
+            std::this_thread::yield();
+        }
+        if (slot.file)
+        {
+            slot.file->Mark(false);
+            slot.file.reset();
+        }
+    }
+}
+
+bool RECLOG::RenderCbor(const void *src, size_t len, std::string &out)
+{
+    BufferInput input(static_cast<const unsigned char *>(src), len);
+    CborText handler(out);
+    cborio::decoder(input, handler).run();
+    return input.Done() && !handler.Failed();
+}
+
+size_t RECLOG::WriteRecord(CodeType type, DiskFileCluster *dest, const void *src, size_t len)
+{
+    if (dest == nullptr)
+    {
+        auto &fp = RECONFIG::GetCurLogFp();
+        if (type == CodeType::LOG)
+        {
+            return fp->WriteData(std::string(static_cast<const char *>(src), len));
+        }
+        if (type == CodeType::CBOR && RECONFIG::g_option.screen_cbor)
+        {
+            std::string text;
+            if (RenderCbor(src, len, text))
             {
-                m_filelist.pop();
+                return fp->WriteData(text);
             }
         }
-    } while (!size_reset);
-    return m_filelist.back();
+        return fp->WriteData(src, sizeof(char), len);
+    }
+    // disk sinks write text and bytes alike, no need for a temporary string.
+    auto handle = dest->GetCurFileFp();
+    auto start = Clock::Ticks();
+    auto bytes_writed = WriteSchemas(dest, handle);
+    bytes_writed += handle->WriteData(src, sizeof(char), len);
+    StatRegistry::Latency(LatencyId::WRITE, start);
+    StatRegistry::Count(StatId::WRITTEN, bytes_writed);
+    dest->IncraeseBytes(bytes_writed);
+    return bytes_writed;
 }
 
 RECLOG::FilePtr &RECLOG::RECONFIG::GetCurLogFp()
@@ -331,67 +1159,207 @@ RECLOG::FilePtr &RECLOG::RECONFIG::GetCurLogFp()
     return RECLOG::RECONFIG::screenfile;
 }
 
-void InitIMPL(const char *filename, bool Compressed)
+void InitIMPL(const char *filename, const RECLOG::RECOPTION &option)
 {
 #if __GNUC__
     install_signal_handlers();
 #endif
     RECLOG::RECONFIG::start_time = get_date_time();
+    // the crash handler can only read a calibration, never make the first one.
+    RECLOG::Clock::Calibrate();
+    RECLOG::RECONFIG::g_option = option;
+    RECLOG::RECONFIG::SetVerbosity(option.verbosity);
     RECLOG::RECONFIG::GetCurLogFp().reset(new FileScreen());
     if (strlen(filename) != 0)
     {
-        RECLOG::RECONFIG::g_compress = Compressed;
+        RECLOG::RECONFIG::g_compress = option.compressed;
         RECLOG::RECONFIG::g_flist_cbor.SetRootName(filename);
         RECLOG::RECONFIG::g_flist_log.SetRootName(filename);
         RECLOG::RECONFIG::g_flist_raw.SetRootName(filename);
+        RECLOG::RECONFIG::g_flist_cbor.SetPolicy(option);
+        RECLOG::RECONFIG::g_flist_log.SetPolicy(option);
+        RECLOG::RECONFIG::g_flist_raw.SetPolicy(option);
     }
     else
     {
         print_header();
     }
+    if (!option.shm_channel.empty())
+    {
+        auto producer = std::make_shared<RECLOG::ShmProducer>(option.shm_channel);
+        if (producer->Valid())
+        {
+            // records from other processes are merged one by one, file headers of their own would not survive.
+            RECLOG::RECONFIG::g_option.deferred = false;
+            RECLOG::RECONFIG::g_option.cbor_schema = false;
+            RECLOG::RECONFIG::g_flist_cbor.SetTransport(
+                std::make_shared<RECLOG::FileShm>(producer, RECLOG::CodeType::CBOR, &RECLOG::RECONFIG::g_flist_cbor));
+            RECLOG::RECONFIG::g_flist_log.SetTransport(
+                std::make_shared<RECLOG::FileShm>(producer, RECLOG::CodeType::LOG, &RECLOG::RECONFIG::g_flist_log));
+            RECLOG::RECONFIG::g_flist_raw.SetTransport(
+                std::make_shared<RECLOG::FileShm>(producer, RECLOG::CodeType::RAW, &RECLOG::RECONFIG::g_flist_raw));
+        }
+        else
+        {
+            RECLOG(STR) << "Failed to open the shm ring of " << option.shm_channel << ", writing own files";
+        }
+    }
+    RECLOG::RECONFIG::g_flist_cbor.SetOverload(option.overload);
+    RECLOG::RECONFIG::g_flist_log.SetOverload(option.overload);
+    RECLOG::RECONFIG::g_flist_raw.SetOverload(option.overload);
+    auto writer_pool = option.writer_pool;
+    auto file_pool = option.file_pool;
+    writer_pool.name = writer_pool.name.empty() ? "rec_writer" : writer_pool.name;
+    file_pool.name = file_pool.name.empty() ? "rec_files" : file_pool.name;
+    if (!RECLOG::RECONFIG::g_expool.configure(writer_pool) || !RECLOG::RECONFIG::g_copool.configure(file_pool))
+    {
+        RECLOG(STR) << "Failed to apply all pool options, some workers keep their defaults";
+    }
+    RECLOG::LogBackend::Instance().Start(RECLOG::RECONFIG::g_expool);
     atexit(RECLOG::RECONFIG::ExitREC);
 }
 
 void RECLOG::RECONFIG::InitREC(const char *RootName, bool Compressed)
 {
-    std::call_once(RECInitFlag, InitIMPL, RootName, Compressed);
+    RECOPTION option;
+    option.compressed = Compressed;
+    InitREC(RootName, option);
+}
+
+void RECLOG::RECONFIG::InitREC(const char *RootName, const RECOPTION &option)
+{
+    std::call_once(RECInitFlag, InitIMPL, RootName, option);
+}
+
+void RECLOG::RECONFIG::Flush()
+{
+    RECLOG::LogBackend::Instance().Flush();
+}
+
+bool RECLOG::RECONFIG::Flush(int timeout_ms)
+{
+    return RECLOG::LogBackend::Instance().Flush(true, timeout_ms);
+}
+
+size_t RECLOG::RECONFIG::Dropped()
+{
+    return RECLOG::LogBackend::Instance().ScreenDropped() + g_flist_cbor.Dropped() +
+           g_flist_log.Dropped() + g_flist_raw.Dropped();
+}
+
+RECLOG::RecStats RECLOG::RECONFIG::Stats()
+{
+    auto st = StatRegistry::Snapshot();
+    st.dropped = Dropped();
+    st.writer_pool = g_expool.stats();
+    st.file_pool = g_copool.stats();
+    return st;
+}
+
+void RECLOG::RECONFIG::AddSink(DiskFileCluster *route, std::shared_ptr<LogSink> sink)
+{
+    RECLOG::LogBackend::Instance().AddSink(route, std::move(sink));
+}
+
+void RECLOG::RECONFIG::RemoveSink(DiskFileCluster *route, const std::shared_ptr<LogSink> &sink)
+{
+    RECLOG::LogBackend::Instance().RemoveSink(route, sink);
+}
+
+std::vector<std::shared_ptr<RECLOG::LogSink>> RECLOG::RECONFIG::Sinks(DiskFileCluster *route)
+{
+    return RECLOG::LogBackend::Instance().Sinks(route);
 }
 
 void RECLOG::RECONFIG::ExitREC()
 {
+    RECLOG::LogBackend::Instance().Stop();
     RECLOG::RECONFIG::g_flist_cbor.AtExit();
     RECLOG::RECONFIG::g_flist_log.AtExit();
     RECLOG::RECONFIG::g_flist_raw.AtExit();
+    RECLOG::CrashRing::Close();
 }
 
 RECLOG::Codec_RAW::~Codec_RAW()
 {
-    auto bytes_writed = m_pFile->WriteData(m_ss.str().c_str(), sizeof(char), m_ss.str().length());
-    if (m_counted)
+    if (m_buf.get() == nullptr)
+    {
+        return;
+    }
+    auto site = m_site != nullptr ? m_site->id : REC_NO_SITE;
+    if (m_blobs.empty())
+    {
+        LogBackend::Instance().Submit(CodeType::RAW, m_pCluster, m_buf->str.data(), m_buf->str.size(), 0, site);
+    }
+    else
     {
-        RECLOG::RECONFIG::g_flist_raw.IncraeseBytes(bytes_writed);
+        LogBackend::Instance().Submit(CodeType::RAW, m_pCluster, m_buf->str.data(), m_buf->str.size(), m_blobs, site);
     }
 }
 
 RECLOG::Codec_CBO::~Codec_CBO()
 {
-    cbs << get_date_time() << get_thread_name();
-    auto bytes_writed = m_pFile->WriteData(cbs.u_str());
-    if (m_counted)
+    if (m_buf.get() == nullptr)
     {
-        RECLOG::RECONFIG::g_flist_cbor.IncraeseBytes(bytes_writed);
+        return;
+    }
+    // raw ticks, the writer or a reader converts them with the file's calibration.
+    cbs.write_tag(REC_TICKS_TAG);
+    cbs << Clock::Ticks() << get_thread_name();
+    auto &content = m_buf->buf;
+    auto site = m_site != nullptr ? m_site->id : REC_NO_SITE;
+    if (m_blobs.empty())
+    {
+        LogBackend::Instance().Submit(CodeType::CBOR, m_pCluster, content.data(), content.size(), 0, site);
+    }
+    else
+    {
+        LogBackend::Instance().Submit(CodeType::CBOR, m_pCluster, content.data(), content.size(), m_blobs, site);
+    }
+}
+
+RECLOG::Codec_STR::Codec_STR(DiskFileCluster *cluster, const LogSite *site)
+    : m_site(site), m_deferred(RECONFIG::g_option.deferred), m_stamp(0),
+      m_text(!m_deferred), m_args(m_deferred), m_pCluster(cluster)
+{
+    if (m_deferred)
+    {
+        m_args->str.assign(REC_DEFERRED_PREFIX, '\0');
+    }
+    else
+    {
+        // stamped when the statement starts, the text follows in the same buffer.
+        char preamble_buffer[REC_PREAMBLE_WIDTH];
+        print_preamble(preamble_buffer, sizeof(preamble_buffer), *m_site);
+        m_text->str.append(preamble_buffer);
+        m_stamp = static_cast<uint16_t>(m_text->str.size());
     }
 }
 
 RECLOG::Codec_STR::~Codec_STR()
 {
-    char preamble_buffer[REC_PREAMBLE_WIDTH];
-    print_preamble(preamble_buffer, sizeof(preamble_buffer), m_verbosity, _file, _line);
-    auto content = m_ss.str().insert(0, preamble_buffer);
-    auto bytes_writed = m_pFile->WriteData(content);
-    if (m_counted)
+    if (m_deferred && m_args.get() != nullptr)
     {
-        RECLOG::RECONFIG::g_flist_cbor.IncraeseBytes(bytes_writed);
+        auto &args = m_args->str;
+        auto prefix = reinterpret_cast<unsigned char *>(&args[0]);
+        store_le(prefix, m_site->id, 4);
+        store_le(prefix + 4, Clock::Ticks(), 8);
+        store_le(prefix + 12, get_thread_name(), 4);
+        if (RECONFIG::g_option.crash_ring)
+        {
+            CrashRing::Note(m_site, true, args.data(), args.size());
+        }
+        LogBackend::Instance().Submit(CodeType::LOG, m_pCluster, args.data(), args.size(),
+                                      REC_FLAG_DEFERRED | REC_FLAG_COLLAPSE, m_site->id, REC_DEFERRED_PREFIX);
+    }
+    else if (!m_deferred && m_text.get() != nullptr)
+    {
+        auto &content = m_text->str;
+        if (RECONFIG::g_option.crash_ring)
+        {
+            CrashRing::Note(m_site, false, content.data(), content.size());
+        }
+        LogBackend::Instance().Submit(CodeType::LOG, m_pCluster, content.data(), content.size(),
+                                      REC_FLAG_COLLAPSE, m_site->id, m_stamp);
     }
-    // printf("%s%s\n", preamble_buffer, m_ss.str().c_str());
-}
\ No newline at end of file
+}
@@ -0,0 +1,198 @@
+#include "gtest/gtest.h"
+#include "reclog.h"
+#include <atomic>
+#include <cstdlib>
+#include <functional>
+#include <new>
+#include <queue>
+
+// heap allocations made by the current thread.
+static thread_local size_t alloc_count = 0;
+// and by all threads, pool tasks allocate wherever they run.
+static std::atomic_size_t alloc_total(0);
+
+void *operator new(std::size_t size)
+{
+    ++alloc_count;
+    alloc_total.fetch_add(1, std::memory_order_relaxed);
+    if (void *ptr = std::malloc(size == 0 ? 1 : size))
+    {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+// gcc inlines the replaced new into its callers and then flags the free below as a mismatch,
+// both sides are the replacements here and always pair malloc with free.
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void operator delete(void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+
+DEFINE_STRUCT(ALLOC_POINT,
+              (int)a,
+              (double)b);
+
+constexpr int REC_ALLOC_WARMUP = 16;
+constexpr int REC_ALLOC_LOOPS = 1000;
+
+class RECALLOC_TestCase : public ::testing::Test
+{
+public:
+    RECALLOC_TestCase()
+    {
+        RECLOG::RECONFIG::InitREC("at");
+    }
+
+    // allocations per call once buffers, rings and sites exist.
+    template <typename F>
+    double count_steady(F &&f)
+    {
+        for (int i = 0; i < REC_ALLOC_WARMUP; ++i)
+        {
+            f(i);
+        }
+        auto before = alloc_count;
+        for (int i = 0; i < REC_ALLOC_LOOPS; ++i)
+        {
+            f(i);
+        }
+        auto allocs = alloc_count - before;
+        RECLOG::RECONFIG::Flush();
+        return static_cast<double>(allocs) / REC_ALLOC_LOOPS;
+    }
+};
+
+TEST_F(RECALLOC_TestCase, cbo_zero_alloc)
+{
+    ALLOC_POINT pt = {1, 2.5};
+    EXPECT_EQ(count_steady([&pt](int i)
+                           { RECFILE(CBO) << i << 3.25 << "cbor" << REFL(pt); }),
+              0.0);
+}
+
+TEST_F(RECALLOC_TestCase, raw_zero_alloc)
+{
+    std::vector<double> vec(32, 1.5);
+    EXPECT_EQ(count_steady([&vec](int i)
+                           { RECFILE(RAW) << i << vec; }),
+              0.0);
+}
+
+TEST_F(RECALLOC_TestCase, str_zero_alloc)
+{
+    std::string str("text");
+    ALLOC_POINT pt = {1, 2.5};
+    EXPECT_EQ(count_steady([&](int i)
+                           { RECFILE(STR) << i << ' ' << 3.25 << str << std::hex << i << REFL(pt); }),
+              0.0);
+}
+
+TEST_F(RECALLOC_TestCase, str_deferred_zero_alloc)
+{
+    std::string str("text");
+    RECLOG::RECONFIG::g_option.deferred = true;
+    auto allocs = count_steady([&str](int i)
+                               { RECFILE(STR) << i << ' ' << 3.25 << str << std::hex << i; });
+    RECLOG::RECONFIG::g_option.deferred = false;
+    EXPECT_EQ(allocs, 0.0);
+}
+
+// 56 bytes of closure, more than std::function keeps in place. each run posts the next.
+struct ALLOC_CHAIN
+{
+    FunctionPool *pool;
+    std::atomic_int *done;
+    int left;
+    uint64_t payload[5];
+
+    void operator()()
+    {
+        done->fetch_add(static_cast<int>(payload[0] & 1));
+        if (left > 0)
+        {
+            pool->post(ALLOC_CHAIN{pool, done, left - 1, {payload[0], 0, 0, 0, 0}});
+        }
+    }
+};
+
+TEST(RECALLOC_PoolCase, task_alloc)
+{
+    std::atomic_int done(0);
+    // what post and infinite_loop_func did before, bind into a std::function, queue it, copy it out.
+    std::queue<std::function<void()>> queue;
+    std::function<void()> func;
+    auto before = alloc_count;
+    for (int i = 0; i < REC_ALLOC_LOOPS; ++i)
+    {
+        queue.push(std::bind(ALLOC_CHAIN{nullptr, &done, 0, {1, 0, 0, 0, 0}}));
+        func = queue.front();
+        queue.pop();
+        func();
+    }
+    auto copied = static_cast<double>(alloc_count - before) / REC_ALLOC_LOOPS;
+
+    FunctionPool pool(1);
+    auto run = [&pool, &done](int tasks)
+    {
+        done.store(0);
+        // half come from outside, half are posted by the worker itself.
+        pool.post(ALLOC_CHAIN{&pool, &done, tasks / 2 - 1, {1, 0, 0, 0, 0}});
+        for (int i = 0; i < tasks / 2; ++i)
+        {
+            pool.post(ALLOC_CHAIN{&pool, &done, 0, {1, 0, 0, 0, 0}});
+        }
+        while (done.load() != tasks)
+        {
+            std::this_thread::yield();
+        }
+    };
+    run(2 * REC_ALLOC_WARMUP);
+    before = alloc_total.load();
+    run(REC_ALLOC_LOOPS);
+    auto pooled = static_cast<double>(alloc_total.load() - before) / REC_ALLOC_LOOPS;
+    printf("%.3lf allocations per task copied, %.3lf moved.\n", copied, pooled);
+    EXPECT_GE(copied, 2.0);
+    EXPECT_LT(pooled, 0.1);
+
+    // move only captures are fine now.
+    std::unique_ptr<int> owned(new int(7));
+    std::atomic_int seen(0);
+    pool.post([&seen](std::unique_ptr<int> &p)
+              { seen.store(*p); },
+              std::move(owned));
+    while (seen.load() == 0)
+    {
+        std::this_thread::yield();
+    }
+    EXPECT_EQ(seen.load(), 7);
+}
@@ -3,8 +3,20 @@
 #include "my_class.h"
 #include "reclog_impl.h"
 #include "test_tools.h"
+#include "ring_buffer.h"
+#include "log_backend.h"
+#include "rec_crash.h"
+#include "rec_shm.h"
+#include "rec_sink.h"
+#include <csignal>
 #include <thread>
 #include <iomanip>
+#include <fstream>
+#include <random>
+#include <cmath>
+#ifdef __linux__
+#include <dirent.h>
+#endif
 
 DEFINE_STRUCT(Point,
               (double)x,
@@ -21,6 +33,11 @@ DEFINE_STRUCT(TEST_CBOR,
               (int)a,
               (double)b);
 
+DEFINE_STRUCT(SCHEMA_SAMPLE,
+              (int)left_position,
+              (int)right_position,
+              (Point)scale_factor);
+
 void generate_rnd_str(std::vector<STRWNUM> &strlist, size_t &cnt)
 {
     std::mt19937 gen{std::random_device{}()};
@@ -86,6 +103,20 @@ public:
     }
 };
 
+class RECDEFER_TestCase : public ::testing::Test
+{
+public:
+    RECDEFER_TestCase()
+    {
+        RECLOG::RECOPTION option;
+        option.deferred = true;
+        RECLOG::RECONFIG::InitREC("st", option);
+        generate_rnd_str(strlist, cnt);
+    }
+    std::vector<STRWNUM> strlist;
+    size_t cnt;
+};
+
 struct test_encoder_stream_io
 {
     int a;
@@ -175,6 +206,91 @@ TEST_F(RECLOG_TestCase, sio_func)
     printf("%.2lf usecond per log.\n", elapsed / 10.0);
 }
 
+TEST_F(RECLOG_TestCase, sio_level)
+{
+    int evaluated = 0;
+    auto arg = [&evaluated]()
+    {
+        return ++evaluated;
+    };
+    RECLOG::RECONFIG::SetVerbosity(RECLOG::REC_LEVEL_INFO);
+    RECLOG_LVL(STR, DEBUG) << "hidden " << arg();
+    RECLOG_LVL(STR, WARNING) << "shown " << arg();
+    EXPECT_EQ(evaluated, 1);
+
+    // disabled statements cost one relaxed load and a compare.
+    constexpr int loops = 10000000;
+    Timer timer;
+    for (int i = 0; i < loops; ++i)
+    {
+        RECLOG_LVL(STR, TRACE) << "hidden " << i << arg();
+    }
+    double elapsed = timer.elapsed();
+    EXPECT_EQ(evaluated, 1);
+    printf("%.3lf nsecond per disabled log.\n", elapsed * 1e6 / loops);
+    RECLOG::RECONFIG::SetVerbosity(RECLOG_MAX_VERBOSITY);
+    RECLOG_LVL(STR, TRACE) << "shown " << arg();
+    EXPECT_EQ(evaluated, 2);
+}
+
+TEST_F(RECLOG_TestCase, sio_limit)
+{
+    int every = 0, first = 0, second = 0;
+    for (int i = 0; i < 100; ++i)
+    {
+        RECLOG_EVERY_N(STR, 10) << "every " << ++every;
+        RECLOG_FIRST_N(STR, 3) << "first " << ++first;
+        RECLOG_PER_SEC(STR, 5) << "second " << ++second;
+    }
+    EXPECT_EQ(every, 10);
+    EXPECT_EQ(first, 3);
+    // the loop may straddle two seconds.
+    EXPECT_GE(second, 5);
+    EXPECT_LE(second, 10);
+}
+
+TEST_F(RECLOG_TestCase, sio_sinks)
+{
+    auto memory = std::make_shared<RECLOG::MemorySink>(16);
+    RECLOG::RECONFIG::AddSink(nullptr, memory);
+    auto sinks = RECLOG::RECONFIG::Sinks(nullptr);
+    ASSERT_EQ(sinks.size(), 2u);
+    EXPECT_EQ(sinks[1], memory);
+    RECLOG(STR) << "fan out " << 1;
+    RECLOG::RECONFIG::Flush();
+    auto records = memory->Records();
+    ASSERT_EQ(records.size(), 1u);
+    EXPECT_NE(records[0].find("fan out 1"), std::string::npos);
+
+    // each sink filters on its own, the screen still shows DEBUG.
+    memory->SetLevel(RECLOG::REC_LEVEL_INFO);
+    RECLOG_LVL(STR, DEBUG) << "screen only";
+    RECLOG_LVL(STR, WARNING) << "both";
+    RECLOG(CBO) << "cbor" << 2;
+    RECLOG::RECONFIG::Flush();
+    records = memory->Records();
+    ASSERT_EQ(records.size(), 3u);
+    EXPECT_NE(records[1].find("both"), std::string::npos);
+    EXPECT_EQ(records[2][0], static_cast<char>(0x64));
+    RECLOG::RECONFIG::RemoveSink(nullptr, memory);
+    RECLOG(STR) << "screen again";
+    RECLOG::RECONFIG::Flush();
+    EXPECT_EQ(memory->Records().size(), 3u);
+}
+
+TEST(RECSCREEN_TestCase, render_cbor)
+{
+    cborio::ustring buf(64);
+    cborio::encoder en(buf);
+    en << "name" << 1.5 << std::vector<int>{1, -2} << 5000000000LL << std::map<std::string, bool>{{"x", true}};
+    std::string text;
+    ASSERT_TRUE(RECLOG::RenderCbor(buf.data(), buf.size(), text));
+    EXPECT_EQ(text, "\"name\" 1.5 [1, -2] 5000000000 {\"x\": true}");
+    // cut short, the array never closes.
+    text.clear();
+    EXPECT_FALSE(RECLOG::RenderCbor(buf.data(), 8, text));
+}
+
 TEST_F(RECLOG_TestCase, sio_speed)
 {
     test_print_speed(strlist, cnt, [](const STRWNUM &stw)
@@ -246,6 +362,444 @@ TEST_F(RECFILE_TestCase, fio_speed_md2)
     }
 }
 
+TEST_F(RECFILE_TestCase, fio_async_flush)
+{
+    std::vector<std::thread> thdvec;
+    for (size_t i = 0; i < 4; ++i)
+    {
+        thdvec.emplace_back([this]()
+                            { test_print_speed(strlist, cnt, [](const STRWNUM &stw)
+                                               { RECFILE(STR) << stw; }); });
+    }
+    for (size_t i = 0; i < thdvec.size(); ++i)
+    {
+        thdvec[i].join();
+    }
+    Timer timer;
+    RECLOG::RECONFIG::Flush();
+    printf("%.2lf msecond to flush.\n", timer.elapsed());
+}
+
+TEST(RECROTATE_TestCase, rotate_md)
+{
+    // rotations race with writers, every handle stays valid while it is held.
+    RECLOG::DiskFileCluster cluster("rt", RECLOG::CodeType::RAW);
+    std::string record(1000, 'r');
+    std::atomic_size_t total{0};
+    std::vector<std::thread> thdvec;
+    for (size_t i = 0; i < 4; ++i)
+    {
+        thdvec.emplace_back([&]()
+                            {
+                                size_t last_gen = 0;
+                                for (int j = 0; j < 1000; ++j)
+                                {
+                                    auto fp = cluster.GetCurFileFp();
+                                    EXPECT_GE(fp.Generation(), last_gen);
+                                    last_gen = fp.Generation();
+                                    auto bytes = fp->WriteData(record.data(), sizeof(char), record.size());
+                                    cluster.IncraeseBytes(bytes);
+                                    total += bytes;
+                                } });
+    }
+    for (size_t i = 0; i < thdvec.size(); ++i)
+    {
+        thdvec[i].join();
+    }
+    EXPECT_EQ(total.load(), 4 * 1000 * record.size());
+    EXPECT_GT(cluster.FileNo(), 1u);
+}
+
+TEST(RECROTATE_TestCase, rotate_policy)
+{
+    RECLOG::RECOPTION option;
+    option.max_filesize = 0;
+    option.rotate_seconds = 1;
+    option.max_filenum = 3;
+    option.disk_budget = 4000;
+    RECLOG::DiskFileCluster cluster("rp", RECLOG::CodeType::RAW);
+    cluster.SetPolicy(option);
+    std::string record(1000, 'p');
+    auto write = [&]()
+    {
+        auto bytes = cluster.GetCurFileFp()->WriteData(record.data(), sizeof(char), record.size());
+        cluster.IncraeseBytes(bytes);
+    };
+    write();
+    write();
+    EXPECT_EQ(cluster.FileNo(), 1u);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+    write();
+    EXPECT_EQ(cluster.FileNo(), 2u);
+
+    option.max_filesize = 1000;
+    option.rotate_seconds = 0;
+    RECLOG::DiskFileCluster sized("rs", RECLOG::CodeType::RAW);
+    sized.SetPolicy(option);
+    for (int i = 0; i < 10; ++i)
+    {
+        auto bytes = sized.GetCurFileFp()->WriteData(record.data(), sizeof(char), record.size());
+        sized.IncraeseBytes(bytes);
+    }
+    EXPECT_EQ(sized.FileNo(), 10u);
+}
+
+#ifdef __linux__
+TEST(RECROTATE_TestCase, rotate_mapped)
+{
+    RECLOG::RECOPTION option;
+    option.mapped = true;
+    option.max_filesize = 1 << 20;
+    {
+        RECLOG::DiskFileCluster cluster("mp_", RECLOG::CodeType::RAW);
+        cluster.SetPolicy(option);
+        std::string record(1000, 'm');
+        std::vector<std::thread> thdvec;
+        for (size_t i = 0; i < 4; ++i)
+        {
+            thdvec.emplace_back([&]()
+                                {
+                                    for (int j = 0; j < 1000; ++j)
+                                    {
+                                        auto bytes = cluster.GetCurFileFp()->WriteData(record.data(), sizeof(char), record.size());
+                                        cluster.IncraeseBytes(bytes);
+                                    } });
+        }
+        for (size_t i = 0; i < thdvec.size(); ++i)
+        {
+            thdvec[i].join();
+        }
+        cluster.AtExit();
+    }
+    // every byte made it into one of the kept files.
+    size_t total = 0;
+    size_t files = 0;
+    auto dir = opendir(".");
+    ASSERT_NE(dir, nullptr);
+    while (auto entry = readdir(dir))
+    {
+        std::string name(entry->d_name);
+        if (name.compare(0, 3, "mp_") != 0)
+        {
+            continue;
+        }
+        std::ifstream ifs(name, std::ios_base::binary);
+        std::string content((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+        EXPECT_EQ(content.find_first_not_of('m'), std::string::npos);
+        total += content.size();
+        ++files;
+        remove(name.c_str());
+    }
+    closedir(dir);
+    EXPECT_EQ(total, 4u * 1000 * 1000);
+    EXPECT_GT(files, 1u);
+}
+#endif
+
+TEST_F(RECFILE_TestCase, fio_durable_flush)
+{
+    for (size_t i = 0; i < 1000; ++i)
+    {
+        RECFILE(CBO) << strlist[i];
+        RECFILE(STR) << strlist[i];
+    }
+    Timer timer;
+    EXPECT_TRUE(RECLOG::RECONFIG::Flush(5000));
+    printf("%.2lf msecond to sync.\n", timer.elapsed());
+}
+
+#ifdef __linux__
+// every file of a private cluster, deleted once read.
+std::string take_files(const char *root)
+{
+    std::string content;
+    auto dir = opendir(".");
+    while (dir != nullptr)
+    {
+        auto entry = readdir(dir);
+        if (entry == nullptr)
+        {
+            closedir(dir);
+            break;
+        }
+        std::string name(entry->d_name);
+        if (name.compare(0, strlen(root), root) == 0)
+        {
+            std::ifstream ifs(name, std::ios_base::binary);
+            content.append((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+            remove(name.c_str());
+        }
+    }
+    return content;
+}
+
+TEST_F(RECFILE_TestCase, fio_durable_rotated)
+{
+    RECLOG::RECOPTION option;
+    option.max_filesize = 1000;
+    option.max_filenum = 4;
+    RECLOG::DiskFileCluster cluster("dr_rotated", RECLOG::CodeType::RAW);
+    cluster.SetPolicy(option);
+    std::string record(1000, 'r');
+    RECLOG::Codec_RAW(&cluster) << record;
+    RECLOG::RECONFIG::Flush();
+    auto before = RECLOG::RECONFIG::Stats().syncs;
+    // the first file is retired before the flush, it has to be synced all the same.
+    RECLOG::Codec_RAW(&cluster) << record;
+    EXPECT_TRUE(RECLOG::RECONFIG::Flush(5000));
+    EXPECT_GE(cluster.FileNo(), 2u);
+    EXPECT_GE(RECLOG::RECONFIG::Stats().syncs - before, 2u);
+    cluster.AtExit();
+    auto content = take_files("dr_rotated");
+    EXPECT_EQ(std::count(content.begin(), content.end(), 'r'), 2000);
+}
+
+TEST_F(RECFILE_TestCase, fio_collapse)
+{
+    // a cluster of its own, the repeat marker reaches the sink as text whether records are deferred or not.
+    auto memory = std::make_shared<RECLOG::MemorySink>(16);
+    {
+        RECLOG::DiskFileCluster cluster("co_collapse", RECLOG::CodeType::LOG);
+        RECLOG::RECONFIG::AddSink(&cluster, memory);
+        for (int i = 0; i < 100; ++i)
+        {
+            RECLOG::Codec_STR(&cluster, REC_SITE(0, RECLOG::CodeType::LOG)) << "collapse me " << 42;
+        }
+        RECLOG::Codec_STR(&cluster, REC_SITE(0, RECLOG::CodeType::LOG)) << "collapse done";
+        RECLOG::RECONFIG::Flush();
+        RECLOG::RECONFIG::RemoveSink(&cluster, memory);
+        cluster.AtExit();
+    }
+    take_files("co_collapse");
+    auto records = memory->Records();
+    ASSERT_EQ(records.size(), 3u);
+    EXPECT_NE(records[0].find("collapse me 42"), std::string::npos);
+    EXPECT_NE(records[1].find("previous record repeated 99 times"), std::string::npos);
+    EXPECT_NE(records[2].find("collapse done"), std::string::npos);
+}
+#endif
+
+#ifdef __linux__
+TEST_F(RECFILE_TestCase, fio_schema)
+{
+    SCHEMA_SAMPLE sample = {1, 2, {0.5, 0.25}};
+    auto write = [&sample](const char *root, bool schema) -> std::string
+    {
+        {
+            RECLOG::DiskFileCluster cluster(root, RECLOG::CodeType::CBOR);
+            RECLOG::RECONFIG::g_option.cbor_schema = schema;
+            for (int i = 0; i < 1000; ++i)
+            {
+                RECLOG::Codec_CBO(&cluster) << sample;
+            }
+            RECLOG::RECONFIG::g_option.cbor_schema = false;
+            RECLOG::RECONFIG::Flush();
+            cluster.AtExit();
+        }
+        std::string content;
+        auto dir = opendir(".");
+        while (dir != nullptr)
+        {
+            auto entry = readdir(dir);
+            if (entry == nullptr)
+            {
+                closedir(dir);
+                break;
+            }
+            std::string name(entry->d_name);
+            if (name.compare(0, strlen(root), root) == 0)
+            {
+                std::ifstream ifs(name, std::ios_base::binary);
+                content.append((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+                remove(name.c_str());
+            }
+        }
+        return content;
+    };
+    auto named = write("sc_named", false);
+    auto schema = write("sc_schema", true);
+    printf("%zu bytes with names, %zu bytes with a schema.\n", named.size(), schema.size());
+    EXPECT_LT(schema.size() * 2, named.size());
+    // the calibration leads the file, then the definitions, nested struct first, written once.
+    ASSERT_GT(schema.size(), 3u);
+    EXPECT_EQ(schema.compare(0, 3, "\xD9\x9C\xA7"), 0);
+    EXPECT_LT(schema.find("\xD9\x9C\xA4"), schema.find("\xD9\x9C\xA5"));
+    EXPECT_LT(schema.find("Point"), schema.find("SCHEMA_SAMPLE"));
+    EXPECT_EQ(schema.find("left_position"), schema.rfind("left_position"));
+}
+#endif
+
+#ifdef __linux__
+TEST(RECSCHEMA_TestCase, file_header)
+{
+    const unsigned char body[] = {0x64, 'T', 'E', 'S', 'T', 0x80};
+    RECLOG::SchemaRegistry::Add(body, sizeof(body));
+    // more clusters than any fixed table, the second round likely reuses the addresses of the first.
+    for (int round = 0; round < 2; ++round)
+    {
+        std::vector<std::unique_ptr<RECLOG::DiskFileCluster>> clusters;
+        std::vector<std::string> roots;
+        for (int i = 0; i < 10; ++i)
+        {
+            roots.push_back("sh_" + std::to_string(i) + "_");
+            clusters.emplace_back(new RECLOG::DiskFileCluster(roots.back().c_str(), RECLOG::CodeType::CBOR));
+            auto handle = clusters.back()->GetCurFileFp();
+            auto first = RECLOG::WriteSchemas(clusters.back().get(), handle);
+            EXPECT_GT(first, 0u);
+            // written once per file, only a recalibration in between is noted again.
+            EXPECT_LT(RECLOG::WriteSchemas(clusters.back().get(), handle), first);
+        }
+        for (auto &cluster : clusters)
+        {
+            cluster->AtExit();
+        }
+        clusters.clear();
+        for (auto &root : roots)
+        {
+            auto content = take_files(root.c_str());
+            // the calibration leads, the definitions follow.
+            EXPECT_EQ(content.compare(0, 3, "\xD9\x9C\xA7"), 0) << root;
+            EXPECT_NE(content.find("\xD9\x9C\xA4"), std::string::npos) << root;
+        }
+    }
+}
+#endif
+
+TEST(RECROTATE_TestCase, write_batch)
+{
+    RECLOG::DiskFileCluster cluster("wb", RECLOG::CodeType::RAW);
+    std::string a(100, 'a'), b(3000, 'b');
+    RECLOG::IoSpan spans[3] = {{a.data(), a.size()}, {b.data(), b.size()}, {a.data(), a.size()}};
+    EXPECT_EQ(cluster.GetCurFileFp()->WriteBatch(spans, 3), 3200u);
+}
+
+TEST(RECOVERLOAD_TestCase, ring_drop_oldest)
+{
+    RECLOG::RingBuffer ring(256);
+    auto push = [&ring](uint32_t len) -> bool
+    {
+        auto ptr = ring.Reserve(len);
+        if (ptr == nullptr)
+        {
+            return false;
+        }
+        memcpy(ptr, &len, sizeof(len));
+        ring.Commit();
+        return true;
+    };
+    EXPECT_TRUE(push(120));
+    EXPECT_TRUE(push(64));
+    EXPECT_TRUE(ring.Crowded());
+    EXPECT_FALSE(push(120));
+    size_t start = 0, end = 0;
+    auto oldest = ring.ClaimOldest(start, end);
+    ASSERT_NE(oldest, nullptr);
+    uint32_t len = 0;
+    memcpy(&len, oldest, sizeof(len));
+    EXPECT_EQ(len, 120u);
+    EXPECT_TRUE(ring.ReleaseOldest(start, end));
+    EXPECT_TRUE(push(120));
+    // the consumer never sees what the producer dropped.
+    auto front = ring.Claim();
+    ASSERT_NE(front, nullptr);
+    memcpy(&len, front, sizeof(len));
+    EXPECT_EQ(len, 64u);
+    ring.Release();
+    front = ring.Claim();
+    ASSERT_NE(front, nullptr);
+    memcpy(&len, front, sizeof(len));
+    EXPECT_EQ(len, 120u);
+    ring.Release();
+    EXPECT_EQ(ring.Claim(), nullptr);
+    EXPECT_TRUE(ring.Empty());
+    // the consumer holds the front entry, dropping the one after it would free nothing.
+    EXPECT_TRUE(push(120));
+    EXPECT_TRUE(push(64));
+    ASSERT_NE(ring.Claim(), nullptr);
+    EXPECT_FALSE(push(120));
+    EXPECT_EQ(ring.ClaimOldest(start, end), nullptr);
+    front = ring.Claim();
+    ASSERT_NE(front, nullptr);
+    memcpy(&len, front, sizeof(len));
+    EXPECT_EQ(len, 64u);
+    ring.Release();
+    EXPECT_TRUE(push(120));
+}
+
+TEST_F(RECFILE_TestCase, fio_drop_newest)
+{
+    RECLOG::OverloadPolicy policy;
+    policy.mode = RECLOG::RECOVERLOAD::DROP_NEWEST;
+    RECLOG::RECONFIG::g_flist_raw.SetOverload(policy);
+    auto before = RECLOG::RECONFIG::g_flist_raw.Dropped();
+    auto total = RECLOG::RECONFIG::Dropped();
+    // far more than one ring holds, written faster than any disk takes it.
+    std::string record(60000, 'd');
+    for (int i = 0; i < 2000; ++i)
+    {
+        RECFILE(RAW) << record;
+    }
+    RECLOG::RECONFIG::Flush();
+    RECLOG::RECONFIG::g_flist_raw.SetOverload(RECLOG::OverloadPolicy());
+    auto dropped = RECLOG::RECONFIG::g_flist_raw.Dropped() - before;
+    EXPECT_LT(dropped, 2000u);
+    EXPECT_EQ(RECLOG::RECONFIG::Dropped() - total, dropped);
+    printf("%zu of 2000 records dropped.\n", dropped);
+}
+
+TEST_F(RECFILE_TestCase, fio_stats)
+{
+    auto before = RECLOG::RECONFIG::Stats();
+    std::string record(100, 's');
+    for (int i = 0; i < 1000; ++i)
+    {
+        RECFILE(RAW) << record;
+    }
+    RECLOG::RECONFIG::Flush();
+    auto after = RECLOG::RECONFIG::Stats();
+    EXPECT_GE(after.records - before.records, 1000u);
+    EXPECT_GE(after.bytes - before.bytes, 100000u);
+    EXPECT_GE(after.written - before.written, 100000u);
+    EXPECT_GE(after.enqueue.count - before.enqueue.count, 1000u);
+    EXPECT_GT(after.write.count, before.write.count);
+    EXPECT_LE(after.enqueue.p50, after.enqueue.p99);
+    EXPECT_LE(after.enqueue.p99, after.enqueue.max);
+    EXPECT_GE(after.queued_peak, after.queued);
+    EXPECT_EQ(after.dropped, RECLOG::RECONFIG::Dropped());
+    EXPECT_GT(after.writer_pool.workers, 0u);
+    printf("enqueue p50 %.0lf p99 %.0lf max %.0lf ns, write p99 %.0lf ns.\n", after.enqueue.p50, after.enqueue.p99,
+           after.enqueue.max, after.write.p99);
+}
+
+TEST(RECSTATS_TestCase, histogram)
+{
+    using RECLOG::LatencyHistogram;
+    for (uint64_t v : {0ull, 1ull, 7ull, 8ull, 9ull, 15ull, 16ull, 17ull, 1000ull, 123456789ull, (1ull << 40) - 1})
+    {
+        auto bucket = LatencyHistogram::Bucket(v);
+        EXPECT_GE(LatencyHistogram::Upper(bucket), v);
+        if (bucket != 0)
+        {
+            EXPECT_LT(LatencyHistogram::Upper(bucket - 1), v);
+        }
+        // within an eighth of the value.
+        EXPECT_LE(LatencyHistogram::Upper(bucket) - v, v / 8);
+    }
+    EXPECT_EQ(LatencyHistogram::Bucket(1ull << 50), RECLOG::REC_HIST_BUCKETS - 1);
+    static LatencyHistogram hist;
+    for (uint64_t v = 1; v <= 1000; ++v)
+    {
+        hist.Record(v);
+    }
+    auto st = hist.Snapshot(2.0);
+    EXPECT_EQ(st.count, 1000u);
+    EXPECT_DOUBLE_EQ(st.mean, 1001.0);
+    EXPECT_DOUBLE_EQ(st.max, 2000.0);
+    EXPECT_NEAR(st.p50, 1000.0, 125.0);
+    EXPECT_NEAR(st.p99, 1980.0, 250.0);
+    EXPECT_LE(st.p999, st.max);
+}
+
 TEST_F(RECRAW_TestCase, raw_func)
 {
     TEST_CBOR tcb = {1, 8.9};
@@ -284,6 +838,588 @@ TEST_F(RECRAW_TestCase, raw_speed_md)
     }
 }
 
+#ifdef __linux__
+TEST_F(RECRAW_TestCase, raw_blob)
+{
+    // a frame the writer refers to, it is freed once its file write is done.
+    auto frame = std::make_shared<std::vector<unsigned char>>(1 << 16);
+    for (size_t i = 0; i < frame->size(); ++i)
+    {
+        (*frame)[i] = static_cast<unsigned char>(i * 7 + 3);
+    }
+    std::weak_ptr<std::vector<unsigned char>> watch(frame);
+    {
+        // a cluster of its own, the bytes checked are exactly the ones it received.
+        RECLOG::DiskFileCluster cluster("rb_blob", RECLOG::CodeType::RAW);
+        RECLOG::Codec_RAW(&cluster) << "FRAME<" << RECLOG::Blob(frame, frame->data(), frame->size()) << ">FRAME";
+        frame.reset();
+        RECLOG::RECONFIG::Flush();
+        EXPECT_TRUE(watch.expired());
+        cluster.AtExit();
+    }
+    std::vector<unsigned char> expect(1 << 16);
+    for (size_t i = 0; i < expect.size(); ++i)
+    {
+        expect[i] = static_cast<unsigned char>(i * 7 + 3);
+    }
+    EXPECT_EQ(take_files("rb_blob"), "FRAME<" + std::string(expect.begin(), expect.end()) + ">FRAME");
+}
+#endif
+
+TEST_F(RECDEFER_TestCase, dio_speed)
+{
+    test_print_speed(strlist, cnt, [](const STRWNUM &stw)
+                     { RECFILE(STR) << stw; });
+    RECLOG(STR) << "deferred " << std::showpoint << 2.25f << ' ' << std::hex << 255u;
+    RECLOG::RECONFIG::Flush();
+}
+
+TEST(RECDeferred, site_registry)
+{
+    auto cbor = REC_SITE(0, RECLOG::CodeType::CBOR);
+    auto text = REC_SITE(RECLOG::REC_LEVEL_ERROR, RECLOG::CodeType::LOG);
+    // registered once, in the order first reached, with ids that stay compact.
+    EXPECT_EQ(text->id, cbor->id + 1);
+    EXPECT_EQ(RECLOG::SiteRegistry::At(cbor->id), cbor);
+    EXPECT_EQ(RECLOG::SiteRegistry::At(text->id), text);
+    EXPECT_EQ(cbor->codec, RECLOG::CodeType::CBOR);
+    EXPECT_STREQ(text->name, "bag_test.cpp");
+    EXPECT_EQ(text->verbosity, RECLOG::REC_LEVEL_ERROR);
+    char where[RECLOG::REC_SITE_WHERE];
+    format_where(where, sizeof(where), __FILE__, text->line);
+    EXPECT_STREQ(text->where, where);
+    for (int i = 0; i < 2; ++i)
+    {
+        EXPECT_EQ(REC_SITE(0, RECLOG::CodeType::RAW)->id, text->id + 1);
+    }
+}
+
+#ifdef __linux__
+TEST(RECDeferred, file_header)
+{
+    // more clusters than any fixed table, the second round likely reuses the addresses of the first.
+    unsigned char record[RECLOG::REC_DEFERRED_PREFIX] = {};
+    for (int round = 0; round < 2; ++round)
+    {
+        std::vector<std::unique_ptr<RECLOG::DiskFileCluster>> clusters;
+        std::vector<std::string> roots;
+        for (int i = 0; i < 10; ++i)
+        {
+            roots.push_back("dh_" + std::to_string(i) + "_");
+            clusters.emplace_back(new RECLOG::DiskFileCluster(roots.back().c_str(), RECLOG::CodeType::LOG));
+            RECLOG::WriteDeferred(clusters.back().get(), record, sizeof(record));
+        }
+        for (auto &cluster : clusters)
+        {
+            cluster->AtExit();
+        }
+        clusters.clear();
+        for (auto &root : roots)
+        {
+            auto content = take_files(root.c_str());
+            EXPECT_EQ(content.compare(0, RECLOG::REC_BIN_MAGIC_LEN, RECLOG::REC_BIN_MAGIC), 0) << root;
+        }
+    }
+}
+#endif
+
+TEST(RECDeferred, render_args)
+{
+    std::string buf;
+    RECLOG::ArgWriter writer(buf);
+    std::ostringstream expect;
+    // user types are formatted on capture with a fresh stream state.
+    test_encoder_stream_io tesi(1, 1, 2.5, "opeassds");
+    writer.put(tesi);
+    expect << tesi;
+    writer.put("lots: ");
+    expect << "lots: ";
+    writer.put(std::showpoint);
+    expect << std::showpoint;
+    writer.put(3.141592f);
+    expect << 3.141592f;
+    writer.put('{');
+    expect << '{';
+    writer.put(-5);
+    expect << -5;
+    writer.put(std::numeric_limits<int64_t>::min());
+    expect << std::numeric_limits<int64_t>::min();
+    writer.put(uint64_t(887));
+    expect << uint64_t(887);
+    writer.put(std::setw(6));
+    expect << std::setw(6);
+    writer.put(std::string("str"));
+    expect << std::string("str");
+    writer.put(std::hex);
+    expect << std::hex;
+    writer.put(true);
+    expect << true;
+    writer.put(255u);
+    expect << 255u;
+    writer.put(5.599);
+    expect << 5.599;
+
+    std::ostringstream out;
+    EXPECT_TRUE(RECLOG::RenderArgs(reinterpret_cast<const unsigned char *>(buf.data()), buf.size(), out));
+    EXPECT_EQ(out.str(), expect.str());
+}
+
+TEST(RECFORMAT_TestCase, numbers)
+{
+    char buf[RECLOG::REC_NUMBER_CHARS];
+    auto text = [&buf](size_t n)
+    {
+        return std::string(buf, n);
+    };
+    EXPECT_EQ(text(RECLOG::FormatInt(buf, INT64_MIN)), "-9223372036854775808");
+    EXPECT_EQ(text(RECLOG::FormatUInt(buf, UINT64_MAX)), "18446744073709551615");
+    EXPECT_EQ(text(RECLOG::FormatInt(buf, 0)), "0");
+    // shortest text that reads back, fixed up to 1e16.
+    EXPECT_EQ(text(RECLOG::FormatDouble(buf, 0.1 + 0.2)), "0.30000000000000004");
+    EXPECT_EQ(text(RECLOG::FormatDouble(buf, 3.0)), "3");
+    EXPECT_EQ(text(RECLOG::FormatDouble(buf, -1.5e-7)), "-1.5e-07");
+    EXPECT_EQ(text(RECLOG::FormatDouble(buf, 1e17)), "1e+17");
+    EXPECT_EQ(text(RECLOG::FormatDouble(buf, 5e-324)), "5e-324");
+    EXPECT_EQ(text(RECLOG::FormatFloat(buf, 0.1f)), "0.1");
+    std::mt19937_64 gen(7);
+    for (int i = 0; i < 100000; ++i)
+    {
+        auto bits = gen();
+        double d;
+        memcpy(&d, &bits, sizeof(d));
+        if (std::isfinite(d))
+        {
+            ASSERT_EQ(strtod(text(RECLOG::FormatDouble(buf, d)).c_str(), nullptr), d);
+        }
+    }
+
+    // a changed stream state is left to the stream.
+    RECLOG::TextBuffer tb;
+    tb.Put(42);
+    tb.os << std::hex;
+    tb.Put(255);
+    tb.os << std::dec << std::setprecision(3);
+    tb.Put(3.14159);
+    EXPECT_EQ(tb.str, "42ff3.14");
+}
+
+TEST(RECCLOCK_TestCase, calibration)
+{
+    using namespace std::chrono;
+    RECLOG::Clock::Calibrate();
+    auto generation = RECLOG::Clock::Generation();
+    auto cal = RECLOG::Clock::Current();
+    EXPECT_GT(cal.ns_per_tick, 0.0);
+    // ticks map onto the wall clock within a few milliseconds and never run backwards.
+    auto wall = duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count();
+    auto first = RECLOG::Clock::Ticks();
+    EXPECT_LT(std::llabs(RECLOG::Clock::ToNanos(first, cal) - wall), 5000000LL);
+    std::this_thread::sleep_for(milliseconds(20));
+    auto second = RECLOG::Clock::Ticks();
+    auto elapsed = RECLOG::Clock::ToNanos(second, cal) - RECLOG::Clock::ToNanos(first, cal);
+    EXPECT_GE(elapsed, 20000000LL);
+    EXPECT_LT(elapsed, 200000000LL);
+    RECLOG::Clock::Calibrate();
+    EXPECT_EQ(RECLOG::Clock::Generation(), generation + 1);
+    RECLOG::ClockCalibration tried;
+    ASSERT_TRUE(RECLOG::Clock::TryCurrent(tried));
+    EXPECT_EQ(tried.base, RECLOG::Clock::Current().base);
+    auto now = RECLOG::Clock::Now();
+    EXPECT_LT(std::llabs(RECLOG::Clock::ToNanos(second, RECLOG::Clock::Current()) - RECLOG::Clock::ToNanos(second, cal)),
+              5000000LL);
+    EXPECT_GE(RECLOG::Clock::Now(), now);
+    // rebased no earlier than the mapping it replaced puts the new base.
+    auto last = RECLOG::Clock::Current();
+    RECLOG::Clock::Calibrate();
+    auto rebased = RECLOG::Clock::Current();
+    EXPECT_GE(rebased.wall, RECLOG::Clock::ToNanos(rebased.base, last));
+}
+
+TEST(RECCLOCK_TestCase, cbor_stamp)
+{
+    using namespace std::chrono;
+    // producers stamp raw ticks, the writer shows them as wall nanoseconds.
+    cborio::ustring buf(32);
+    cborio::encoder en(buf);
+    en.write_tag(RECLOG::REC_TICKS_TAG);
+    en << RECLOG::Clock::Ticks() << 7;
+    std::string text;
+    ASSERT_TRUE(RECLOG::RenderCbor(buf.data(), buf.size(), text));
+    auto wall = duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count();
+    auto space = text.find(' ');
+    ASSERT_NE(space, std::string::npos);
+    EXPECT_LT(std::llabs(std::stoll(text.substr(0, space)) - wall), 5000000LL);
+    EXPECT_EQ(text.substr(space), " 7");
+}
+
+TEST(RECCLOCK_TestCase, preamble_date)
+{
+    char first[REC_PREAMBLE_WIDTH], second[REC_PREAMBLE_WIDTH];
+    // the cached date of one second must not leak into the next one.
+    format_preamble(first, sizeof(first), 86400000LL * 365 + 999, 0, "1", 0, "where");
+    format_preamble(second, sizeof(second), 86400000LL * 365 + 1000, 0, "1", 0, "where");
+    EXPECT_NE(std::string(first, 19), std::string(second, 19));
+    EXPECT_EQ(std::string(first + 19, 5), ".999 ");
+    EXPECT_EQ(std::string(second + 19, 5), ".000 ");
+}
+
+TEST(RECTHREAD_TestCase, context)
+{
+    auto &ctx = RECLOG::ThisThread();
+    EXPECT_NE(ctx.index, 0u);
+    EXPECT_EQ(&ctx, &RECLOG::ThisThread());
+    EXPECT_EQ(get_thread_name(), ctx.index);
+    uint32_t other = 0;
+    std::string text;
+    std::thread([&]()
+                {
+                    RECLOG::RECONFIG::SetThreadName("io_worker_long");
+                    other = RECLOG::ThisThread().index;
+                    text = RECLOG::ThisThread().text; })
+        .join();
+    EXPECT_NE(other, ctx.index);
+    // the preamble column keeps its width, the registry has the whole name.
+    EXPECT_EQ(text, std::string("io_worker_long").substr(0, REC_THREADNAME_WIDTH));
+    EXPECT_EQ(RECLOG::ThreadRegistry::Name(other), "io_worker_long");
+    EXPECT_EQ(RECLOG::ThreadRegistry::Name(ctx.index), "");
+}
+
+TEST(RECPOOL_TestCase, pool_speed)
+{
+    // roots come in through the injection queue and fan out on the workers that run them.
+    const int roots = 64;
+    const int leaves = 2048;
+    for (int workers = 1; workers <= 32; workers *= 2)
+    {
+        std::atomic_int finished(0);
+        std::atomic<uint64_t> sink(0);
+        Timer timer;
+        {
+            FunctionPool pool(workers);
+            for (int r = 0; r < roots; ++r)
+            {
+                pool.post([&pool, &finished, &sink](int seed)
+                          {
+                              for (int l = 0; l < leaves; ++l)
+                              {
+                                  pool.post([&finished, &sink](uint64_t v)
+                                            {
+                                                for (int i = 0; i < 64; ++i)
+                                                {
+                                                    v = v * 6364136223846793005ULL + 1442695040888963407ULL;
+                                                }
+                                                sink.fetch_add(v & 1, std::memory_order_relaxed);
+                                                finished.fetch_add(1, std::memory_order_relaxed);
+                                            },
+                                            static_cast<uint64_t>(seed * leaves + l));
+                              }
+                              finished.fetch_add(1, std::memory_order_relaxed);
+                          },
+                          r);
+            }
+            while (finished.load() != roots * (leaves + 1))
+            {
+                std::this_thread::yield();
+            }
+        }
+        double elapsed = timer.elapsed();
+        EXPECT_EQ(finished.load(), roots * (leaves + 1));
+        printf("%2d workers: %.2lf M tasks per second.\n", workers, roots * (leaves + 1) / elapsed / 1000.0);
+    }
+}
+
+TEST(RECPOOL_TestCase, submit_bulk_for)
+{
+    FunctionPool pool(4);
+    auto sum = pool.submit([](int a, int b)
+                           { return a + b; },
+                           2, 3);
+    auto fail = pool.submit([]()
+                            { throw std::runtime_error("task failed"); });
+    EXPECT_EQ(sum.get(), 5);
+    EXPECT_THROW(fail.get(), std::runtime_error);
+
+    std::atomic_int ran(0);
+    std::vector<std::function<void()>> jobs(100, [&ran]()
+                                            { ran.fetch_add(1); });
+    pool.post_bulk(jobs.begin(), jobs.end());
+
+    // a task waiting on its own parallel_for keeps its worker busy with the pieces.
+    std::vector<uint64_t> values(1 << 20);
+    auto filled = pool.submit([&pool, &values]()
+                              { pool.parallel_for(0, values.size(), 1024, [&values](size_t first, size_t last)
+                                                  {
+                                                      for (auto i = first; i < last; ++i)
+                                                      {
+                                                          values[i] = i * i;
+                                                      } }); });
+    filled.get();
+    for (size_t i = 0; i < values.size(); ++i)
+    {
+        ASSERT_EQ(values[i], i * i);
+    }
+    std::atomic<uint64_t> total(0);
+    pool.parallel_for(10, 1000, 7, [&total](size_t first, size_t last)
+                      {
+                          uint64_t part = 0;
+                          for (auto i = first; i < last; ++i)
+                          {
+                              part += i;
+                          }
+                          total.fetch_add(part); });
+    EXPECT_EQ(total.load(), 999u * 1000 / 2 - 45);
+    EXPECT_THROW(pool.parallel_for(0, 100, 1, [](size_t first, size_t)
+                                   {
+                                       if (first == 42)
+                                       {
+                                           throw std::out_of_range("piece failed");
+                                       } }),
+                 std::out_of_range);
+    while (ran.load() != 100)
+    {
+        std::this_thread::yield();
+    }
+}
+
+#ifdef __linux__
+TEST(RECPOOL_TestCase, lanes_and_options)
+{
+    struct Seen
+    {
+        char name[16];
+        int policy;
+        int nice;
+        int cpus;
+    };
+    auto look = []()
+    {
+        Seen seen = {};
+        pthread_getname_np(pthread_self(), seen.name, sizeof(seen.name));
+        seen.policy = sched_getscheduler(0);
+        seen.nice = getpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)));
+        cpu_set_t set;
+        sched_getaffinity(0, sizeof(set), &set);
+        seen.cpus = CPU_COUNT(&set);
+        return seen;
+    };
+    FunctionPool pool(2);
+    PoolOptions options;
+    options.name = "rec_test";
+    options.cpus = {0};
+    options.low_workers = 1;
+    options.low_nice = 5;
+    options.low_idle = true;
+    ASSERT_TRUE(pool.configure(options));
+
+    auto normal = pool.submit(look).get();
+    EXPECT_STREQ(normal.name, "rec_test/0");
+    EXPECT_EQ(normal.policy, SCHED_OTHER);
+    EXPECT_EQ(normal.cpus, 1);
+    // the idle lane only runs while this thread sleeps.
+    std::mutex lock;
+    std::condition_variable cond;
+    std::vector<Seen> low;
+    for (int i = 0; i < 8; ++i)
+    {
+        pool.post_low([&]()
+                      {
+                          auto seen = look();
+                          std::lock_guard<std::mutex> guard(lock);
+                          low.push_back(seen);
+                          cond.notify_all(); });
+    }
+    std::unique_lock<std::mutex> guard(lock);
+    cond.wait(guard, [&low]()
+              { return low.size() == 8; });
+    for (auto &seen : low)
+    {
+        EXPECT_STREQ(seen.name, "rec_test/1");
+        EXPECT_EQ(seen.policy, SCHED_IDLE);
+        EXPECT_EQ(seen.nice, 5);
+        EXPECT_EQ(seen.cpus, 1);
+    }
+}
+#endif
+
+TEST(RECCRASH_TestCase, ring_wrap)
+{
+    auto site = REC_SITE(0, RECLOG::CodeType::LOG);
+    auto note = [site](const std::string &text)
+    { RECLOG::CrashRing::Note(site, false, text.data(), text.size()); };
+    // one thread wraps its own ring, two more come one after the other.
+    std::thread([&note]()
+                {
+                    for (size_t i = 0; i < RECLOG::REC_CRASH_SLOTS + 10; ++i)
+                    {
+                        note("wrap " + std::to_string(i) + "\n");
+                    } })
+        .join();
+    std::thread([&note]()
+                { note("wrap second\n"); })
+        .join();
+    std::thread([&note]()
+                { note("wrap third\n"); })
+        .join();
+    auto fp = tmpfile();
+    ASSERT_NE(fp, nullptr);
+    RECLOG::CrashRing::DumpRecords(fileno(fp));
+    rewind(fp);
+    std::vector<std::string> lines;
+    char line[512];
+    while (fgets(line, sizeof(line), fp) != nullptr)
+    {
+        // other tests leave records of their own threads.
+        if (strncmp(line, "text wrap ", 10) == 0)
+        {
+            lines.emplace_back(line);
+        }
+    }
+    fclose(fp);
+    // only the newest records of a thread survive, oldest first across threads, newlines escaped.
+    ASSERT_EQ(lines.size(), RECLOG::REC_CRASH_SLOTS + 2);
+    EXPECT_EQ(lines.front(), "text wrap 10\\n\n");
+    EXPECT_EQ(lines[RECLOG::REC_CRASH_SLOTS - 1], "text wrap " + std::to_string(RECLOG::REC_CRASH_SLOTS + 9) + "\\n\n");
+    EXPECT_EQ(lines[RECLOG::REC_CRASH_SLOTS], "text wrap second\\n\n");
+    EXPECT_EQ(lines.back(), "text wrap third\\n\n");
+}
+
+#ifdef __linux__
+TEST(RECCRASH_TestCase, signal_dump)
+{
+    EXPECT_EXIT(
+        {
+            RECLOG::RECONFIG::InitREC();
+            RECLOG(STR) << "last words " << 42;
+            raise(SIGSEGV);
+        },
+        ::testing::KilledBySignal(SIGSEGV), "REC caught SIGSEGV");
+    std::string content;
+    auto dir = opendir(".");
+    while (dir != nullptr)
+    {
+        auto entry = readdir(dir);
+        if (entry == nullptr)
+        {
+            closedir(dir);
+            break;
+        }
+        std::string name(entry->d_name);
+        if (name.size() > 6 && name.compare(name.size() - 6, 6, ".crash") == 0)
+        {
+            std::ifstream ifs(name);
+            std::string text((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+            if (text.find("last words 42") != std::string::npos)
+            {
+                content = text;
+                remove(name.c_str());
+            }
+        }
+    }
+    // written by the handler alone, the symbols are left to crashsym.
+    EXPECT_EQ(content.compare(0, 20, "REC crash SIGSEGV 11"), 0);
+    EXPECT_NE(content.find("\nframe 0x"), std::string::npos);
+    EXPECT_NE(content.find("\nmap "), std::string::npos);
+    EXPECT_NE(content.find("\ntext "), std::string::npos);
+}
+#endif
+
+#ifdef __linux__
+TEST(RECSHM_TestCase, merge)
+{
+    auto channel = "t" + std::to_string(getpid());
+    {
+        RECLOG::ShmCollector collector(channel, "shm_merge", RECLOG::RECOPTION());
+        {
+            RECLOG::ShmProducer first(channel), second(channel, 4096);
+            ASSERT_TRUE(first.Valid());
+            ASSERT_TRUE(second.Valid());
+            for (int i = 0; i < 4; ++i)
+            {
+                auto a = "a" + std::to_string(i) + ";";
+                auto b = "b" + std::to_string(i) + ";";
+                EXPECT_TRUE(first.Put(RECLOG::CodeType::LOG, a.data(), a.size()));
+                EXPECT_TRUE(second.Put(RECLOG::CodeType::LOG, b.data(), b.size()));
+            }
+            // nobody drained the small ring yet, it drops instead of waiting.
+            std::string big(1000, 'x');
+            size_t kept = 0;
+            for (int i = 0; i < 8; ++i)
+            {
+                kept += second.Put(RECLOG::CodeType::RAW, big.data(), big.size()) ? 1 : 0;
+            }
+            EXPECT_LT(kept, 8u);
+            EXPECT_EQ(second.Dropped(), 8 - kept);
+            collector.Poll();
+            EXPECT_EQ(collector.Rings(), 2u);
+        }
+        collector.Stop();
+        EXPECT_EQ(collector.Rings(), 0u);
+    }
+    std::string content;
+    bool leftover = false;
+    auto dir = opendir(".");
+    while (dir != nullptr)
+    {
+        auto entry = readdir(dir);
+        if (entry == nullptr)
+        {
+            closedir(dir);
+            break;
+        }
+        std::string name(entry->d_name);
+        if (name.compare(0, 9, "shm_merge") == 0)
+        {
+            if (name.size() > 4 && name.compare(name.size() - 4, 4, ".log") == 0)
+            {
+                std::ifstream ifs(name, std::ios_base::binary);
+                content.append((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+            }
+            remove(name.c_str());
+        }
+    }
+    // one file for both producers, in the order the records were made.
+    EXPECT_EQ(content, "a0;b0;a1;b1;a2;b2;a3;b3;");
+    dir = opendir(RECLOG::REC_SHM_DIR);
+    while (dir != nullptr)
+    {
+        auto entry = readdir(dir);
+        if (entry == nullptr)
+        {
+            closedir(dir);
+            break;
+        }
+        leftover = leftover || std::string(entry->d_name).find("rec." + channel + ".") == 0;
+    }
+    EXPECT_FALSE(leftover);
+}
+
+TEST(RECSHM_TestCase, blob)
+{
+    // the records go through the writer, blobs by reference.
+    RECLOG::RECONFIG::InitREC("st");
+    auto channel = "b" + std::to_string(getpid());
+    {
+        RECLOG::ShmCollector collector(channel, "shm_blob", RECLOG::RECOPTION());
+        {
+            auto producer = std::make_shared<RECLOG::ShmProducer>(channel);
+            ASSERT_TRUE(producer->Valid());
+            RECLOG::DiskFileCluster cluster("shm_source", RECLOG::CodeType::RAW);
+            cluster.SetTransport(std::make_shared<RECLOG::FileShm>(producer, RECLOG::CodeType::RAW, &cluster));
+            // one entry per record, a blob never travels apart from what surrounds it.
+            RECLOG::Codec_RAW(&cluster) << "HEAD" << RECLOG::Blob(std::vector<char>(1000, 'b')) << "TAIL";
+            RECLOG::Codec_RAW(&cluster) << "HEAD" << RECLOG::Blob(std::vector<char>(3 << 20, 'x')) << "TAIL";
+            RECLOG::RECONFIG::Flush();
+            // larger than half the ring, lost whole and counted like any other drop.
+            EXPECT_EQ(cluster.Dropped(), 1u);
+            EXPECT_EQ(producer->Dropped(), 1u);
+            cluster.AtExit();
+        }
+        collector.Stop();
+    }
+    EXPECT_EQ(take_files("shm_blob"), "HEAD" + std::string(1000, 'b') + "TAIL");
+}
+#endif
+
 TEST(RECBORSTREAM, test)
 {
     RECLOG::RECONFIG::InitREC("st");
@@ -0,0 +1,373 @@
+#include "rec_clock.h"
+#include "rec_schema.h"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <vector>
+
+// renders .cbor files as text, one top level item per line.
+// structs written with RECOPTION::cbor_schema get their struct and field names back,
+// and every thread name given so far shows as a line of its own.
+// record stamps are converted to wall nanoseconds with the calibration noted before them.
+// usage: cbo2txt <input.cbor> [output.txt]
+
+struct Schema
+{
+    std::string name;
+    std::vector<std::string> fields;
+};
+
+class Reader
+{
+public:
+    Reader(const unsigned char *data, size_t len) : m_ptr(data), m_end(data + len) {}
+
+    bool Done() const
+    {
+        return m_ptr >= m_end;
+    }
+
+    // one item as text, definitions are kept and render as nothing.
+    bool Item(std::string &out)
+    {
+        int major = 0, minor = 0;
+        uint64_t value = 0;
+        if (!Head(major, minor, value))
+        {
+            return false;
+        }
+        std::ostringstream os;
+        switch (major)
+        {
+        case 0:
+            os << value;
+            break;
+        case 1:
+            os << "-" << value + 1;
+            break;
+        case 2:
+        case 3:
+        {
+            if (value > static_cast<uint64_t>(m_end - m_ptr))
+            {
+                return false;
+            }
+            std::string str(reinterpret_cast<const char *>(m_ptr), static_cast<size_t>(value));
+            m_ptr += value;
+            if (major == 3)
+            {
+                os << '"' << str << '"';
+            }
+            else
+            {
+                os << "h'" << std::hex;
+                for (auto c : str)
+                {
+                    os << (static_cast<unsigned>(static_cast<unsigned char>(c)) >> 4) << (c & 0xF);
+                }
+                os << "'";
+            }
+            break;
+        }
+        case 4:
+        case 5:
+        {
+            os << (major == 4 ? '[' : '{');
+            for (uint64_t i = 0; i < value; ++i)
+            {
+                std::string elem;
+                if (!Item(elem))
+                {
+                    return false;
+                }
+                os << (i == 0 ? "" : ", ") << elem;
+                if (major == 5)
+                {
+                    if (!Item(elem))
+                    {
+                        return false;
+                    }
+                    os << ": " << elem;
+                }
+            }
+            os << (major == 4 ? ']' : '}');
+            break;
+        }
+        case 6:
+            if (value == RECLOG::REC_SCHEMA_DEF_TAG)
+            {
+                return Define(out);
+            }
+            if (value == RECLOG::REC_SCHEMA_TAG)
+            {
+                return Struct(out);
+            }
+            if (value == RECLOG::REC_THREAD_TAG)
+            {
+                return Thread(out);
+            }
+            if (value == RECLOG::REC_CLOCK_TAG)
+            {
+                return Calibration(out);
+            }
+            if (value == RECLOG::REC_TICKS_TAG && m_calibrated)
+            {
+                uint64_t ticks = 0;
+                if (!Unsigned(ticks))
+                {
+                    return false;
+                }
+                out = std::to_string(RECLOG::Clock::ToNanos(ticks, m_clock));
+                return true;
+            }
+            {
+                std::string elem;
+                if (!Item(elem))
+                {
+                    return false;
+                }
+                os << value << "(" << elem << ")";
+            }
+            break;
+        default:
+            Simple(os, minor, value);
+            break;
+        }
+        out = os.str();
+        return true;
+    }
+
+private:
+    const unsigned char *m_ptr;
+    const unsigned char *m_end;
+    std::map<uint64_t, Schema> m_schemas;
+    RECLOG::ClockCalibration m_clock{0, 0, 0};
+    bool m_calibrated = false;
+
+    bool Head(int &major, int &minor, uint64_t &value)
+    {
+        if (m_ptr >= m_end)
+        {
+            return false;
+        }
+        auto byte = *m_ptr++;
+        major = byte >> 5;
+        minor = byte & 0x1F;
+        value = static_cast<uint64_t>(minor);
+        if (minor >= 24 && minor <= 27)
+        {
+            size_t n = static_cast<size_t>(1) << (minor - 24);
+            if (n > static_cast<size_t>(m_end - m_ptr))
+            {
+                return false;
+            }
+            value = 0;
+            for (size_t i = 0; i < n; ++i)
+            {
+                value = (value << 8) | *m_ptr++;
+            }
+        }
+        else if (minor > 27)
+        {
+            // indefinite lengths are never written by the encoder.
+            return false;
+        }
+        return true;
+    }
+
+    bool Unsigned(uint64_t &value)
+    {
+        int major = 0, minor = 0;
+        return Head(major, minor, value) && major == 0;
+    }
+
+    bool Text(std::string &str)
+    {
+        int major = 0, minor = 0;
+        uint64_t len = 0;
+        if (!Head(major, minor, len) || major != 3 || len > static_cast<uint64_t>(m_end - m_ptr))
+        {
+            return false;
+        }
+        str.assign(reinterpret_cast<const char *>(m_ptr), static_cast<size_t>(len));
+        m_ptr += len;
+        return true;
+    }
+
+    bool Define(std::string &out)
+    {
+        int major = 0, minor = 0;
+        uint64_t count = 0, id = 0, fields = 0;
+        Schema schema;
+        if (!Head(major, minor, count) || major != 4 || count != 3 ||
+            !Unsigned(id) || !Text(schema.name) ||
+            !Head(major, minor, fields) || major != 4)
+        {
+            return false;
+        }
+        for (uint64_t i = 0; i < fields; ++i)
+        {
+            std::string str;
+            if (!Text(str))
+            {
+                return false;
+            }
+            // names and types alternate, only the names are needed to render.
+            if (i % 2 == 0)
+            {
+                schema.fields.push_back(str);
+            }
+        }
+        m_schemas[id] = schema;
+        out.clear();
+        return true;
+    }
+
+    bool Thread(std::string &out)
+    {
+        int major = 0, minor = 0;
+        uint64_t count = 0, index = 0;
+        std::string name;
+        if (!Head(major, minor, count) || major != 4 || count != 2 || !Unsigned(index) || !Text(name))
+        {
+            return false;
+        }
+        out = "thread " + std::to_string(index) + " \"" + name + "\"";
+        return true;
+    }
+
+    bool Calibration(std::string &out)
+    {
+        int major = 0, minor = 0;
+        uint64_t count = 0, wall = 0, rate = 0;
+        if (!Head(major, minor, count) || major != 4 || count != 3 || !Unsigned(m_clock.base) ||
+            !Unsigned(wall) || !Head(major, minor, rate) || major != 7 || minor != 27)
+        {
+            return false;
+        }
+        m_clock.wall = static_cast<long long>(wall);
+        memcpy(&m_clock.ns_per_tick, &rate, sizeof(rate));
+        m_calibrated = true;
+        out.clear();
+        return true;
+    }
+
+    bool Struct(std::string &out)
+    {
+        int major = 0, minor = 0;
+        uint64_t count = 0, id = 0;
+        if (!Head(major, minor, count) || major != 4 || count == 0 || !Unsigned(id))
+        {
+            return false;
+        }
+        auto iter = m_schemas.find(id);
+        std::ostringstream os;
+        os << (iter != m_schemas.end() ? iter->second.name : "?" + std::to_string(id)) << '{';
+        for (uint64_t i = 1; i < count; ++i)
+        {
+            std::string elem;
+            if (!Item(elem))
+            {
+                return false;
+            }
+            os << (i == 1 ? "" : ", ");
+            if (iter != m_schemas.end() && i - 1 < iter->second.fields.size())
+            {
+                os << iter->second.fields[i - 1] << ": ";
+            }
+            os << elem;
+        }
+        os << '}';
+        out = os.str();
+        return true;
+    }
+
+    void Simple(std::ostream &os, int minor, uint64_t value)
+    {
+        switch (minor)
+        {
+        case 20:
+            os << "false";
+            break;
+        case 21:
+            os << "true";
+            break;
+        case 22:
+            os << "null";
+            break;
+        case 23:
+            os << "undefined";
+            break;
+        case 25:
+        {
+            // half precision
+            auto exp = static_cast<int>((value >> 10) & 0x1F);
+            auto mant = static_cast<double>(value & 0x3FF);
+            double v = exp == 0 ? std::ldexp(mant, -24) : exp == 31 ? (mant == 0 ? INFINITY : NAN)
+                                                                    : std::ldexp(mant + 1024, exp - 25);
+            os << ((value & 0x8000) ? -v : v);
+            break;
+        }
+        case 26:
+        {
+            auto bits = static_cast<uint32_t>(value);
+            float v;
+            memcpy(&v, &bits, sizeof(v));
+            os << v;
+            break;
+        }
+        case 27:
+        {
+            double v;
+            memcpy(&v, &value, sizeof(v));
+            os << v;
+            break;
+        }
+        default:
+            os << "simple(" << value << ")";
+            break;
+        }
+    }
+};
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s <input.cbor> [output.txt]\n", argv[0]);
+        return 1;
+    }
+    std::ifstream ifs(argv[1], std::ios_base::binary);
+    if (!ifs.is_open())
+    {
+        fprintf(stderr, "can not open %s\n", argv[1]);
+        return 1;
+    }
+    std::string content((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+    std::ofstream ofs;
+    if (argc > 2)
+    {
+        ofs.open(argv[2], std::ios_base::binary);
+    }
+    std::ostream &os = argc > 2 ? ofs : std::cout;
+
+    Reader reader(reinterpret_cast<const unsigned char *>(content.data()), content.size());
+    std::string item;
+    while (!reader.Done())
+    {
+        if (!reader.Item(item))
+        {
+            fprintf(stderr, "malformed item\n");
+            return 2;
+        }
+        if (!item.empty())
+        {
+            os << item << '\n';
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,200 @@
+#include "reclog.h"
+#include "reclog_impl.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+// symbolizes the <pid>.crash file a signal left behind and renders the records it kept.
+// frames are resolved with addr2line against the modules listed in the file.
+// usage: crashsym <pid.crash> [output.txt]
+
+struct Module
+{
+    uint64_t start;
+    uint64_t end;
+    uint64_t offset;
+    std::string path;
+};
+
+static bool parse_map(const std::string &line, Module &mod)
+{
+    // start-end perms offset dev inode path
+    std::istringstream is(line);
+    std::string range, perms, offset, dev, inode;
+    if (!(is >> range >> perms >> offset >> dev >> inode >> mod.path) || mod.path[0] != '/')
+    {
+        return false;
+    }
+    auto dash = range.find('-');
+    if (dash == std::string::npos)
+    {
+        return false;
+    }
+    mod.start = strtoull(range.c_str(), nullptr, 16);
+    mod.end = strtoull(range.c_str() + dash + 1, nullptr, 16);
+    mod.offset = strtoull(offset.c_str(), nullptr, 16);
+    return true;
+}
+
+static std::string symbolize(uint64_t addr, const std::vector<Module> &modules)
+{
+    char buf[512];
+    for (auto &mod : modules)
+    {
+        if (addr < mod.start || addr >= mod.end)
+        {
+            continue;
+        }
+        // return addresses point past the call, step back into it.
+        auto rel = addr - mod.start + mod.offset - 1;
+        snprintf(buf, sizeof(buf), "addr2line -C -f -e '%s' 0x%llx 2>/dev/null", mod.path.c_str(),
+                 static_cast<unsigned long long>(rel));
+        std::string result;
+        auto pipe = popen(buf, "r");
+        if (pipe != nullptr)
+        {
+            std::string func, where;
+            if (fgets(buf, sizeof(buf), pipe) != nullptr)
+            {
+                func.assign(buf, strcspn(buf, "\n"));
+            }
+            if (fgets(buf, sizeof(buf), pipe) != nullptr)
+            {
+                where.assign(buf, strcspn(buf, "\n"));
+            }
+            pclose(pipe);
+            if (!func.empty() && func != "??")
+            {
+                result = func + " at " + where;
+            }
+        }
+        snprintf(buf, sizeof(buf), "%s+0x%llx", filename(mod.path.c_str()), static_cast<unsigned long long>(rel + 1));
+        return result.empty() ? std::string(buf) : result + " (" + buf + ")";
+    }
+    return "??";
+}
+
+static std::string unescape(const std::string &text)
+{
+    std::string out;
+    for (size_t i = 0; i < text.size(); ++i)
+    {
+        if (text[i] == '\\' && i + 1 < text.size())
+        {
+            out += text[++i] == 'n' ? '\n' : text[i];
+        }
+        else
+        {
+            out += text[i];
+        }
+    }
+    return out;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s <pid.crash> [output.txt]\n", argv[0]);
+        return 1;
+    }
+    std::ifstream ifs(argv[1]);
+    if (!ifs.is_open())
+    {
+        fprintf(stderr, "can not open %s\n", argv[1]);
+        return 1;
+    }
+    std::ofstream ofs;
+    if (argc > 2)
+    {
+        ofs.open(argv[2]);
+    }
+    std::ostream &os = argc > 2 ? ofs : std::cout;
+
+    std::vector<std::string> lines;
+    std::vector<Module> modules;
+    std::string line;
+    while (std::getline(ifs, line))
+    {
+        Module mod;
+        if (line.compare(0, 4, "map ") == 0)
+        {
+            if (parse_map(line.substr(4), mod))
+            {
+                modules.push_back(mod);
+            }
+            continue;
+        }
+        lines.push_back(line);
+    }
+
+    RECLOG::ClockCalibration cal = {0, 0, 1.0};
+    long long start_time = 0;
+    int frame = 0;
+    for (auto &item : lines)
+    {
+        auto space = item.find(' ');
+        auto kind = item.substr(0, space);
+        auto rest = space == std::string::npos ? std::string() : item.substr(space + 1);
+        if (kind == "clock" && rest == "uncalibrated")
+        {
+            os << "no clock calibration at the crash, times of deferred records are unknown.\n";
+        }
+        else if (kind == "clock")
+        {
+            std::istringstream is(rest);
+            std::string rate;
+            is >> cal.base >> cal.wall >> rate;
+            auto bits = static_cast<uint64_t>(strtoull(rate.c_str(), nullptr, 16));
+            memcpy(&cal.ns_per_tick, &bits, sizeof(bits));
+        }
+        else if (kind == "frame")
+        {
+            if (frame == 0)
+            {
+                os << "backtrace, innermost first:\n";
+            }
+            auto addr = static_cast<uint64_t>(strtoull(rest.c_str(), nullptr, 16));
+            os << "  #" << frame++ << ' ' << rest << ' ' << symbolize(addr, modules) << '\n';
+        }
+        else if (kind == "text")
+        {
+            os << unescape(rest) << '\n';
+        }
+        else if (kind == "args")
+        {
+            std::istringstream is(rest);
+            std::string file, hex;
+            unsigned site_line = 0;
+            int verbosity = 0;
+            is >> file >> site_line >> verbosity >> hex;
+            std::string data;
+            for (size_t i = 0; i + 1 < hex.size(); i += 2)
+            {
+                data += static_cast<char>(strtoul(hex.substr(i, 2).c_str(), nullptr, 16));
+            }
+            std::string text;
+            if (!RECLOG::RenderDeferred(reinterpret_cast<const unsigned char *>(data.data()), data.size(), start_time, cal,
+                                        std::string(), file.c_str(), site_line, verbosity, text))
+            {
+                // the slot kept only the head of a long record.
+                text += "[truncated]";
+            }
+            os << text << '\n';
+        }
+        else
+        {
+            auto start = item.find(" start ");
+            if (kind == "REC" && start != std::string::npos)
+            {
+                start_time = strtoll(item.c_str() + start + 7, nullptr, 10);
+                item.resize(start);
+            }
+            os << item << '\n';
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,125 @@
+#include "reclog.h"
+#include "reclog_impl.h"
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+
+// renders binary .log files written with RECOPTION::deferred back into the text layout.
+// usage: rec2txt <input.log> [output.txt]
+
+struct SiteInfo
+{
+    std::string file;
+    unsigned line;
+    int verbosity;
+};
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s <input.log> [output.txt]\n", argv[0]);
+        return 1;
+    }
+    std::ifstream ifs(argv[1], std::ios_base::binary);
+    if (!ifs.is_open())
+    {
+        fprintf(stderr, "can not open %s\n", argv[1]);
+        return 1;
+    }
+    std::string content((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+    std::ofstream ofs;
+    if (argc > 2)
+    {
+        ofs.open(argv[2], std::ios_base::binary);
+    }
+    std::ostream &os = argc > 2 ? ofs : std::cout;
+
+    if (content.compare(0, RECLOG::REC_BIN_MAGIC_LEN, RECLOG::REC_BIN_MAGIC) != 0)
+    {
+        // written as text already.
+        os << content;
+        return 0;
+    }
+
+    auto data = reinterpret_cast<const unsigned char *>(content.data());
+    size_t pos = RECLOG::REC_BIN_MAGIC_LEN;
+    long long start_time = 0;
+    RECLOG::ClockCalibration cal = {0, 0, 1.0};
+    std::map<uint32_t, SiteInfo> sites;
+    std::map<uint32_t, std::string> threads;
+    std::string line;
+    size_t bad = 0;
+    while (pos + 5 <= content.size())
+    {
+        auto kind = data[pos];
+        auto len = static_cast<size_t>(RECLOG::load_le(data + pos + 1, 4));
+        pos += 5;
+        if (len > content.size() - pos)
+        {
+            fprintf(stderr, "truncated frame at %zu\n", pos - 5);
+            return 2;
+        }
+        auto frame = data + pos;
+        pos += len;
+        switch (kind)
+        {
+        case RECLOG::FRAME_START:
+            if (len >= 8)
+            {
+                start_time = static_cast<long long>(RECLOG::load_le(frame, 8));
+            }
+            break;
+        case RECLOG::FRAME_CLOCK:
+            if (len >= 24)
+            {
+                auto rate = RECLOG::load_le(frame + 16, 8);
+                cal.base = RECLOG::load_le(frame, 8);
+                cal.wall = static_cast<long long>(RECLOG::load_le(frame + 8, 8));
+                memcpy(&cal.ns_per_tick, &rate, sizeof(rate));
+            }
+            break;
+        case RECLOG::FRAME_THREAD:
+            if (len >= 4)
+            {
+                auto &name = threads[static_cast<uint32_t>(RECLOG::load_le(frame, 4))];
+                name.assign(reinterpret_cast<const char *>(frame + 4), len - 4);
+            }
+            break;
+        case RECLOG::FRAME_SITE:
+            if (len >= 12)
+            {
+                SiteInfo info;
+                info.line = static_cast<unsigned>(RECLOG::load_le(frame + 4, 4));
+                info.verbosity = static_cast<int>(static_cast<uint32_t>(RECLOG::load_le(frame + 8, 4)));
+                info.file.assign(reinterpret_cast<const char *>(frame + 12), len - 12);
+                sites[static_cast<uint32_t>(RECLOG::load_le(frame, 4))] = info;
+            }
+            break;
+        case RECLOG::FRAME_RECORD:
+        {
+            auto iter = len >= 4 ? sites.find(static_cast<uint32_t>(RECLOG::load_le(frame, 4))) : sites.end();
+            // unnamed threads map to an empty name and show their index.
+            auto thread = len >= RECLOG::REC_DEFERRED_PREFIX ? threads[static_cast<uint32_t>(RECLOG::load_le(frame + 12, 4))]
+                                                             : std::string();
+            if (iter == sites.end() ||
+                !RECLOG::RenderDeferred(frame, len, start_time, cal, thread, iter->second.file.c_str(),
+                                        iter->second.line, iter->second.verbosity, line))
+            {
+                ++bad;
+                continue;
+            }
+            os << line << '\n';
+            break;
+        }
+        default:
+            break;
+        }
+    }
+    if (bad != 0)
+    {
+        fprintf(stderr, "%zu records could not be rendered\n", bad);
+    }
+    return bad == 0 ? 0 : 2;
+}
@@ -0,0 +1,46 @@
+#include "rec_shm.h"
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+
+// the single disk writer of a host: merges the shm rings of every process logging with
+// RECOPTION::shm_channel set into one set of files, until SIGINT or SIGTERM.
+// usage: reccollect <channel> <rootname> [max_filesize] [max_filenum]
+
+namespace
+{
+    volatile std::sig_atomic_t running = 1;
+
+    void stop(int)
+    {
+        running = 0;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "usage: %s <channel> <rootname> [max_filesize] [max_filenum]\n", argv[0]);
+        return 1;
+    }
+    RECLOG::RECOPTION option;
+    if (argc > 3)
+    {
+        option.max_filesize = strtoull(argv[3], nullptr, 10);
+    }
+    if (argc > 4)
+    {
+        option.max_filenum = strtoull(argv[4], nullptr, 10);
+    }
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+    RECLOG::ShmCollector collector(argv[1], argv[2], option);
+    collector.Start();
+    while (running)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    collector.Stop();
+    return 0;
+}